@@ -0,0 +1,89 @@
+'''
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+'''
+
+'''
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+'''
+
+'''
+bench_compare.py diffs two simavr_bench reports, e.g. one from master and one from a branch:
+
+    python3 bench_compare.py baseline.csv benchmark_report.csv [--fail-above PERCENT]
+
+Prints each probe's mean cycles and each memory section's size with the change from the baseline. With
+--fail-above, exits with status 1 if any probe's mean or any section grew by more than PERCENT, so it can gate CI.
+'''
+
+import argparse
+import csv
+import sys
+
+
+def read_report(path):
+    rows = {}
+    with open(path, newline='') as f:
+        for row in csv.DictReader(f):
+            rows[row['name']] = row
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare two simavr_bench reports.')
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    parser.add_argument('--fail-above', type=float, default=None, metavar='PERCENT',
+                        help='exit 1 if any figure grew by more than PERCENT')
+    args = parser.parse_args()
+
+    base = read_report(args.baseline)
+    curr = read_report(args.current)
+
+    print('{:<32} {:>7} {:>12} {:>12} {:>10} {:>8}'.format('name', 'kind', 'baseline', 'current', 'delta', '%'))
+    regressed = []
+    for name in list(base) + [n for n in curr if n not in base]:
+        b = base.get(name)
+        c = curr.get(name)
+        kind = (c or b)['kind']
+        b_val = float(b['mean']) if b else None
+        c_val = float(c['mean']) if c else None
+        if b_val is None or c_val is None:
+            print('{:<32} {:>7} {:>12} {:>12}'.format(name, kind, '-' if b is None else '{:.1f}'.format(b_val),
+                                                       '-' if c is None else '{:.1f}'.format(c_val)))
+            continue
+        delta = c_val - b_val
+        percent = 100.0 * delta / b_val if b_val else 0.0
+        print('{:<32} {:>7} {:>12.1f} {:>12.1f} {:>+10.1f} {:>+7.1f}%'.format(name, kind, b_val, c_val, delta, percent))
+        if args.fail_above is not None and percent > args.fail_above:
+            regressed.append(name)
+
+    if regressed:
+        print('\nregressed by more than {}%: {}'.format(args.fail_above, ', '.join(regressed)))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,177 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * bench_main.c is the firmware image for the cycle benchmark. It is built by `make benchmark` in a lab directory
+ * (see benchmark.mk) with MEGN540_BENCHMARK defined and run under simavr by simavr_bench.c, which times every
+ * BENCH_PROBE_BEGIN/END pair from the simulator's cycle counter.
+ *
+ * Each scenario runs BENCH_ITERATIONS times so the report has a min, max and mean. Timer0 is left off so no
+ * interrupt lands inside a probe except the encoder interrupts the encoder scenario raises on purpose.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "../c_lib/Benchmark_Probe.h"
+#include "../c_lib/SerialIO.h"
+#include "../c_lib/Encoder.h"
+#include "../c_lib/Filter.h"
+#include "../c_lib/Controller.h"
+#include "../c_lib/MEGN540_MessageHandeling.h"
+
+#define BENCH_ITERATIONS 64
+
+// Lab5's battery filter coefficients. Lab5 initializes it with filter_order+1 (5), so a zero sixth coefficient is
+// added here and Filter_Value is measured at the order the firmware runs
+#define BENCH_FILTER_ORDER 5
+static float _numerator[]   = { 0, 1.00000000002831, -6.2016614795055e-18, 7.98934716362488e-22, -7.81462568477543e-37, 0 };
+static float _denominator[] = { 1, -3.44897255468215e-11, 3.01641584463356e-22, 6.53851093191958e-37, 1.17549435e-38, 0 };
+
+static void Bench_Empty()
+{
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        BENCH_PROBE_BEGIN( BENCH_EMPTY );
+        BENCH_PROBE_END( BENCH_EMPTY );
+    }
+}
+
+static void Bench_Filter()
+{
+    Filter_Data_t filter;
+    Filter_Init( &filter, _numerator, _denominator, BENCH_FILTER_ORDER );
+
+    volatile float input = 4.8f;
+    float output;
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        BENCH_PROBE_BEGIN( BENCH_FILTER_VALUE );
+        output = Filter_Value( &filter, input );
+        BENCH_PROBE_END( BENCH_FILTER_VALUE );
+        input = output + 0.001f * i;
+    }
+}
+
+static void Bench_Cascade()
+{
+    Cascade_Controller_t cascade;
+    PI_Loop_Init( &cascade.position, 8.0f, 2.0f, 1.0f, 600.0f, 0.002f );
+    PI_Loop_Init( &cascade.velocity, 0.01f, 0.2f, 0.008f, 6.0f, 0.002f );
+    Cascade_Init( &cascade );
+
+    volatile float measured = 0;
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        BENCH_PROBE_BEGIN( BENCH_CASCADE_UPDATE );
+        float u = Cascade_Update( &cascade, 100.0f, 50.0f, measured, 40.0f );
+        BENCH_PROBE_END( BENCH_CASCADE_UPDATE );
+        measured = measured + u;
+    }
+}
+
+static void Bench_USB_Send()
+{
+    // the 'q' telemetry record Lab5 streams
+    struct __attribute__( ( __packed__ ) ) { float time; int16_t PWM_L; int16_t PWM_R; int16_t Encoder_L; int16_t Encoder_R; }
+            data = { 1.5f, 100, -100, 1234, -1234 };
+
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        usb_bench_discard_output();
+        BENCH_PROBE_BEGIN( BENCH_USB_SEND_MSG );
+        usb_send_msg( "cf4h", 'q', &data, sizeof( data ) );
+        BENCH_PROBE_END( BENCH_USB_SEND_MSG );
+    }
+    usb_bench_discard_output();
+}
+
+static void Bench_Message_Handling()
+{
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        BENCH_PROBE_BEGIN( BENCH_MESSAGE_HANDLING_IDLE );
+        Message_Handling_Task();
+        BENCH_PROBE_END( BENCH_MESSAGE_HANDLING_IDLE );
+    }
+
+    // '+' with two floats: parse, add, reply
+    struct __attribute__( ( __packed__ ) ) { char cmd; float a; float b; } add = { '+', 1.25f, 2.5f };
+    for( uint8_t i = 0; i < BENCH_ITERATIONS; i++ ) {
+        usb_bench_inject( (const uint8_t*)&add, sizeof( add ) );
+        BENCH_PROBE_BEGIN( BENCH_MESSAGE_HANDLING_CMD );
+        Message_Handling_Task();
+        BENCH_PROBE_END( BENCH_MESSAGE_HANDLING_CMD );
+        usb_bench_discard_output();
+    }
+}
+
+/**
+ * Walks both encoders through BENCH_ITERATIONS quadrature steps. The encoder pins are made outputs so the firmware
+ * can drive them itself; pin change and external interrupts still fire on output pins (datasheet 11.1), and the
+ * ISRs carry their own probes.
+ */
+static void Bench_Encoders()
+{
+    static const uint8_t a_of[4] = { 0, 1, 1, 0 };
+    static const uint8_t b_of[4] = { 0, 0, 1, 1 };
+
+    DDRB |= ( 1 << DDB4 );
+    DDRE |= ( 1 << DDE2 ) | ( 1 << DDE6 );
+    DDRF |= ( 1 << DDF0 );
+    Encoders_Init();
+    sei();
+
+    for( uint8_t i = 1; i <= BENCH_ITERATIONS; i++ ) {
+        uint8_t a = a_of[i & 0x03], b = b_of[i & 0x03];
+        PORTE = ( PORTE & ~( 1 << PORTE2 ) ) | ( b << PORTE2 );      // left B
+        PORTB = ( PORTB & ~( 1 << PORTB4 ) ) | ( ( a ^ b ) << PORTB4 );  // left xor, PCINT4
+        PORTF = ( PORTF & ~( 1 << PORTF0 ) ) | ( b << PORTF0 );      // right B
+        PORTE = ( PORTE & ~( 1 << PORTE6 ) ) | ( ( a ^ b ) << PORTE6 );  // right xor, INT6
+        asm volatile( "nop\n\tnop" );
+    }
+    cli();
+}
+
+int main( void )
+{
+    USB_SetupHardware();
+    Message_Handling_Init();
+
+    Bench_Empty();
+    Bench_Filter();
+    Bench_Cascade();
+    Bench_USB_Send();
+    Bench_Message_Handling();
+    Bench_Encoders();
+
+    BENCH_DONE();
+    cli();
+    sleep_enable();
+    sleep_cpu();
+    for( ;; )
+        ;
+}
@@ -0,0 +1,64 @@
+# Cycle benchmark target, included at the end of the lab Makefiles.
+#
+#   make benchmark                                 build the instrumented image, run it under simavr and write
+#                                                  benchmark_report.csv (cycles per probe, flash and RAM)
+#   make benchmark BENCH_BASELINE=old.csv          also print the change from an earlier report
+#   make benchmark BENCH_BASELINE=old.csv BENCH_FAIL_ABOVE=5
+#                                                  and fail if anything grew by more than 5%
+#   make clean_benchmark
+#
+# The image is Benchmark/bench_main.c linked with c_lib, compiled with this lab's flags plus MEGN540_BENCHMARK so
+# the Benchmark_Probe.h markers are live. Needs avr-gcc and simavr (headers and libsimavr, found with pkg-config).
+
+BENCH_DIR       = ../Benchmark
+BENCH_OBJDIR    = BIN-bench
+BENCH_ELF       = $(BENCH_OBJDIR)/benchmark.elf
+BENCH_RUNNER    = $(BENCH_OBJDIR)/simavr_bench
+BENCH_REPORT   ?= benchmark_report.csv
+HOST_CC        ?= cc
+SIMAVR_FLAGS   ?= $(shell pkg-config --cflags --libs simavr 2>/dev/null || echo -lsimavr) -lelf
+
+BENCH_SRC = $(BENCH_DIR)/bench_main.c \
+	$(MEGN_C_LIB_PATH)/SerialIO.c \
+	$(MEGN_C_LIB_PATH)/Ring_Buffer.c \
+	$(MEGN_C_LIB_PATH)/MEGN540_MessageHandeling.c \
+	$(MEGN_C_LIB_PATH)/Timing.c \
+	$(MEGN_C_LIB_PATH)/Encoder.c \
+	$(MEGN_C_LIB_PATH)/MotorPWM.c \
+	$(MEGN_C_LIB_PATH)/Battery_Monitor.c \
+	$(MEGN_C_LIB_PATH)/Filter.c \
+	$(MEGN_C_LIB_PATH)/Controller.c \
+	$(MEGN_C_LIB_PATH)/USB_Config/Descriptors.c \
+	$(LUFA_SRC_USB)
+
+# objects keep their source paths under BIN-bench, with ../ spelled _up_/ so they stay inside it
+BENCH_OBJ    = $(patsubst %.c,$(BENCH_OBJDIR)/%.o,$(subst ../,_up_/,$(BENCH_SRC)))
+BENCH_CFLAGS = -mmcu=$(MCU) -I. $(addprefix -I,$(EXTRAINCDIRS)) $(CFLAGS) $(CDEFS) -DMEGN540_BENCHMARK
+
+benchmark: $(BENCH_ELF) $(BENCH_RUNNER)
+	$(BENCH_RUNNER) $(BENCH_ELF) $(BENCH_REPORT)
+	@cat $(BENCH_REPORT)
+ifdef BENCH_BASELINE
+	python3 $(BENCH_DIR)/bench_compare.py $(BENCH_BASELINE) $(BENCH_REPORT) $(if $(BENCH_FAIL_ABOVE),--fail-above $(BENCH_FAIL_ABOVE))
+endif
+
+$(BENCH_ELF): $(BENCH_OBJ)
+	$(CC) $(BENCH_CFLAGS) $^ -o $@ $(LDFLAGS)
+	$(SIZE) $@
+
+$(BENCH_OBJDIR)/_up_/%.o: ../%.c
+	@mkdir -p $(dir $@)
+	$(CC) -c $(BENCH_CFLAGS) $< -o $@
+
+$(BENCH_OBJDIR)/%.o: %.c
+	@mkdir -p $(dir $@)
+	$(CC) -c $(BENCH_CFLAGS) $< -o $@
+
+$(BENCH_RUNNER): $(BENCH_DIR)/simavr_bench.c $(MEGN_C_LIB_PATH)/Benchmark_Probe.h
+	@mkdir -p $(dir $@)
+	$(HOST_CC) -O2 -o $@ $< $(SIMAVR_FLAGS)
+
+clean_benchmark:
+	rm -rf $(BENCH_OBJDIR) $(BENCH_REPORT)
+
+.PHONY: benchmark clean_benchmark
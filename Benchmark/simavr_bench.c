@@ -0,0 +1,172 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * simavr_bench runs a benchmark firmware image (bench_main.c) on simavr's ATmega32U4 core and reports the cycles
+ * spent between each BENCH_PROBE_BEGIN/END pair, plus the image's flash and RAM use.
+ *
+ *   simavr_bench <firmware.elf> [report.csv]
+ *
+ * The report is CSV, one row per probe and one per memory section:
+ *   name,kind,count,min,max,mean,total
+ *   <probe name>,cycles,<count>,<min>,<max>,<mean>,<total>
+ *   flash,bytes,1,<size>,<size>,<size>,<size>
+ * Cycle figures have the marker overhead (the minimum of the "empty" probe) taken off. bench_compare.py diffs two
+ * reports.
+ *
+ * Build against simavr (https://github.com/buserror/simavr), e.g.
+ *   cc -O2 -o simavr_bench simavr_bench.c $(pkg-config --cflags --libs simavr) -lelf
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+
+// the firmware's avr/io.h is not included on the host, so the shared probe header only supplies ids and names
+#include "../c_lib/Benchmark_Probe.h"
+
+#define GPIOR0_ADDR 0x3E  // data space address of GPIOR0 (I/O 0x1E)
+#define GPIOR1_ADDR 0x4A  // data space address of GPIOR1 (I/O 0x2A)
+#define MAX_CYCLES  200000000ULL  // give up after 12.5 simulated seconds
+
+#define BENCH_NAME_ENTRY( id, name ) name,
+static const char* const _probe_names[BENCH_PROBE_COUNT] = { BENCH_PROBES( BENCH_NAME_ENTRY ) };
+
+typedef struct { uint32_t count; uint64_t min; uint64_t max; uint64_t total; avr_cycle_count_t begin; int open; }
+        Probe_Stats_t;
+
+static Probe_Stats_t _stats[BENCH_PROBE_COUNT];
+static int _done        = 0;
+static int _unmatched   = 0;
+
+/**
+ * GPIOR0 write callback. The firmware writes the probe id to GPIOR1 first, so it is already in data space here.
+ */
+static void _marker_write( avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param )
+{
+    avr->data[addr] = value;
+
+    if( value == BENCH_MARK_DONE ) {
+        _done = 1;
+        return;
+    }
+
+    uint8_t id = avr->data[GPIOR1_ADDR];
+    if( id >= BENCH_PROBE_COUNT ) {
+        _unmatched++;
+        return;
+    }
+
+    Probe_Stats_t* p = &_stats[id];
+    if( value == BENCH_MARK_BEGIN ) {
+        p->begin = avr->cycle;
+        p->open  = 1;
+    } else if( value == BENCH_MARK_END && p->open ) {
+        uint64_t cycles = avr->cycle - p->begin;
+        if( p->count == 0 || cycles < p->min )
+            p->min = cycles;
+        if( cycles > p->max )
+            p->max = cycles;
+        p->total += cycles;
+        p->count++;
+        p->open = 0;
+    } else {
+        _unmatched++;
+    }
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 ) {
+        fprintf( stderr, "usage: %s <firmware.elf> [report.csv]\n", argv[0] );
+        return 2;
+    }
+
+    elf_firmware_t firmware;
+    memset( &firmware, 0, sizeof( firmware ) );
+    if( elf_read_firmware( argv[1], &firmware ) != 0 ) {
+        fprintf( stderr, "simavr_bench: could not read %s\n", argv[1] );
+        return 1;
+    }
+    strcpy( firmware.mmcu, "atmega32u4" );
+    firmware.frequency = 16000000;
+
+    avr_t* avr = avr_make_mcu_by_name( firmware.mmcu );
+    if( !avr ) {
+        fprintf( stderr, "simavr_bench: simavr has no %s core\n", firmware.mmcu );
+        return 1;
+    }
+    avr_init( avr );
+    avr_load_firmware( avr, &firmware );
+    avr_register_io_write( avr, GPIOR0_ADDR, _marker_write, NULL );
+
+    int state = cpu_Running;
+    while( !_done && avr->cycle < MAX_CYCLES && state != cpu_Done && state != cpu_Crashed )
+        state = avr_run( avr );
+
+    if( !_done ) {
+        fprintf( stderr, "simavr_bench: firmware did not finish (state %d, cycle %llu)\n", state,
+                 (unsigned long long)avr->cycle );
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if( argc > 2 && !( out = fopen( argv[2], "w" ) ) ) {
+        perror( argv[2] );
+        return 1;
+    }
+
+    uint64_t overhead = _stats[BENCH_EMPTY].count ? _stats[BENCH_EMPTY].min : 0;
+    fprintf( out, "name,kind,count,min,max,mean,total\n" );
+    for( int id = 0; id < BENCH_PROBE_COUNT; id++ ) {
+        Probe_Stats_t* p = &_stats[id];
+        if( p->count == 0 )
+            continue;
+        uint64_t min = p->min - overhead, max = p->max - overhead, total = p->total - overhead * p->count;
+        fprintf( out, "%s,cycles,%u,%llu,%llu,%.1f,%llu\n", _probe_names[id], p->count, (unsigned long long)min,
+                 (unsigned long long)max, (double)total / p->count, (unsigned long long)total );
+    }
+    uint32_t flash = firmware.flashsize;
+    uint32_t ram   = firmware.datasize + firmware.bsssize;
+    fprintf( out, "flash,bytes,1,%u,%u,%u,%u\n", flash, flash, flash, flash );
+    fprintf( out, "ram,bytes,1,%u,%u,%u,%u\n", ram, ram, ram, ram );
+
+    if( out != stdout )
+        fclose( out );
+    if( _unmatched )
+        fprintf( stderr, "simavr_bench: %d unmatched probe markers\n", _unmatched );
+    avr_terminate( avr );
+    return 0;
+}
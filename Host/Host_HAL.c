@@ -0,0 +1,696 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "Host_HAL.h"
+
+#include <setjmp.h>
+#include <stddef.h>
+
+/**
+ * The I/O registers. Listed once here so Host_HAL_Reset can return them all to zero, which is the reset value of
+ * every register emulated.
+ */
+#define HOST_REGISTERS_8( X )                                                                                         \
+    X( SREG ) X( GPIOR0 ) X( GPIOR1 ) X( GPIOR2 ) X( MCUSR ) X( MCUCR ) X( CLKPR ) X( PRR0 ) X( PRR1 )               \
+    X( PINB ) X( DDRB ) X( PORTB ) X( PINC ) X( DDRC ) X( PORTC ) X( PIND ) X( DDRD ) X( PORTD )                    \
+    X( PINE ) X( DDRE ) X( PORTE ) X( PINF ) X( DDRF ) X( PORTF )                                                   \
+    X( TCCR0A ) X( TCCR0B ) X( TCNT0 ) X( OCR0A ) X( OCR0B ) X( TIMSK0 ) X( TIFR0 ) X( GTCCR )                      \
+    X( TCCR1A ) X( TCCR1B ) X( TCCR1C ) X( TIMSK1 ) X( TIFR1 )                                                      \
+    X( TCCR3A ) X( TCCR3B ) X( TCCR3C ) X( TIMSK3 ) X( TIFR3 )                                                      \
+    X( EICRA ) X( EICRB ) X( EIMSK ) X( EIFR ) X( PCICR ) X( PCIFR ) X( PCMSK0 )                                    \
+    X( _host_ADCSRA ) X( ADCSRB ) X( ADMUX ) X( DIDR0 ) X( DIDR2 )
+#define HOST_REGISTERS_16( X )                                                                                        \
+    X( TCNT1 ) X( OCR1A ) X( OCR1B ) X( OCR1C ) X( ICR1 ) X( TCNT3 ) X( OCR3A ) X( OCR3B ) X( OCR3C ) X( ICR3 ) X( ADC )
+
+#define HOST_DEFINE_8( name )  volatile uint8_t name;
+#define HOST_DEFINE_16( name ) volatile uint16_t name;
+#define HOST_ZERO( name )      name = 0;
+HOST_REGISTERS_8( HOST_DEFINE_8 )
+HOST_REGISTERS_16( HOST_DEFINE_16 )
+
+/**
+ * Interrupt vectors. ISR(name) in the firmware defines a function with the vector's name; the weak declarations
+ * leave it NULL when the module that would define it is not linked.
+ */
+#define HOST_VECTORS( X )                                                                                             \
+    X( INT0_vect ) X( INT1_vect ) X( INT2_vect ) X( INT3_vect ) X( INT6_vect ) X( PCINT0_vect )                      \
+    X( TIMER1_CAPT_vect ) X( TIMER1_COMPA_vect ) X( TIMER1_COMPB_vect ) X( TIMER1_COMPC_vect ) X( TIMER1_OVF_vect )  \
+    X( TIMER0_COMPA_vect ) X( TIMER0_COMPB_vect ) X( TIMER0_OVF_vect ) X( ADC_vect )                                 \
+    X( TIMER3_CAPT_vect ) X( TIMER3_COMPA_vect ) X( TIMER3_COMPB_vect ) X( TIMER3_COMPC_vect ) X( TIMER3_OVF_vect )
+#define HOST_DECLARE_VECTOR( name ) void name( void ) __attribute__( ( weak ) );
+HOST_VECTORS( HOST_DECLARE_VECTOR )
+
+/**
+ * Interrupt flag registers. The firmware clears a flag by writing a one to it, which a plain variable would read as
+ * setting it. Each flag register keeps the last value the emulation put there; if the firmware has changed the
+ * register since, the ones it wrote are the flags it cleared.
+ */
+typedef struct { volatile uint8_t* reg; uint8_t flags; } Flag_Reg_t;
+static Flag_Reg_t _tifr0 = { &TIFR0, 0 };
+static Flag_Reg_t _tifr1 = { &TIFR1, 0 };
+static Flag_Reg_t _tifr3 = { &TIFR3, 0 };
+static Flag_Reg_t _eifr  = { &EIFR, 0 };
+static Flag_Reg_t _pcifr = { &PCIFR, 0 };
+static Flag_Reg_t* const _flag_regs[] = { &_tifr0, &_tifr1, &_tifr3, &_eifr, &_pcifr };
+
+static inline void _flag_sync( Flag_Reg_t* f )
+{
+    if( *f->reg != f->flags ) {
+        f->flags &= ~*f->reg;
+        *f->reg = f->flags;
+    }
+}
+
+static inline void _flag_set( Flag_Reg_t* f, uint8_t bit )
+{
+    _flag_sync( f );
+    f->flags |= ( 1 << bit );
+    *f->reg = f->flags;
+}
+
+static inline void _flag_clear( Flag_Reg_t* f, uint8_t bit )
+{
+    _flag_sync( f );
+    f->flags &= ~( 1 << bit );
+    *f->reg = f->flags;
+}
+
+static void _flag_sync_all( void )
+{
+    for( uint8_t i = 0; i < sizeof( _flag_regs ) / sizeof( _flag_regs[0] ); i++ )
+        _flag_sync( _flag_regs[i] );
+}
+
+/**
+ * Interrupt table in vector (priority) order. A vector runs when its flag and enable bits are both set; the flag is
+ * cleared as the vector is entered, as the hardware does.
+ */
+typedef struct { void ( *vector )( void ); Flag_Reg_t* flag_reg; volatile uint8_t* enable_reg; uint8_t bit;
+                 uint8_t enable_bit; } Host_Interrupt_t;
+
+static Flag_Reg_t _adcsra_flag = { &_host_ADCSRA, 0 };  // ADIF is sticky, only used for the table lookup below
+
+static const Host_Interrupt_t _interrupts[] = {
+    { INT0_vect, &_eifr, &EIMSK, INTF0, INT0 },
+    { INT1_vect, &_eifr, &EIMSK, INTF1, INT1 },
+    { INT2_vect, &_eifr, &EIMSK, INTF2, INT2 },
+    { INT3_vect, &_eifr, &EIMSK, INTF3, INT3 },
+    { INT6_vect, &_eifr, &EIMSK, INTF6, INT6 },
+    { PCINT0_vect, &_pcifr, &PCICR, PCIF0, PCIE0 },
+    { TIMER1_CAPT_vect, &_tifr1, &TIMSK1, ICF1, ICIE1 },
+    { TIMER1_COMPA_vect, &_tifr1, &TIMSK1, OCF1A, OCIE1A },
+    { TIMER1_COMPB_vect, &_tifr1, &TIMSK1, OCF1B, OCIE1B },
+    { TIMER1_COMPC_vect, &_tifr1, &TIMSK1, OCF1C, OCIE1C },
+    { TIMER1_OVF_vect, &_tifr1, &TIMSK1, TOV1, TOIE1 },
+    { TIMER0_COMPA_vect, &_tifr0, &TIMSK0, OCF0A, OCIE0A },
+    { TIMER0_COMPB_vect, &_tifr0, &TIMSK0, OCF0B, OCIE0B },
+    { TIMER0_OVF_vect, &_tifr0, &TIMSK0, TOV0, TOIE0 },
+    { ADC_vect, &_adcsra_flag, &_host_ADCSRA, ADIF, ADIE },
+    { TIMER3_CAPT_vect, &_tifr3, &TIMSK3, ICF3, ICIE3 },
+    { TIMER3_COMPA_vect, &_tifr3, &TIMSK3, OCF3A, OCIE3A },
+    { TIMER3_COMPB_vect, &_tifr3, &TIMSK3, OCF3B, OCIE3B },
+    { TIMER3_COMPC_vect, &_tifr3, &TIMSK3, OCF3C, OCIE3C },
+    { TIMER3_OVF_vect, &_tifr3, &TIMSK3, TOV3, TOIE3 },
+};
+
+static void _dispatch( void );
+
+/**
+ * Timers. One engine covers the 8 bit Timer0 and the 16 bit Timer1/Timer3; the 8 bit timer has no ICR and no
+ * channel C. ocr_active holds the compare values the counter is actually using, which lag the OCRnx registers in
+ * the double buffered PWM modes.
+ */
+typedef enum { UPDATE_IMMEDIATE, UPDATE_AT_TOP, UPDATE_AT_BOTTOM } Ocr_Update_t;
+typedef enum { TOV_AT_MAX, TOV_AT_TOP, TOV_AT_BOTTOM } Tov_Set_t;
+typedef enum { TOP_FIXED, TOP_OCRA, TOP_ICR } Top_Source_t;
+typedef struct { uint16_t fixed_top; Top_Source_t top_source; bool dual_slope; Ocr_Update_t update; Tov_Set_t tov; }
+        Timer_Mode_t;
+
+typedef struct {
+    bool wide;
+    volatile uint8_t* tccra;
+    volatile uint8_t* tccrb;
+    volatile uint8_t* tcnt8;
+    volatile uint16_t* tcnt16;
+    volatile uint8_t* ocr8[2];
+    volatile uint16_t* ocr16[3];
+    volatile uint16_t* icr;
+    Flag_Reg_t* tifr;
+    uint8_t ocf_bits[3];
+    uint8_t tov_bit;
+    uint8_t icf_bit;
+    uint16_t ocr_active[3];
+    bool counting_down;
+    uint32_t residue;  // CPU cycles toward the next timer clock
+} Host_Timer_t;
+
+static Host_Timer_t _timer0 = { .wide = false, .tccra = &TCCR0A, .tccrb = &TCCR0B, .tcnt8 = &TCNT0,
+                                .ocr8 = { &OCR0A, &OCR0B }, .tifr = &_tifr0, .ocf_bits = { OCF0A, OCF0B, 0 },
+                                .tov_bit = TOV0 };
+static Host_Timer_t _timer1 = { .wide = true, .tccra = &TCCR1A, .tccrb = &TCCR1B, .tcnt16 = &TCNT1,
+                                .ocr16 = { &OCR1A, &OCR1B, &OCR1C }, .icr = &ICR1, .tifr = &_tifr1,
+                                .ocf_bits = { OCF1A, OCF1B, OCF1C }, .tov_bit = TOV1, .icf_bit = ICF1 };
+static Host_Timer_t _timer3 = { .wide = true, .tccra = &TCCR3A, .tccrb = &TCCR3B, .tcnt16 = &TCNT3,
+                                .ocr16 = { &OCR3A, &OCR3B, &OCR3C }, .icr = &ICR3, .tifr = &_tifr3,
+                                .ocf_bits = { OCF3A, OCF3B, OCF3C }, .tov_bit = TOV3, .icf_bit = ICF3 };
+static Host_Timer_t* const _timers[] = { &_timer0, &_timer1, &_timer3 };
+
+// Mode tables, datasheet tables 13-8 (Timer0) and 14-4 (Timer1/3)
+static const Timer_Mode_t _modes8[8] = {
+    { 0xFF, TOP_FIXED, false, UPDATE_IMMEDIATE, TOV_AT_MAX },  // 0 normal
+    { 0xFF, TOP_FIXED, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },   // 1 phase correct
+    { 0xFF, TOP_OCRA, false, UPDATE_IMMEDIATE, TOV_AT_MAX },   // 2 CTC
+    { 0xFF, TOP_FIXED, false, UPDATE_AT_BOTTOM, TOV_AT_MAX },  // 3 fast PWM
+    { 0xFF, TOP_FIXED, false, UPDATE_IMMEDIATE, TOV_AT_MAX },  // 4 reserved
+    { 0xFF, TOP_OCRA, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },    // 5 phase correct, TOP = OCRA
+    { 0xFF, TOP_FIXED, false, UPDATE_IMMEDIATE, TOV_AT_MAX },  // 6 reserved
+    { 0xFF, TOP_OCRA, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },   // 7 fast PWM, TOP = OCRA
+};
+static const Timer_Mode_t _modes16[16] = {
+    { 0xFFFF, TOP_FIXED, false, UPDATE_IMMEDIATE, TOV_AT_MAX },  // 0 normal
+    { 0x00FF, TOP_FIXED, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },   // 1 phase correct 8 bit
+    { 0x01FF, TOP_FIXED, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },   // 2 phase correct 9 bit
+    { 0x03FF, TOP_FIXED, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },   // 3 phase correct 10 bit
+    { 0xFFFF, TOP_OCRA, false, UPDATE_IMMEDIATE, TOV_AT_MAX },   // 4 CTC, TOP = OCRA
+    { 0x00FF, TOP_FIXED, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },  // 5 fast PWM 8 bit
+    { 0x01FF, TOP_FIXED, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },  // 6 fast PWM 9 bit
+    { 0x03FF, TOP_FIXED, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },  // 7 fast PWM 10 bit
+    { 0xFFFF, TOP_ICR, true, UPDATE_AT_BOTTOM, TOV_AT_BOTTOM },  // 8 phase and frequency correct, TOP = ICR
+    { 0xFFFF, TOP_OCRA, true, UPDATE_AT_BOTTOM, TOV_AT_BOTTOM }, // 9 phase and frequency correct, TOP = OCRA
+    { 0xFFFF, TOP_ICR, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },     // 10 phase correct, TOP = ICR
+    { 0xFFFF, TOP_OCRA, true, UPDATE_AT_TOP, TOV_AT_BOTTOM },    // 11 phase correct, TOP = OCRA
+    { 0xFFFF, TOP_ICR, false, UPDATE_IMMEDIATE, TOV_AT_MAX },    // 12 CTC, TOP = ICR
+    { 0xFFFF, TOP_FIXED, false, UPDATE_IMMEDIATE, TOV_AT_MAX },  // 13 reserved
+    { 0xFFFF, TOP_ICR, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },    // 14 fast PWM, TOP = ICR
+    { 0xFFFF, TOP_OCRA, false, UPDATE_AT_BOTTOM, TOV_AT_TOP },   // 15 fast PWM, TOP = OCRA
+};
+
+static const uint16_t _prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };  // CSn2:0, external clocks not emulated
+
+static inline const Timer_Mode_t* _timer_mode( const Host_Timer_t* t )
+{
+    if( t->wide )
+        return &_modes16[( ( *t->tccrb >> 1 ) & 0x0C ) | ( *t->tccra & 0x03 )];
+    return &_modes8[( ( *t->tccrb >> 1 ) & 0x04 ) | ( *t->tccra & 0x03 )];
+}
+
+static inline uint8_t _timer_channels( const Host_Timer_t* t ) { return t->wide ? 3 : 2; }
+static inline uint16_t _timer_max( const Host_Timer_t* t ) { return t->wide ? 0xFFFF : 0xFF; }
+static inline uint16_t _timer_count( const Host_Timer_t* t ) { return t->wide ? *t->tcnt16 : *t->tcnt8; }
+
+static inline void _timer_set_count( Host_Timer_t* t, uint16_t count )
+{
+    if( t->wide )
+        *t->tcnt16 = count;
+    else
+        *t->tcnt8 = (uint8_t)count;
+}
+
+static inline void _timer_latch( Host_Timer_t* t )
+{
+    for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ )
+        t->ocr_active[ch] = t->wide ? *t->ocr16[ch] : *t->ocr8[ch];
+}
+
+static inline uint16_t _timer_top( const Host_Timer_t* t, const Timer_Mode_t* m )
+{
+    switch( m->top_source ) {
+        case TOP_OCRA: return t->ocr_active[0];
+        case TOP_ICR: return *t->icr;
+        default: return m->fixed_top;
+    }
+}
+
+/**
+ * Number of timer clocks until the next one that does something (sets a flag, turns the count around or latches
+ * the compare registers), including that clock. Always at least 1.
+ *
+ * Single slope modes follow the datasheet's timing: a compare match flag is set on the timer clock after the count
+ * equals OCRnx, and the count wraps to BOTTOM on the clock after it equals TOP. Dual slope modes act on the clock
+ * that arrives at the compare value, TOP or BOTTOM.
+ */
+static uint32_t _timer_ticks_to_event( Host_Timer_t* t, const Timer_Mode_t* m )
+{
+    uint16_t count = _timer_count( t );
+    uint16_t top   = _timer_top( t, m );
+    uint16_t max   = _timer_max( t );
+    uint32_t best;
+
+    if( !m->dual_slope ) {
+        uint16_t wrap = count > top ? max : top;  // a count past TOP runs on to MAX
+        best          = (uint32_t)wrap - count + 1;
+        for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ ) {
+            uint16_t v = t->ocr_active[ch];
+            if( v >= count && v <= wrap && (uint32_t)v - count + 1 < best )
+                best = (uint32_t)v - count + 1;
+        }
+        return best;
+    }
+
+    if( top == 0 )
+        return 1;
+    if( t->counting_down && count == 0 )
+        t->counting_down = false;
+    if( !t->counting_down && count == top )
+        t->counting_down = true;
+
+    if( t->counting_down ) {
+        best = count;
+        for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ )
+            if( t->ocr_active[ch] < count && count - t->ocr_active[ch] < best )
+                best = count - t->ocr_active[ch];
+    } else {
+        uint16_t limit = count > top ? max : top;
+        best           = (uint32_t)limit - count + ( count > top ? 1 : 0 );
+        for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ )
+            if( t->ocr_active[ch] > count && t->ocr_active[ch] <= limit && t->ocr_active[ch] - count < best )
+                best = t->ocr_active[ch] - count;
+    }
+    return best;
+}
+
+/**
+ * Runs the timer clock that _timer_ticks_to_event found, after the ones before it have been counted.
+ */
+static void _timer_event_tick( Host_Timer_t* t, const Timer_Mode_t* m )
+{
+    uint16_t count = _timer_count( t );
+    uint16_t top   = _timer_top( t, m );
+    uint16_t max   = _timer_max( t );
+
+    if( !m->dual_slope ) {
+        uint16_t wrap = count > top ? max : top;
+        for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ )
+            if( count == t->ocr_active[ch] )
+                _flag_set( t->tifr, t->ocf_bits[ch] );
+        if( count != wrap ) {
+            _timer_set_count( t, count + 1 );
+            return;
+        }
+        _timer_set_count( t, 0 );
+        if( ( m->tov == TOV_AT_MAX && count == max ) || m->tov == TOV_AT_TOP )
+            _flag_set( t->tifr, t->tov_bit );
+        if( m->top_source == TOP_ICR && count == top )
+            _flag_set( t->tifr, t->icf_bit );
+        if( m->update == UPDATE_AT_BOTTOM )
+            _timer_latch( t );
+        return;
+    }
+
+    if( top == 0 ) {  // degenerate, count sits at BOTTOM
+        _timer_set_count( t, 0 );
+        _flag_set( t->tifr, t->tov_bit );
+        return;
+    }
+
+    bool bottom = false;
+    if( t->counting_down ) {
+        count--;
+        bottom = ( count == 0 );
+    } else if( count == max ) {
+        count  = 0;
+        bottom = true;
+    } else {
+        count++;
+    }
+    _timer_set_count( t, count );
+
+    for( uint8_t ch = 0; ch < _timer_channels( t ); ch++ )
+        if( count == t->ocr_active[ch] )
+            _flag_set( t->tifr, t->ocf_bits[ch] );
+
+    if( !t->counting_down && count == top ) {
+        t->counting_down = true;
+        if( m->top_source == TOP_ICR )
+            _flag_set( t->tifr, t->icf_bit );
+        if( m->update == UPDATE_AT_TOP )
+            _timer_latch( t );
+    }
+    if( bottom ) {
+        t->counting_down = false;
+        _flag_set( t->tifr, t->tov_bit );
+        if( m->update == UPDATE_AT_BOTTOM )
+            _timer_latch( t );
+    }
+}
+
+/**
+ * CPU cycles until this timer's next event, or 0 if the timer is stopped.
+ */
+static uint64_t _timer_cycles_to_event( Host_Timer_t* t )
+{
+    uint16_t prescale = _prescale[*t->tccrb & 0x07];
+    if( prescale == 0 )
+        return 0;
+
+    const Timer_Mode_t* m = _timer_mode( t );
+    if( m->update == UPDATE_IMMEDIATE )
+        _timer_latch( t );
+    return (uint64_t)_timer_ticks_to_event( t, m ) * prescale - t->residue;
+}
+
+/**
+ * Advances the timer by a number of CPU cycles that does not go past its next event.
+ */
+static void _timer_advance( Host_Timer_t* t, uint64_t cycles )
+{
+    uint16_t prescale = _prescale[*t->tccrb & 0x07];
+    if( prescale == 0 )
+        return;
+
+    const Timer_Mode_t* m = _timer_mode( t );
+    uint64_t total        = t->residue + cycles;
+    uint32_t ticks        = total / prescale;
+    t->residue            = total % prescale;
+    if( ticks == 0 )
+        return;
+
+    uint32_t to_event = _timer_ticks_to_event( t, m );
+    uint32_t plain    = ticks < to_event ? ticks : to_event - 1;
+    uint16_t count    = _timer_count( t );
+    if( m->dual_slope && t->counting_down )
+        _timer_set_count( t, count - plain );
+    else
+        _timer_set_count( t, count + plain );
+
+    if( ticks >= to_event )
+        _timer_event_tick( t, m );
+}
+
+/**
+ * Simulated clock and the main loop hook.
+ */
+static uint64_t _cycles         = 0;
+static uint32_t _loop_cycles    = 160;
+static void ( *_usbtask_hook )( void ) = NULL;
+static uint16_t _adc_values[64];
+static uint8_t _encoder_state[2];  // quadrature state 0-3 for the left (0) and right (1) encoders
+
+void Host_HAL_Reset( void )
+{
+    HOST_REGISTERS_8( HOST_ZERO )
+    HOST_REGISTERS_16( HOST_ZERO )
+    for( uint8_t i = 0; i < sizeof( _flag_regs ) / sizeof( _flag_regs[0] ); i++ )
+        _flag_regs[i]->flags = 0;
+    for( uint8_t i = 0; i < sizeof( _timers ) / sizeof( _timers[0] ); i++ ) {
+        _timers[i]->counting_down = false;
+        _timers[i]->residue       = 0;
+        for( uint8_t ch = 0; ch < 3; ch++ )
+            _timers[i]->ocr_active[ch] = 0;
+    }
+    for( uint8_t i = 0; i < 64; i++ )
+        _adc_values[i] = 0;
+    _encoder_state[0] = _encoder_state[1] = 0;
+    _cycles                               = 0;
+    Host_USB_Reset();
+}
+
+uint64_t Host_Cycles( void )
+{
+    return _cycles;
+}
+
+double Host_Seconds( void )
+{
+    return (double)_cycles / F_CPU;
+}
+
+void Host_Advance_Cycles( uint64_t cycles )
+{
+    while( cycles ) {
+        _flag_sync_all();
+
+        uint64_t step = cycles;
+        for( uint8_t i = 0; i < sizeof( _timers ) / sizeof( _timers[0] ); i++ ) {
+            uint64_t to_event = _timer_cycles_to_event( _timers[i] );
+            if( to_event && to_event < step )
+                step = to_event;
+        }
+        for( uint8_t i = 0; i < sizeof( _timers ) / sizeof( _timers[0] ); i++ )
+            _timer_advance( _timers[i], step );
+
+        _cycles += step;
+        cycles -= step;
+        _dispatch();
+    }
+}
+
+void Host_Advance_Micros( uint32_t us )
+{
+    Host_Advance_Cycles( (uint64_t)us * ( F_CPU / 1000000UL ) );
+}
+
+void Host_Set_Loop_Cycles( uint32_t cycles )
+{
+    _loop_cycles = cycles;
+}
+
+void Host_Set_USBTask_Hook( void ( *hook )( void ) )
+{
+    _usbtask_hook = hook;
+}
+
+static jmp_buf _firmware_exit;
+
+void Host_Run_Firmware( int ( *firmware_main )( void ) )
+{
+    if( setjmp( _firmware_exit ) == 0 )
+        firmware_main();
+}
+
+void Host_Stop_Firmware( void )
+{
+    longjmp( _firmware_exit, 1 );
+}
+
+/**
+ * Called by the USB_USBTask stand-in in Host_USB.c once per firmware main loop pass.
+ */
+void Host_Loop_Tick( void )
+{
+    Host_Advance_Cycles( _loop_cycles );
+    if( _usbtask_hook )
+        _usbtask_hook();
+}
+
+/**
+ * Global interrupt enable. sei() runs whatever became pending while interrupts were off.
+ */
+void cli( void )
+{
+    SREG &= ~( 1 << SREG_I );
+}
+
+void sei( void )
+{
+    SREG |= ( 1 << SREG_I );
+    _dispatch();
+}
+
+/**
+ * Level triggered external interrupts (ISCn1:0 = 0) request service for as long as the pin is low. Their flag is
+ * set here before each dispatch so the table lookup treats them like the edge triggered ones.
+ */
+static void _update_level_interrupts( void )
+{
+    for( uint8_t n = 0; n < 4; n++ )
+        if( ( EIMSK & ( 1 << n ) ) && !( ( EICRA >> ( 2 * n ) ) & 0x03 ) && !( PIND & ( 1 << n ) ) )
+            _flag_set( &_eifr, n );
+    if( ( EIMSK & ( 1 << INT6 ) ) && !( ( EICRB >> ISC60 ) & 0x03 ) && !( PINE & ( 1 << PE6 ) ) )
+        _flag_set( &_eifr, INTF6 );
+}
+
+static void _dispatch( void )
+{
+    bool serviced = true;
+    while( serviced && ( SREG & ( 1 << SREG_I ) ) ) {
+        serviced = false;
+        _flag_sync_all();
+        _update_level_interrupts();
+        _adcsra_flag.flags = _host_ADCSRA;
+        for( uint8_t i = 0; i < sizeof( _interrupts ) / sizeof( _interrupts[0] ); i++ ) {
+            const Host_Interrupt_t* irq = &_interrupts[i];
+            if( !( irq->flag_reg->flags & ( 1 << irq->bit ) ) || !( *irq->enable_reg & ( 1 << irq->enable_bit ) ) )
+                continue;
+            if( irq->flag_reg == &_adcsra_flag )
+                _host_ADCSRA &= ~( 1 << ADIF );
+            else
+                _flag_clear( irq->flag_reg, irq->bit );
+            if( irq->vector ) {
+                SREG &= ~( 1 << SREG_I );
+                irq->vector();
+                SREG |= ( 1 << SREG_I );
+            }
+            serviced = true;
+            break;  // rescan from the highest priority
+        }
+    }
+}
+
+/**
+ * Pins
+ */
+typedef struct { volatile uint8_t* pin; volatile uint8_t* ddr; volatile uint8_t* port; } Host_Port_t;
+
+static bool _port_regs( char port, Host_Port_t* regs )
+{
+    switch( port ) {
+        case 'B': *regs = ( Host_Port_t ){ &PINB, &DDRB, &PORTB }; return true;
+        case 'C': *regs = ( Host_Port_t ){ &PINC, &DDRC, &PORTC }; return true;
+        case 'D': *regs = ( Host_Port_t ){ &PIND, &DDRD, &PORTD }; return true;
+        case 'E': *regs = ( Host_Port_t ){ &PINE, &DDRE, &PORTE }; return true;
+        case 'F': *regs = ( Host_Port_t ){ &PINF, &DDRF, &PORTF }; return true;
+        default: return false;
+    }
+}
+
+static void _external_edge( uint8_t n, uint8_t sense, bool level )
+{
+    // sense ISCn1:0, 1 any edge, 2 falling, 3 rising. Level sensing is handled at dispatch.
+    if( sense == 1 || ( sense == 2 && !level ) || ( sense == 3 && level ) )
+        _flag_set( &_eifr, n );
+}
+
+void Host_Pin_Write( char port, uint8_t bit, bool level )
+{
+    Host_Port_t regs;
+    if( !_port_regs( port, &regs ) || bit > 7 )
+        return;
+
+    volatile uint8_t* pin = regs.pin;
+    bool old              = ( *pin >> bit ) & 0x01;
+    if( level )
+        *pin |= ( 1 << bit );
+    else
+        *pin &= ~( 1 << bit );
+    if( old == level )
+        return;
+
+    if( port == 'B' && ( PCMSK0 & ( 1 << bit ) ) )
+        _flag_set( &_pcifr, PCIF0 );
+    if( port == 'D' && bit < 4 )
+        _external_edge( bit, ( EICRA >> ( 2 * bit ) ) & 0x03, level );
+    if( port == 'E' && bit == PE6 )
+        _external_edge( INTF6, ( EICRB >> ISC60 ) & 0x03, level );
+    _dispatch();
+}
+
+bool Host_Pin_Read( char port, uint8_t bit )
+{
+    Host_Port_t regs;
+    if( !_port_regs( port, &regs ) || bit > 7 )
+        return false;
+
+    if( !( *regs.ddr & ( 1 << bit ) ) )
+        return ( *regs.pin >> bit ) & 0x01;
+
+    if( port == 'B' && ( bit == PB5 || bit == PB6 ) ) {
+        uint8_t com = ( TCCR1A >> ( bit == PB5 ? COM1A0 : COM1B0 ) ) & 0x03;
+        if( com >= 2 ) {
+            bool high = TCNT1 < _timer1.ocr_active[bit == PB5 ? 0 : 1];
+            return com == 2 ? high : !high;
+        }
+    }
+    return ( *regs.port >> bit ) & 0x01;
+}
+
+float Host_PWM_Duty( uint8_t channel )
+{
+    if( channel > 1 )
+        return 0;
+
+    uint8_t com = ( TCCR1A >> ( channel == 0 ? COM1A0 : COM1B0 ) ) & 0x03;
+    uint8_t pin = channel == 0 ? PB5 : PB6;
+    if( com < 2 || !( DDRB & ( 1 << pin ) ) )
+        return Host_Pin_Read( 'B', pin ) ? 1.0f : 0.0f;
+
+    uint16_t top = _timer_top( &_timer1, _timer_mode( &_timer1 ) );
+    float duty   = top ? (float)_timer1.ocr_active[channel] / top : 0.0f;
+    if( duty > 1.0f )
+        duty = 1.0f;
+    return com == 2 ? duty : 1.0f - duty;
+}
+
+/**
+ * ADC
+ */
+static const uint8_t _adc_divider[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+
+volatile uint8_t* Host_ADCSRA_Access( void )
+{
+    static bool converting = false;
+    if( converting || ( _host_ADCSRA & ( ( 1 << ADEN ) | ( 1 << ADSC ) ) ) != ( ( 1 << ADEN ) | ( 1 << ADSC ) ) )
+        return &_host_ADCSRA;
+
+    uint8_t channel = ( ADMUX & 0x1F ) | ( ( ADCSRB & ( 1 << MUX5 ) ) ? 0x20 : 0 );
+    uint16_t value  = _adc_values[channel] & 0x03FF;
+    ADC             = ( ADMUX & ( 1 << ADLAR ) ) ? value << 6 : value;
+    _host_ADCSRA    = ( _host_ADCSRA & ~( 1 << ADSC ) ) | ( 1 << ADIF );
+
+    // 13 ADC clocks per conversion; interrupts that come due in the meantime run if they are enabled
+    converting = true;
+    Host_Advance_Cycles( 13UL * _adc_divider[_host_ADCSRA & 0x07] );
+    converting = false;
+    return &_host_ADCSRA;
+}
+
+void Host_ADC_Set( uint8_t channel, uint16_t counts )
+{
+    _adc_values[channel & 0x3F] = counts > 1023 ? 1023 : counts;
+}
+
+void Host_Battery_Set( float volts )
+{
+    float counts = volts / 2.0f / 2.56f * 1023.0f + 0.5f;
+    Host_ADC_Set( 6, counts < 0 ? 0 : (uint16_t)counts );
+}
+
+/**
+ * Zumo encoders. Quadrature state s = 0..3 is (A,B) = 00, 10, 11, 01; a positive step is the direction Encoder.c
+ * counts up.
+ */
+void Host_Encoder_Step( bool left, int8_t direction )
+{
+    static const uint8_t a_of[4] = { 0, 1, 1, 0 };
+    static const uint8_t b_of[4] = { 0, 0, 1, 1 };
+
+    uint8_t* s = &_encoder_state[left ? 0 : 1];
+    *s         = ( *s + ( direction > 0 ? 1 : 3 ) ) & 0x03;
+    bool a = a_of[*s], b = b_of[*s];
+
+    // B first, it is not an interrupt pin; the xor edge then raises the encoder interrupt
+    if( left ) {
+        Host_Pin_Write( 'E', PE2, b );
+        Host_Pin_Write( 'B', PB4, a ^ b );
+    } else {
+        Host_Pin_Write( 'F', PF0, b );
+        Host_Pin_Write( 'E', PE6, a ^ b );
+    }
+}
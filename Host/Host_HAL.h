@@ -0,0 +1,202 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * Host_HAL.h/c emulate the ATmega32U4 peripherals c_lib touches so the library can be compiled with the native gcc
+ * and driven from a Linux program. Host/include provides stand-ins for <avr/io.h>, <avr/interrupt.h> and the LUFA
+ * headers; the I/O registers are plain variables and the c_lib sources are compiled unchanged.
+ *
+ * Nothing happens on its own: simulated time only moves when Host_Advance_Cycles (or USB_USBTask, see
+ * Host_Set_Loop_Cycles) is called. Advancing time steps Timer0, Timer1 and Timer3 from event to event (compare
+ * match, TOP, BOTTOM) rather than tick by tick, sets their flags, latches double buffered OCRnx where the mode calls
+ * for it, and runs any enabled interrupt whose flag is set while SREG_I is set. Interrupt service routines run in zero
+ * simulated time.
+ *
+ * Emulated:
+ *   - Timer0 (8 bit) and Timer1/Timer3 (16 bit), all waveform generation modes, clk/1 to clk/1024 prescalers.
+ *   - ADC single conversions. Setting ADSC completes the conversion the next time ADCSRA is accessed, with the result
+ *     taken from Host_ADC_Set and the conversion time charged to the simulated clock. ADIF cannot be cleared by
+ *     writing one to it (register writes are not observable), so it stays set after the first conversion.
+ *   - Pin change interrupt 0 (PCINT0-7 on PB0-7) and external interrupts INT0-3 (PD0-3) and INT6 (PE6).
+ *   - The CDC data endpoints, see Host_CDC_Write/Host_CDC_Read.
+ *
+ * Interrupt flags (TIFRn, EIFR, PCIFR) are cleared by writing a one to them as on the chip, except when the value
+ * written equals the register's current value, which cannot be told apart from no write at all.
+ */
+
+#ifndef _MEGN540_HOST_HAL_H
+#define _MEGN540_HOST_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+/**
+ * Function Host_HAL_Reset returns every emulated register and peripheral to its power-on state, empties the CDC
+ * FIFOs and sets the simulated clock to zero.
+ */
+void Host_HAL_Reset( void );
+
+/**
+ * Function Host_Cycles returns the number of CPU cycles simulated since Host_HAL_Reset.
+ * @return [uint64_t] cycles at F_CPU
+ */
+uint64_t Host_Cycles( void );
+
+/**
+ * Function Host_Seconds returns the simulated time since Host_HAL_Reset.
+ * @return [double] seconds
+ */
+double Host_Seconds( void );
+
+/**
+ * Function Host_Advance_Cycles advances simulated time, running the timers and any interrupts they trigger.
+ * @param [uint64_t] cycles CPU cycles to advance
+ */
+void Host_Advance_Cycles( uint64_t cycles );
+
+/**
+ * Function Host_Advance_Micros advances simulated time by the given number of microseconds.
+ * @param [uint32_t] us microseconds to advance
+ */
+void Host_Advance_Micros( uint32_t us );
+
+/**
+ * Function Host_Set_Loop_Cycles sets the simulated time charged to each USB_USBTask call. Firmware main loops call
+ * USB_Upkeep_Task once per pass, so this is the modeled cost of one main loop iteration. Defaults to 160 (10 us).
+ * @param [uint32_t] cycles CPU cycles per USB_USBTask call
+ */
+void Host_Set_Loop_Cycles( uint32_t cycles );
+
+/**
+ * Function Host_Set_USBTask_Hook installs a function called from every USB_USBTask, after the loop cycles have been
+ * charged. Harnesses use it to feed the CDC endpoint, drive the plant, or stop a firmware main loop. NULL removes it.
+ * @param [void(*)(void)] hook function to call
+ */
+void Host_Set_USBTask_Hook( void ( *hook )( void ) );
+
+/**
+ * Function Host_Run_Firmware calls a firmware main (a lab's main() compiled with -Dmain=<name>) and returns once a
+ * hook calls Host_Stop_Firmware. The firmware initializes itself as it does after power on, so it can be run again
+ * after Host_HAL_Reset.
+ * @param [int(*)(void)] firmware_main the renamed firmware entry point
+ */
+void Host_Run_Firmware( int ( *firmware_main )( void ) );
+
+/**
+ * Function Host_Stop_Firmware leaves the firmware main loop and returns from Host_Run_Firmware. Only call it from
+ * the USBTask hook (or anything else running inside Host_Run_Firmware).
+ */
+void Host_Stop_Firmware( void );
+
+/**
+ * Function Host_Pin_Write drives an input pin from outside the chip. Pin change and external interrupts configured
+ * on the pin set their flags and run as they would on the chip.
+ * @param [char] port 'B', 'C', 'D', 'E' or 'F'
+ * @param [uint8_t] bit pin number within the port
+ * @param [bool] level the new level
+ */
+void Host_Pin_Write( char port, uint8_t bit, bool level );
+
+/**
+ * Function Host_Pin_Read returns the level the chip is driving on a pin. Output pins report their PORT bit, or the
+ * waveform level if a Timer1 compare output (OC1A on PB5, OC1B on PB6) is connected. Input pins report PIN.
+ * @param [char] port 'B', 'C', 'D', 'E' or 'F'
+ * @param [uint8_t] bit pin number within the port
+ * @return [bool] pin level
+ */
+bool Host_Pin_Read( char port, uint8_t bit );
+
+/**
+ * Function Host_PWM_Duty returns the average level of a Timer1 compare output pin over one PWM period, 0 to 1.
+ * When the compare output is disconnected this is the PORT level of the pin.
+ * @param [uint8_t] channel 0 for OC1A (PB5), 1 for OC1B (PB6)
+ * @return [float] duty cycle
+ */
+float Host_PWM_Duty( uint8_t channel );
+
+/**
+ * Function Host_ADC_Set sets the value the next conversion on an ADC channel returns.
+ * @param [uint8_t] channel MUX5:0 channel selection (ADC6 is 6)
+ * @param [uint16_t] counts 10 bit result
+ */
+void Host_ADC_Set( uint8_t channel, uint16_t counts );
+
+/**
+ * Function Host_Battery_Set sets the battery voltage seen on ADC6 through the Zumo's 1/2 divider, with the 2.56V
+ * reference Battery_Monitor_Init selects.
+ * @param [float] volts battery voltage
+ */
+void Host_Battery_Set( float volts );
+
+/**
+ * Function Host_Encoder_Step moves one of the Zumo encoders by one quadrature count. The Zumo wires each encoder as
+ * (A xor B, B): left on PB4 (PCINT4) and PE2, right on PE6 (INT6) and PF0, so each step toggles the xor pin and
+ * raises the encoder interrupt.
+ * @param [bool] left true for the left encoder, false for the right
+ * @param [int8_t] direction +1 or -1 counts
+ */
+void Host_Encoder_Step( bool left, int8_t direction );
+
+/**
+ * Function Host_CDC_Write queues bytes sent by the host on the CDC OUT endpoint. The firmware receives them in
+ * packets of up to CDC_TXRX_EPSIZE bytes.
+ * @param [const void*] data bytes to send
+ * @param [uint16_t] len number of bytes
+ * @return [uint16_t] number of bytes queued (fewer if the FIFO is full)
+ */
+uint16_t Host_CDC_Write( const void* data, uint16_t len );
+
+/**
+ * Function Host_CDC_Read takes bytes the firmware sent on the CDC IN endpoint.
+ * @param [void*] data destination
+ * @param [uint16_t] max maximum number of bytes to take
+ * @return [uint16_t] number of bytes copied
+ */
+uint16_t Host_CDC_Read( void* data, uint16_t max );
+
+/**
+ * Function Host_CDC_Available returns how many bytes the firmware has sent that Host_CDC_Read has not taken yet.
+ * @return [uint16_t] byte count
+ */
+uint16_t Host_CDC_Available( void );
+
+/**
+ * Function Host_USB_Reset empties the CDC FIFOs and endpoint banks and detaches the device. Called by Host_HAL_Reset.
+ */
+void Host_USB_Reset( void );
+
+#endif
@@ -0,0 +1,240 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+
+/**
+ * Host_USB.c stands in for the LUFA device stack c_lib/SerialIO.c uses. The CDC data endpoints are a pair of byte
+ * FIFOs shared with the host side: Host_CDC_Write fills the OUT FIFO, which the firmware sees a packet (up to
+ * CDC_TXRX_EPSIZE bytes) at a time through the endpoint bank, and each Endpoint_ClearIN moves the IN bank into the IN
+ * FIFO for Host_CDC_Read. The IN endpoint reports not ready while the IN FIFO cannot take another packet, the same
+ * back pressure a host that stops reading gives the real device.
+ */
+
+#include "Host_HAL.h"
+#include "USB_Config/Descriptors.h"
+
+#define HOST_CDC_FIFO_SIZE 4096  // power of two
+
+typedef struct { uint8_t data[HOST_CDC_FIFO_SIZE]; uint32_t head; uint32_t tail; } Host_FIFO_t;
+
+static Host_FIFO_t _out_fifo;  // host to device
+static Host_FIFO_t _in_fifo;   // device to host
+
+static uint8_t _out_bank[CDC_TXRX_EPSIZE];
+static uint8_t _out_bank_len;
+static uint8_t _out_bank_pos;
+static bool _out_bank_full;
+
+static uint8_t _in_bank[CDC_TXRX_EPSIZE];
+static uint8_t _in_bank_len;
+
+static uint8_t _selected_endpoint;
+
+volatile uint8_t USB_DeviceState;
+USB_Request_Header_t USB_ControlRequest;
+
+void Host_Loop_Tick( void );  // Host_HAL.c
+
+static inline uint32_t _fifo_length( const Host_FIFO_t* f ) { return f->tail - f->head; }
+static inline uint32_t _fifo_free( const Host_FIFO_t* f ) { return HOST_CDC_FIFO_SIZE - _fifo_length( f ); }
+
+static inline void _fifo_push( Host_FIFO_t* f, uint8_t byte )
+{
+    f->data[f->tail++ & ( HOST_CDC_FIFO_SIZE - 1 )] = byte;
+}
+
+static inline uint8_t _fifo_pop( Host_FIFO_t* f )
+{
+    return f->data[f->head++ & ( HOST_CDC_FIFO_SIZE - 1 )];
+}
+
+static inline bool _out_selected( void ) { return ( _selected_endpoint & ENDPOINT_EPNUM_MASK ) == ( CDC_RX_EPADDR & ENDPOINT_EPNUM_MASK ); }
+static inline bool _in_selected( void ) { return ( _selected_endpoint & ENDPOINT_EPNUM_MASK ) == ( CDC_TX_EPADDR & ENDPOINT_EPNUM_MASK ); }
+
+void Host_USB_Reset( void )
+{
+    _out_fifo.head = _out_fifo.tail = 0;
+    _in_fifo.head = _in_fifo.tail = 0;
+    _out_bank_len = _out_bank_pos = 0;
+    _out_bank_full                = false;
+    _in_bank_len                  = 0;
+    _selected_endpoint            = 0;
+    USB_DeviceState               = DEVICE_STATE_Unattached;
+}
+
+uint16_t Host_CDC_Write( const void* data, uint16_t len )
+{
+    const uint8_t* bytes = data;
+    uint16_t i;
+    for( i = 0; i < len && _fifo_free( &_out_fifo ); i++ )
+        _fifo_push( &_out_fifo, bytes[i] );
+    return i;
+}
+
+uint16_t Host_CDC_Read( void* data, uint16_t max )
+{
+    uint8_t* bytes = data;
+    uint16_t i;
+    for( i = 0; i < max && _fifo_length( &_in_fifo ); i++ )
+        bytes[i] = _fifo_pop( &_in_fifo );
+    return i;
+}
+
+uint16_t Host_CDC_Available( void )
+{
+    return _fifo_length( &_in_fifo );
+}
+
+/**
+ * Enumeration is not emulated, the device is configured as soon as the stack is initialized.
+ */
+void USB_Init( void )
+{
+    USB_DeviceState = DEVICE_STATE_Configured;
+}
+
+void USB_USBTask( void )
+{
+    Host_Loop_Tick();
+}
+
+bool Endpoint_ConfigureEndpoint( const uint8_t Address, const uint8_t Type, const uint16_t Size, const uint8_t Banks )
+{
+    return true;
+}
+
+void Endpoint_SelectEndpoint( const uint8_t Address )
+{
+    _selected_endpoint = Address;
+}
+
+bool Endpoint_IsOUTReceived( void )
+{
+    if( !_out_selected() )
+        return false;
+    if( !_out_bank_full && _fifo_length( &_out_fifo ) ) {
+        _out_bank_len = 0;
+        _out_bank_pos = 0;
+        while( _out_bank_len < CDC_TXRX_EPSIZE && _fifo_length( &_out_fifo ) )
+            _out_bank[_out_bank_len++] = _fifo_pop( &_out_fifo );
+        _out_bank_full = true;
+    }
+    return _out_bank_full;
+}
+
+bool Endpoint_IsINReady( void )
+{
+    return _in_selected() && _fifo_free( &_in_fifo ) >= CDC_TXRX_EPSIZE;
+}
+
+uint16_t Endpoint_BytesInEndpoint( void )
+{
+    if( _out_selected() )
+        return _out_bank_full ? _out_bank_len - _out_bank_pos : 0;
+    if( _in_selected() )
+        return _in_bank_len;
+    return 0;
+}
+
+uint8_t Endpoint_Read_8( void )
+{
+    if( !_out_selected() || !_out_bank_full || _out_bank_pos >= _out_bank_len )
+        return 0;
+    return _out_bank[_out_bank_pos++];
+}
+
+void Endpoint_Write_8( const uint8_t Data )
+{
+    if( _in_selected() && _in_bank_len < CDC_TXRX_EPSIZE )
+        _in_bank[_in_bank_len++] = Data;
+}
+
+void Endpoint_ClearOUT( void )
+{
+    if( _out_selected() )
+        _out_bank_full = false;
+}
+
+void Endpoint_ClearIN( void )
+{
+    if( !_in_selected() )
+        return;
+    for( uint8_t i = 0; i < _in_bank_len && _fifo_free( &_in_fifo ); i++ )
+        _fifo_push( &_in_fifo, _in_bank[i] );
+    _in_bank_len = 0;
+}
+
+uint8_t Endpoint_WaitUntilReady( void )
+{
+    if( _in_selected() && !Endpoint_IsINReady() )
+        return ENDPOINT_READYWAIT_Timeout;
+    return ENDPOINT_READYWAIT_NoError;
+}
+
+uint8_t Endpoint_Read_Stream_LE( void* const Buffer, uint16_t Length, uint16_t* const BytesProcessed )
+{
+    uint8_t* bytes = Buffer;
+    for( uint16_t i = 0; i < Length; i++ ) {
+        if( !Endpoint_BytesInEndpoint() ) {
+            Endpoint_ClearOUT();
+            if( !Endpoint_IsOUTReceived() )
+                return ENDPOINT_RWSTREAM_IncompleteTransfer;
+        }
+        bytes[i] = Endpoint_Read_8();
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Write_Stream_LE( const void* const Buffer, uint16_t Length, uint16_t* const BytesProcessed )
+{
+    const uint8_t* bytes = Buffer;
+    for( uint16_t i = 0; i < Length; i++ ) {
+        if( _in_bank_len == CDC_TXRX_EPSIZE )
+            Endpoint_ClearIN();
+        Endpoint_Write_8( bytes[i] );
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+/**
+ * Control requests never arrive on the host, these only need to link.
+ */
+void Endpoint_ClearSETUP( void ) {}
+void Endpoint_ClearStatusStage( void ) {}
+
+uint8_t Endpoint_Write_Control_Stream_LE( const void* const Buffer, uint16_t Length )
+{
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Read_Control_Stream_LE( void* const Buffer, uint16_t Length )
+{
+    return ENDPOINT_RWSTREAM_NoError;
+}
@@ -0,0 +1,128 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "Zumo_Plant.h"
+#include "Host_HAL.h"
+
+#include <math.h>
+
+#define NOT_STARTED UINT64_MAX
+
+void Zumo_Plant_Default_Params( Zumo_Plant_Params_t* p_params )
+{
+    for( uint8_t m = 0; m < 2; m++ ) {
+        p_params->motor[m].gain       = 1015.0f;  // 12.83 counts/s per PWM count * 380 / 4.8 V
+        p_params->motor[m].deadband   = 0.30f;    // 23 PWM counts at 4.8 V
+        p_params->motor[m].tau_m      = 0.060f;
+        p_params->motor[m].tau_e      = 0.0f;
+        p_params->motor[m].resistance = 3.75f;    // 6 V / 1.6 A stall
+    }
+    p_params->battery_open       = 5.0f;   // four charged NiMH cells
+    p_params->battery_resistance = 0.30f;  // cells, holder and switch
+    p_params->logic_current      = 0.05f;
+}
+
+void Zumo_Plant_Init( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params )
+{
+    for( uint8_t m = 0; m < 2; m++ ) {
+        p_state->volts[m]    = 0;
+        p_state->speed[m]    = 0;
+        p_state->position[m] = 0;
+        p_state->counts[m]   = 0;
+        p_state->current[m]  = 0;
+    }
+    p_state->battery     = p_params->battery_open - p_params->battery_resistance * p_params->logic_current;
+    p_state->last_cycles = NOT_STARTED;
+}
+
+/**
+ * First order lag, discretized exactly for a constant input over the step.
+ */
+static inline float _lag( float state, float input, float tau, float dt )
+{
+    if( tau <= 0 )
+        return input;
+    return input + ( state - input ) * expf( -dt / tau );
+}
+
+void Zumo_Plant_Step( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params, float duty_left,
+                      float duty_right, float dt )
+{
+    float duty[2]         = { duty_left, duty_right };
+    float battery_current = p_params->logic_current;
+
+    for( uint8_t m = 0; m < 2; m++ ) {
+        const Zumo_Motor_Params_t* p_motor = &p_params->motor[m];
+        float d                            = fmaxf( -1.0f, fminf( 1.0f, duty[m] ) );
+
+        // the supply seen this step is the terminal voltage left by the last step's draw
+        p_state->volts[m] = _lag( p_state->volts[m], d * p_state->battery, p_motor->tau_e, dt );
+
+        float v         = p_state->volts[m];
+        float driving   = fmaxf( fabsf( v ) - p_motor->deadband, 0.0f );
+        float target    = p_motor->gain * copysignf( driving, v );
+        float old_speed = p_state->speed[m];
+        p_state->speed[m] = _lag( old_speed, target, p_motor->tau_m, dt );
+
+        // trapezoid on the speed is exact enough at the step sizes used
+        p_state->position[m] += 0.5 * ( old_speed + p_state->speed[m] ) * dt;
+
+        // current flows while the driver is on; braking during the off time returns nothing to the battery
+        p_state->current[m] = 0;
+        if( p_motor->resistance > 0 )
+            p_state->current[m] = ( v - p_state->speed[m] / p_motor->gain ) / p_motor->resistance;
+        battery_current += fabsf( d * p_state->current[m] );
+    }
+
+    p_state->battery = p_params->battery_open - p_params->battery_resistance * battery_current;
+    if( p_state->battery < 0 )
+        p_state->battery = 0;
+}
+
+void Zumo_Plant_Update_HAL( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params )
+{
+    uint64_t now = Host_Cycles();
+    if( p_state->last_cycles != NOT_STARTED && now > p_state->last_cycles ) {
+        float duty_left  = Host_PWM_Duty( 1 ) * ( Host_Pin_Read( 'B', PB2 ) ? -1.0f : 1.0f );
+        float duty_right = Host_PWM_Duty( 0 ) * ( Host_Pin_Read( 'B', PB1 ) ? -1.0f : 1.0f );
+        Zumo_Plant_Step( p_state, p_params, duty_left, duty_right, (float)( now - p_state->last_cycles ) / F_CPU );
+
+        for( uint8_t m = 0; m < 2; m++ ) {
+            int32_t counts = (int32_t)floor( p_state->position[m] );
+            while( p_state->counts[m] != counts ) {
+                int8_t dir = p_state->counts[m] < counts ? 1 : -1;
+                Host_Encoder_Step( m == ZUMO_LEFT, dir );
+                p_state->counts[m] += dir;
+            }
+        }
+    }
+    p_state->last_cycles = now;
+    Host_Battery_Set( p_state->battery );
+}
@@ -0,0 +1,124 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * Zumo_Plant.h/c simulate the Zumo 32U4 drive train so the control code can be run closed loop on the host.
+ *
+ * Each wheel is a DC gearmotor driven through the DRV8838 in phase/enable mode: the average motor voltage is
+ * duty * battery voltage with the sign from the direction pin, and the off part of the PWM period brakes. The wheel
+ * speed follows the motor voltage past a friction deadband through a first order lag (tau_m), optionally behind a
+ * second, electrical lag (tau_e) for a second order model:
+ *
+ *      speed_ss = gain * sign(v) * max(|v| - deadband, 0)
+ *      tau_m * d(speed)/dt = speed_ss - speed
+ *
+ * The battery is an open circuit voltage behind an internal resistance. The motor currents, (v - speed/gain) / R
+ * scaled by the duty, plus a constant logic draw sag the terminal voltage, which is both what the motors see on the
+ * next step and what the battery monitor measures.
+ *
+ * The default parameters are fit to SerialMonitor/Lab5_data.csv (PWM steps on the ground at PWM_TOP 380, assumed
+ * 4.8 V supply): about 12.8 counts/s per PWM count past a 23 count deadband, tau_m about 60 ms. The encoders give
+ * 909.7 counts per wheel revolution.
+ *
+ * Zumo_Plant_Step is a pure function of its arguments, so independent plants can be stepped from several threads.
+ * Zumo_Plant_Update_HAL binds one plant to the register emulation in Host_HAL.c: it reads the Timer1 duty and the
+ * direction pins, steps the plant over the simulated time since the last call, drives the encoder pins and sets the
+ * battery voltage on ADC6. Call it from the USBTask hook.
+ */
+
+#ifndef _MEGN540_ZUMO_PLANT_H
+#define _MEGN540_ZUMO_PLANT_H
+
+#include <stdint.h>
+
+#define ZUMO_COUNTS_PER_REV 909.7f  // 12 counts per motor revolution, 75.81:1 gearbox
+
+enum { ZUMO_LEFT = 0, ZUMO_RIGHT = 1 };
+
+/** One gearmotor, speeds in encoder counts per second. */
+typedef struct {
+    float gain;        ///<-- steady state speed per volt past the deadband [counts/s/V]
+    float deadband;    ///<-- motor voltage needed to overcome friction [V]
+    float tau_m;       ///<-- mechanical time constant [s]
+    float tau_e;       ///<-- electrical time constant [s], 0 for a first order model
+    float resistance;  ///<-- winding resistance, for the current draw [ohm]
+} Zumo_Motor_Params_t;
+
+typedef struct {
+    Zumo_Motor_Params_t motor[2];  ///<-- ZUMO_LEFT, ZUMO_RIGHT
+    float battery_open;            ///<-- battery open circuit voltage [V]
+    float battery_resistance;      ///<-- battery internal resistance [ohm]
+    float logic_current;           ///<-- constant draw of everything but the motors [A]
+} Zumo_Plant_Params_t;
+
+typedef struct {
+    float volts[2];        ///<-- motor voltage after the electrical lag [V]
+    float speed[2];        ///<-- wheel speed [counts/s]
+    double position[2];    ///<-- wheel position [counts]
+    int32_t counts[2];     ///<-- encoder counts emitted so far, floor(position)
+    float current[2];      ///<-- motor current [A]
+    float battery;         ///<-- battery terminal voltage [V]
+    uint64_t last_cycles;  ///<-- Host_Cycles at the last Zumo_Plant_Update_HAL
+} Zumo_Plant_State_t;
+
+/**
+ * Function Zumo_Plant_Default_Params fills in the parameters fit to the lab recordings.
+ * @param [Zumo_Plant_Params_t*] p_params parameters to fill
+ */
+void Zumo_Plant_Default_Params( Zumo_Plant_Params_t* p_params );
+
+/**
+ * Function Zumo_Plant_Init puts the plant at rest at position zero with the battery at its open circuit voltage.
+ * @param [Zumo_Plant_State_t*] p_state state to initialize
+ * @param [const Zumo_Plant_Params_t*] p_params plant parameters
+ */
+void Zumo_Plant_Init( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params );
+
+/**
+ * Function Zumo_Plant_Step advances the plant by dt with constant motor duties.
+ * @param [Zumo_Plant_State_t*] p_state state to advance
+ * @param [const Zumo_Plant_Params_t*] p_params plant parameters
+ * @param [float] duty_left signed duty of the left motor, -1 to 1 (negative is reverse)
+ * @param [float] duty_right signed duty of the right motor, -1 to 1
+ * @param [float] dt time step [s]
+ */
+void Zumo_Plant_Step( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params, float duty_left,
+                      float duty_right, float dt );
+
+/**
+ * Function Zumo_Plant_Update_HAL steps the plant over the simulated time since the last call using the duty and
+ * direction the firmware is driving (OC1B/PB2 left, OC1A/PB1 right), then emits the encoder edges for the counts
+ * moved and sets the battery voltage. The first call after Zumo_Plant_Init only takes the current time.
+ * @param [Zumo_Plant_State_t*] p_state state to advance
+ * @param [const Zumo_Plant_Params_t*] p_params plant parameters
+ */
+void Zumo_Plant_Update_HAL( Zumo_Plant_State_t* p_state, const Zumo_Plant_Params_t* p_params );
+
+#endif
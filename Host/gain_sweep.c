@@ -0,0 +1,406 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * gain_sweep tunes the Lab5 position controller (Controller_t: kp times the error against a lead/lag filtered
+ * measurement) against the simulated drive train in Zumo_Plant.h. Every candidate runs a position step on both
+ * wheels, closed loop at the controller update period, and is scored on its step response. The sweep runs on all
+ * cores and the best candidate is written as a header of initializers for Lab5-Control.c.
+ *
+ *   gain_sweep [-k min:max:n] [-z min:max:n] [-p min:max:n] [-r rounds] [-s step_counts] [-T seconds]
+ *              [-u update_s] [-g gain] [-d deadband] [-m tau_m] [-e tau_e] [-b volts] [-W os,sat,settle]
+ *              [-j threads] [-n top] [-o header.h]
+ *
+ *   -k -z -p  grid over kp, the filter zero and the filter pole (all in z). The filter is
+ *             (1 - z q^-1) / (1 - p q^-1) scaled to unity DC gain, the form of the Lab5 leftNumerator/leftDenominator.
+ *             Defaults 0.02:1:50, 0.90:0.995:10, 0.80:0.998:12.
+ *   -r        pattern search rounds run from the best grid point (each round evaluates its neighbours in parallel,
+ *             halving the step when none improves). Default 40, 0 for the grid only.
+ *   -s -T -u  step size [counts], simulated time [s] and controller update period [s]. Defaults 500, 1.0, 0.002.
+ *   -g -d -m -e -b  motor model (Zumo_Motor_Params_t gain, deadband, tau_m, tau_e) and battery open circuit voltage,
+ *             for both wheels. Defaults are Zumo_Plant_Default_Params.
+ *   -W        cost weights. cost = rise time + os * overshoot + sat * saturated fraction + settle * settling time,
+ *             times in seconds, overshoot and saturation as fractions. Default 1,0.2,0.5.
+ *   -j        worker threads. Default: one per online CPU.
+ *   -n        candidates to list. Default 10.
+ *   -o        header to write. Default lab5_controller_gains.h.
+ *
+ * The controller output is the motor voltage, saturated at the battery voltage and applied as duty = volts / battery
+ * (Motor_Volts_To_PWM). The measurement is the integer encoder count. A candidate that never reaches 90% of the step
+ * or has not settled inside 2% by the end is rejected.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Controller.h"
+#include "Zumo_Plant.h"
+
+typedef struct { float min; float max; unsigned n; } Range_t;
+
+typedef struct {
+    float kp;
+    float zero;
+    float pole;
+    // results
+    bool valid;
+    float cost;
+    float rise;        // 10% to 90% [s]
+    float overshoot;   // fraction of the step
+    float settle;      // last time outside 2% [s]
+    float saturation;  // fraction of updates at the voltage limit
+} Candidate_t;
+
+// sweep settings, read only while workers run
+static Zumo_Plant_Params_t _plant;
+static float _step         = 500;
+static float _duration     = 1.0f;
+static float _update       = 0.002f;
+static float _w_overshoot  = 1.0f;
+static float _w_saturation = 0.2f;
+static float _w_settle     = 0.5f;
+static unsigned _threads   = 1;
+
+/**
+ * Lead/lag filter coefficients with unity DC gain, in the Filter_Init layout.
+ */
+static void _filter_coefficients( float zero, float pole, float num[2], float den[2] )
+{
+    float scale = ( 1 - zero ) / ( 1 - pole );
+    num[0]      = 1;
+    num[1]      = -zero;
+    den[0]      = scale;
+    den[1]      = -pole * scale;
+}
+
+/**
+ * Runs one closed loop step response and scores it. Only touches its own controller and plant, so it is safe to
+ * call from several threads.
+ */
+static void _evaluate( Candidate_t* p_cand )
+{
+    p_cand->valid = false;
+    p_cand->cost  = INFINITY;
+    if( p_cand->kp <= 0 || p_cand->zero <= -1 || p_cand->zero >= 1 || p_cand->pole <= -1 || p_cand->pole >= 1 )
+        return;
+
+    float num[2], den[2];
+    _filter_coefficients( p_cand->zero, p_cand->pole, num, den );
+
+    Controller_t controller[2];
+    for( uint8_t m = 0; m < 2; m++ ) {
+        Controller_Init( &controller[m], p_cand->kp, num, den, 1, _update );
+        Controller_Set_Target_Position( &controller[m], _step );
+    }
+
+    Zumo_Plant_State_t plant;
+    Zumo_Plant_Init( &plant, &_plant );
+
+    unsigned steps     = (unsigned)( _duration / _update + 0.5f );
+    float t10[2]       = { -1, -1 };
+    float t90[2]       = { -1, -1 };
+    float peak[2]      = { 0, 0 };
+    float settle[2]    = { 0, 0 };
+    unsigned saturated = 0;
+
+    for( unsigned k = 0; k < steps; k++ ) {
+        float t = k * _update;
+        float duty[2];
+        for( uint8_t m = 0; m < 2; m++ ) {
+            float y = (float)floor( plant.position[m] );
+
+            if( t10[m] < 0 && y >= 0.1f * _step )
+                t10[m] = t;
+            if( t90[m] < 0 && y >= 0.9f * _step )
+                t90[m] = t;
+            if( y > peak[m] )
+                peak[m] = y;
+            if( fabsf( y - _step ) > 0.02f * _step )
+                settle[m] = t + _update;
+
+            float volts = Controller_Update( &controller[m], y, _update );
+            if( !isfinite( volts ) )
+                return;
+            if( fabsf( volts ) >= plant.battery ) {
+                volts = copysignf( plant.battery, volts );
+                saturated++;
+            }
+            duty[m] = plant.battery > 0 ? volts / plant.battery : 0;
+        }
+        Zumo_Plant_Step( &plant, &_plant, duty[ZUMO_LEFT], duty[ZUMO_RIGHT], _update );
+    }
+
+    // score the worse wheel
+    p_cand->rise = p_cand->overshoot = p_cand->settle = 0;
+    for( uint8_t m = 0; m < 2; m++ ) {
+        if( t90[m] < 0 || settle[m] >= _duration )
+            return;
+        p_cand->rise      = fmaxf( p_cand->rise, t90[m] - t10[m] );
+        p_cand->overshoot = fmaxf( p_cand->overshoot, fmaxf( peak[m] - _step, 0 ) / _step );
+        p_cand->settle    = fmaxf( p_cand->settle, settle[m] );
+    }
+    p_cand->saturation = (float)saturated / ( 2 * steps );
+    p_cand->cost       = p_cand->rise + _w_overshoot * p_cand->overshoot + _w_saturation * p_cand->saturation
+                   + _w_settle * p_cand->settle;
+    p_cand->valid = true;
+}
+
+/**
+ * Thread pool: the workers take candidates off a shared index until the batch is done.
+ */
+typedef struct { Candidate_t* candidates; size_t count; size_t next; } Batch_t;
+
+static void* _worker( void* arg )
+{
+    Batch_t* p_batch = arg;
+    for( ;; ) {
+        size_t i = __atomic_fetch_add( &p_batch->next, 1, __ATOMIC_RELAXED );
+        if( i >= p_batch->count )
+            return NULL;
+        _evaluate( &p_batch->candidates[i] );
+    }
+}
+
+static void _evaluate_all( Candidate_t* candidates, size_t count )
+{
+    Batch_t batch      = { candidates, count, 0 };
+    unsigned n_threads = _threads < count ? _threads : (unsigned)count;
+    pthread_t threads[n_threads ? n_threads : 1];
+    unsigned started = 0;
+    for( ; started < n_threads; started++ )
+        if( pthread_create( &threads[started], NULL, _worker, &batch ) != 0 )
+            break;
+    if( started == 0 )
+        _worker( &batch );  // no threads available, run the batch here
+    for( unsigned i = 0; i < started; i++ )
+        pthread_join( threads[i], NULL );
+}
+
+static int _by_cost( const void* a, const void* b )
+{
+    float ca = ( (const Candidate_t*)a )->cost;
+    float cb = ( (const Candidate_t*)b )->cost;
+    return ( ca > cb ) - ( ca < cb );
+}
+
+static float _range_value( const Range_t* p_range, unsigned i )
+{
+    return p_range->n < 2 ? p_range->min : p_range->min + ( p_range->max - p_range->min ) * i / ( p_range->n - 1 );
+}
+
+static bool _parse_range( const char* arg, Range_t* p_range )
+{
+    return sscanf( arg, "%f:%f:%u", &p_range->min, &p_range->max, &p_range->n ) == 3 && p_range->n > 0;
+}
+
+/**
+ * Pattern search from the best grid point: try +-step on each parameter, move to the best improvement or halve the
+ * steps. The neighbours of a round are evaluated in parallel.
+ */
+static Candidate_t _refine( Candidate_t best, float step_kp, float step_zero, float step_pole, unsigned rounds )
+{
+    for( unsigned r = 0; r < rounds && best.valid; r++ ) {
+        Candidate_t next[6];
+        for( uint8_t i = 0; i < 6; i++ ) {
+            next[i]    = best;
+            float sign = ( i & 1 ) ? -1.0f : 1.0f;
+            if( i < 2 )
+                next[i].kp += sign * step_kp;
+            else if( i < 4 )
+                next[i].zero += sign * step_zero;
+            else
+                next[i].pole += sign * step_pole;
+        }
+        _evaluate_all( next, 6 );
+        qsort( next, 6, sizeof( Candidate_t ), _by_cost );
+        if( next[0].valid && next[0].cost < best.cost ) {
+            best = next[0];
+        } else {
+            step_kp /= 2;
+            step_zero /= 2;
+            step_pole /= 2;
+        }
+    }
+    return best;
+}
+
+static bool _write_header( const char* path, const Candidate_t* p_best, size_t evaluated )
+{
+    FILE* f = fopen( path, "w" );
+    if( !f ) {
+        perror( path );
+        return false;
+    }
+    float num[2], den[2];
+    _filter_coefficients( p_best->zero, p_best->pole, num, den );
+
+    fprintf( f, "/**\n" );
+    fprintf( f, " * Lab5 position controller gains written by Host/gain_sweep (best of %zu candidates).\n", evaluated );
+    fprintf( f, " *\n" );
+    fprintf( f, " * Plant: gain %.1f counts/s/V, deadband %.3f V, tau_m %.4f s, tau_e %.4f s, battery %.2f V.\n",
+             _plant.motor[0].gain, _plant.motor[0].deadband, _plant.motor[0].tau_m, _plant.motor[0].tau_e,
+             _plant.battery_open );
+    fprintf( f, " * Step %.0f counts, update period %.4f s: rise %.4f s, overshoot %.1f%%, settling %.4f s, "
+                "saturated %.1f%%.\n",
+             _step, _update, p_best->rise, 100 * p_best->overshoot, p_best->settle, 100 * p_best->saturation );
+    fprintf( f, " *\n" );
+    fprintf( f, " * e.g. float KpLeft = LAB5_CONTROLLER_KP; float leftNumerator[] = LAB5_CONTROLLER_NUMERATOR;\n" );
+    fprintf( f, " */\n" );
+    fprintf( f, "#ifndef LAB5_CONTROLLER_GAINS_H\n#define LAB5_CONTROLLER_GAINS_H\n\n" );
+    fprintf( f, "#define LAB5_CONTROLLER_UPDATE_PERIOD %.9gf\n", _update );
+    fprintf( f, "#define LAB5_CONTROLLER_ORDER 1\n" );
+    fprintf( f, "#define LAB5_CONTROLLER_KP %.9gf\n", p_best->kp );
+    fprintf( f, "#define LAB5_CONTROLLER_NUMERATOR { %.12g, %.12g }\n", num[0], num[1] );
+    fprintf( f, "#define LAB5_CONTROLLER_DENOMINATOR { %.12g, %.12g }\n", den[0], den[1] );
+    fprintf( f, "\n#endif\n" );
+    fclose( f );
+    return true;
+}
+
+static void _usage( void )
+{
+    fprintf( stderr, "usage: gain_sweep [-k min:max:n] [-z min:max:n] [-p min:max:n] [-r rounds] [-s step_counts] "
+                     "[-T seconds] [-u update_s] [-g gain] [-d deadband] [-m tau_m] [-e tau_e] [-b volts] "
+                     "[-W os,sat,settle] [-j threads] [-n top] [-o header.h]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    Range_t kp          = { 0.02f, 1.0f, 50 };
+    Range_t zero        = { 0.90f, 0.995f, 10 };
+    Range_t pole        = { 0.80f, 0.998f, 12 };
+    unsigned rounds     = 40;
+    unsigned top        = 10;
+    const char* header  = "lab5_controller_gains.h";
+    long cpus           = sysconf( _SC_NPROCESSORS_ONLN );
+    _threads            = cpus > 0 ? (unsigned)cpus : 1;
+
+    Zumo_Plant_Default_Params( &_plant );
+
+    int opt;
+    while( ( opt = getopt( argc, argv, "k:z:p:r:s:T:u:g:d:m:e:b:W:j:n:o:" ) ) != -1 ) {
+        bool ok = true;
+        switch( opt ) {
+            case 'k': ok = _parse_range( optarg, &kp ); break;
+            case 'z': ok = _parse_range( optarg, &zero ); break;
+            case 'p': ok = _parse_range( optarg, &pole ); break;
+            case 'r': rounds = (unsigned)atoi( optarg ); break;
+            case 's': _step = atof( optarg ); ok = _step > 0; break;
+            case 'T': _duration = atof( optarg ); ok = _duration > 0; break;
+            case 'u': _update = atof( optarg ); ok = _update > 0; break;
+            case 'b': _plant.battery_open = atof( optarg ); break;
+            case 'W':
+                ok = sscanf( optarg, "%f,%f,%f", &_w_overshoot, &_w_saturation, &_w_settle ) == 3;
+                break;
+            case 'j': _threads = (unsigned)atoi( optarg ); ok = _threads > 0; break;
+            case 'n': top = (unsigned)atoi( optarg ); break;
+            case 'o': header = optarg; break;
+            case 'g':
+            case 'd':
+            case 'm':
+            case 'e':
+                for( uint8_t m = 0; m < 2; m++ ) {
+                    Zumo_Motor_Params_t* p_motor = &_plant.motor[m];
+                    float value                  = atof( optarg );
+                    if( opt == 'g' )
+                        p_motor->gain = value;
+                    else if( opt == 'd' )
+                        p_motor->deadband = value;
+                    else if( opt == 'm' )
+                        p_motor->tau_m = value;
+                    else
+                        p_motor->tau_e = value;
+                }
+                break;
+            default: ok = false;
+        }
+        if( !ok )
+            _usage();
+    }
+
+    size_t count            = (size_t)kp.n * zero.n * pole.n;
+    Candidate_t* candidates = calloc( count, sizeof( Candidate_t ) );
+    if( !candidates ) {
+        fprintf( stderr, "gain_sweep: out of memory\n" );
+        return 2;
+    }
+    size_t c = 0;
+    for( unsigned i = 0; i < kp.n; i++ )
+        for( unsigned j = 0; j < zero.n; j++ )
+            for( unsigned k = 0; k < pole.n; k++, c++ ) {
+                candidates[c].kp   = _range_value( &kp, i );
+                candidates[c].zero = _range_value( &zero, j );
+                candidates[c].pole = _range_value( &pole, k );
+            }
+
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    _evaluate_all( candidates, count );
+    qsort( candidates, count, sizeof( Candidate_t ), _by_cost );
+
+    size_t valid = 0;
+    while( valid < count && candidates[valid].valid )
+        valid++;
+    if( !valid ) {
+        fprintf( stderr, "gain_sweep: no candidate reached and settled on the step, widen the grid or -T\n" );
+        return 1;
+    }
+
+    float step_kp   = kp.n > 1 ? ( kp.max - kp.min ) / ( kp.n - 1 ) : kp.min / 4;
+    float step_zero = zero.n > 1 ? ( zero.max - zero.min ) / ( zero.n - 1 ) : 0.01f;
+    float step_pole = pole.n > 1 ? ( pole.max - pole.min ) / ( pole.n - 1 ) : 0.01f;
+    Candidate_t best = _refine( candidates[0], step_kp, step_zero, step_pole, rounds );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    double wall = ( end.tv_sec - start.tv_sec ) + 1e-9 * ( end.tv_nsec - start.tv_nsec );
+
+    printf( "%zu candidates (%zu settled) on %u threads in %.3f s, %.0f step responses/s\n", count, valid, _threads,
+            wall, count / wall );
+    printf( "%4s %10s %8s %8s %8s %9s %8s %8s %8s\n", "rank", "kp", "zero", "pole", "cost", "rise[s]", "os[%]",
+            "sat[%]", "ts[s]" );
+    for( unsigned i = 0; i < top && i < valid; i++ ) {
+        const Candidate_t* p = &candidates[i];
+        printf( "%4u %10.5f %8.5f %8.5f %8.4f %9.4f %8.2f %8.2f %8.4f\n", i + 1, p->kp, p->zero, p->pole, p->cost,
+                p->rise, 100 * p->overshoot, 100 * p->saturation, p->settle );
+    }
+    printf( "%4s %10.5f %8.5f %8.5f %8.4f %9.4f %8.2f %8.2f %8.4f\n", "best", best.kp, best.zero, best.pole,
+            best.cost, best.rise, 100 * best.overshoot, 100 * best.saturation, best.settle );
+
+    bool ok = _write_header( header, &best, count );
+    free( candidates );
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,90 @@
+/*
+ * Host stand-in for the subset of LUFA's device mode USB API used by c_lib/SerialIO.c. The CDC data endpoints are
+ * backed by byte FIFOs in Host_USB.c that the host side fills and drains with Host_CDC_Write/Host_CDC_Read, one
+ * CDC_TXRX_EPSIZE packet per bank like the real endpoints. Control requests and descriptors are not emulated.
+ */
+#ifndef _HOST_LUFA_USB_H
+#define _HOST_LUFA_USB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/interrupt.h>
+#include <LUFA/Platform/Platform.h>
+
+#define ATTR_WARN_UNUSED_RESULT
+#define ATTR_NON_NULL_PTR_ARG(...)
+#define ATTR_PACKED __attribute__((packed))
+
+#define ENDPOINT_DIR_IN  0x80
+#define ENDPOINT_DIR_OUT 0x00
+#define ENDPOINT_EPNUM_MASK 0x0F
+
+enum { EP_TYPE_CONTROL = 0, EP_TYPE_ISOCHRONOUS, EP_TYPE_BULK, EP_TYPE_INTERRUPT };
+
+enum USB_Device_States_t { DEVICE_STATE_Unattached = 0, DEVICE_STATE_Powered, DEVICE_STATE_Default,
+                           DEVICE_STATE_Addressed, DEVICE_STATE_Configured, DEVICE_STATE_Suspended };
+
+enum Endpoint_WaitUntilReady_ErrorCodes_t { ENDPOINT_READYWAIT_NoError = 0, ENDPOINT_READYWAIT_EndpointStalled,
+                                            ENDPOINT_READYWAIT_DeviceDisconnected, ENDPOINT_READYWAIT_BusSuspended,
+                                            ENDPOINT_READYWAIT_Timeout };
+
+enum Endpoint_Stream_RW_ErrorCodes_t { ENDPOINT_RWSTREAM_NoError = 0, ENDPOINT_RWSTREAM_EndpointStalled,
+                                       ENDPOINT_RWSTREAM_DeviceDisconnected, ENDPOINT_RWSTREAM_BusSuspended,
+                                       ENDPOINT_RWSTREAM_Timeout, ENDPOINT_RWSTREAM_IncompleteTransfer };
+
+#define REQDIR_HOSTTODEVICE (0 << 7)
+#define REQDIR_DEVICETOHOST (1 << 7)
+#define REQTYPE_STANDARD    (0 << 5)
+#define REQTYPE_CLASS       (1 << 5)
+#define REQTYPE_VENDOR      (2 << 5)
+#define REQREC_DEVICE       (0 << 0)
+#define REQREC_INTERFACE    (1 << 0)
+#define REQREC_ENDPOINT     (2 << 0)
+
+typedef struct { uint8_t bmRequestType; uint8_t bRequest; uint16_t wValue; uint16_t wIndex; uint16_t wLength; }
+        USB_Request_Header_t;
+
+// CDC class definitions
+enum CDC_ClassRequests_t { CDC_REQ_SendEncapsulatedCommand = 0x00, CDC_REQ_GetEncapsulatedResponse = 0x01,
+                           CDC_REQ_SetLineEncoding = 0x20, CDC_REQ_GetLineEncoding = 0x21,
+                           CDC_REQ_SetControlLineState = 0x22, CDC_REQ_SendBreak = 0x23 };
+enum CDC_LineEncodingFormats_t { CDC_LINEENCODING_OneStopBit = 0, CDC_LINEENCODING_OneAndAHalfStopBits,
+                                 CDC_LINEENCODING_TwoStopBits };
+enum CDC_LineEncodingParity_t { CDC_PARITY_None = 0, CDC_PARITY_Odd, CDC_PARITY_Even, CDC_PARITY_Mark,
+                                CDC_PARITY_Space };
+typedef struct { uint32_t BaudRateBPS; uint8_t CharFormat; uint8_t ParityType; uint8_t DataBits; } ATTR_PACKED
+        CDC_LineEncoding_t;
+
+// Descriptor types, only needed so USB_Config/Descriptors.h parses
+typedef struct { uint8_t Size; uint8_t Type; } USB_Descriptor_Header_t;
+typedef USB_Descriptor_Header_t USB_Descriptor_Configuration_Header_t;
+typedef USB_Descriptor_Header_t USB_Descriptor_Interface_t;
+typedef USB_Descriptor_Header_t USB_Descriptor_Endpoint_t;
+typedef USB_Descriptor_Header_t USB_CDC_Descriptor_FunctionalHeader_t;
+typedef USB_Descriptor_Header_t USB_CDC_Descriptor_FunctionalACM_t;
+typedef USB_Descriptor_Header_t USB_CDC_Descriptor_FunctionalUnion_t;
+
+extern volatile uint8_t USB_DeviceState;
+extern USB_Request_Header_t USB_ControlRequest;
+
+void USB_Init(void);
+void USB_USBTask(void);
+
+bool     Endpoint_ConfigureEndpoint(const uint8_t Address, const uint8_t Type, const uint16_t Size, const uint8_t Banks);
+void     Endpoint_SelectEndpoint(const uint8_t Address);
+bool     Endpoint_IsOUTReceived(void);
+bool     Endpoint_IsINReady(void);
+uint16_t Endpoint_BytesInEndpoint(void);
+uint8_t  Endpoint_Read_8(void);
+void     Endpoint_Write_8(const uint8_t Data);
+void     Endpoint_ClearOUT(void);
+void     Endpoint_ClearIN(void);
+uint8_t  Endpoint_WaitUntilReady(void);
+uint8_t  Endpoint_Read_Stream_LE(void* const Buffer, uint16_t Length, uint16_t* const BytesProcessed);
+uint8_t  Endpoint_Write_Stream_LE(const void* const Buffer, uint16_t Length, uint16_t* const BytesProcessed);
+void     Endpoint_ClearSETUP(void);
+void     Endpoint_ClearStatusStage(void);
+uint8_t  Endpoint_Write_Control_Stream_LE(const void* const Buffer, uint16_t Length);
+uint8_t  Endpoint_Read_Control_Stream_LE(void* const Buffer, uint16_t Length);
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for LUFA's Platform.h.
+ */
+#ifndef _HOST_LUFA_PLATFORM_H
+#define _HOST_LUFA_PLATFORM_H
+
+#define ARCH_AVR8 0
+#define ARCH_UC3  1
+#define ARCH_XMEGA 2
+
+#define GlobalInterruptEnable()  sei()
+#define GlobalInterruptDisable() cli()
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for <avr/interrupt.h>. ISR(vector) defines an ordinary function named after the vector, which
+ * Host_HAL.c calls when the emulated flag, enable bit and SREG I bit line up. cli()/sei() set and clear SREG_I;
+ * sei() also runs any interrupt that became pending while interrupts were disabled.
+ */
+#ifndef _HOST_AVR_INTERRUPT_H
+#define _HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...) void vector(void)
+
+void cli(void);
+void sei(void);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * Host stand-in for <avr/io.h> (ATmega32U4). The I/O registers are plain volatile variables defined in Host_HAL.c.
+ * Firmware reads and writes them exactly as it would on the chip; the peripherals behind them are emulated by
+ * Host_HAL.c as simulated time is advanced. Bit names and positions follow avr-libc's iom32u4.h.
+ */
+#ifndef _HOST_AVR_IO_H
+#define _HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+#define bit_is_set(sfr, bit)   ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)   do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#define _HOST_REG8(name)  extern volatile uint8_t  name;
+#define _HOST_REG16(name) extern volatile uint16_t name;
+#define _HOST_LO(reg16) (((volatile uint8_t*)&(reg16))[0])
+#define _HOST_HI(reg16) (((volatile uint8_t*)&(reg16))[1])
+
+// Status register
+_HOST_REG8(SREG)
+#define SREG_C 0
+#define SREG_Z 1
+#define SREG_N 2
+#define SREG_V 3
+#define SREG_S 4
+#define SREG_H 5
+#define SREG_T 6
+#define SREG_I 7
+
+// General purpose I/O registers and MCU status
+_HOST_REG8(GPIOR0) _HOST_REG8(GPIOR1) _HOST_REG8(GPIOR2)
+_HOST_REG8(MCUSR) _HOST_REG8(MCUCR) _HOST_REG8(CLKPR) _HOST_REG8(PRR0) _HOST_REG8(PRR1)
+#define PORF  0
+#define EXTRF 1
+#define BORF  2
+#define WDRF  3
+#define JTRF  4
+
+// Ports
+_HOST_REG8(PINB) _HOST_REG8(DDRB) _HOST_REG8(PORTB)
+_HOST_REG8(PINC) _HOST_REG8(DDRC) _HOST_REG8(PORTC)
+_HOST_REG8(PIND) _HOST_REG8(DDRD) _HOST_REG8(PORTD)
+_HOST_REG8(PINE) _HOST_REG8(DDRE) _HOST_REG8(PORTE)
+_HOST_REG8(PINF) _HOST_REG8(DDRF) _HOST_REG8(PORTF)
+
+#define _HOST_PORT_BITS(P)                                                                               \
+    P##0 = 0, P##1 = 1, P##2 = 2, P##3 = 3, P##4 = 4, P##5 = 5, P##6 = 6, P##7 = 7
+enum { _HOST_PORT_BITS(PINB), _HOST_PORT_BITS(DDB), _HOST_PORT_BITS(PORTB), _HOST_PORT_BITS(PB) };
+enum { _HOST_PORT_BITS(PINC), _HOST_PORT_BITS(DDC), _HOST_PORT_BITS(PORTC), _HOST_PORT_BITS(PC) };
+enum { _HOST_PORT_BITS(PIND), _HOST_PORT_BITS(DDD), _HOST_PORT_BITS(PORTD), _HOST_PORT_BITS(PD) };
+enum { _HOST_PORT_BITS(PINE), _HOST_PORT_BITS(DDE), _HOST_PORT_BITS(PORTE), _HOST_PORT_BITS(PE) };
+enum { _HOST_PORT_BITS(PINF), _HOST_PORT_BITS(DDF), _HOST_PORT_BITS(PORTF), _HOST_PORT_BITS(PF) };
+
+// Timer/Counter 0
+_HOST_REG8(TCCR0A) _HOST_REG8(TCCR0B) _HOST_REG8(TCNT0) _HOST_REG8(OCR0A) _HOST_REG8(OCR0B)
+_HOST_REG8(TIMSK0) _HOST_REG8(TIFR0) _HOST_REG8(GTCCR)
+#define WGM00  0
+#define WGM01  1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00   0
+#define CS01   1
+#define CS02   2
+#define WGM02  3
+#define FOC0B  6
+#define FOC0A  7
+#define TOIE0  0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0   0
+#define OCF0A  1
+#define OCF0B  2
+#define PSRSYNC 0
+#define TSM     7
+
+// Timer/Counter 1 and 3 (16 bit)
+_HOST_REG8(TCCR1A) _HOST_REG8(TCCR1B) _HOST_REG8(TCCR1C)
+_HOST_REG16(TCNT1) _HOST_REG16(OCR1A) _HOST_REG16(OCR1B) _HOST_REG16(OCR1C) _HOST_REG16(ICR1)
+_HOST_REG8(TIMSK1) _HOST_REG8(TIFR1)
+_HOST_REG8(TCCR3A) _HOST_REG8(TCCR3B) _HOST_REG8(TCCR3C)
+_HOST_REG16(TCNT3) _HOST_REG16(OCR3A) _HOST_REG16(OCR3B) _HOST_REG16(OCR3C) _HOST_REG16(ICR3)
+_HOST_REG8(TIMSK3) _HOST_REG8(TIFR3)
+#define TCNT1L _HOST_LO(TCNT1)
+#define TCNT1H _HOST_HI(TCNT1)
+#define OCR1AL _HOST_LO(OCR1A)
+#define OCR1AH _HOST_HI(OCR1A)
+#define OCR1BL _HOST_LO(OCR1B)
+#define OCR1BH _HOST_HI(OCR1B)
+#define ICR1L  _HOST_LO(ICR1)
+#define ICR1H  _HOST_HI(ICR1)
+#define TCNT3L _HOST_LO(TCNT3)
+#define TCNT3H _HOST_HI(TCNT3)
+#define WGM10  0
+#define WGM11  1
+#define COM1C0 2
+#define COM1C1 3
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define ICES1  6
+#define ICNC1  7
+#define TOIE1  0
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCIE1C 3
+#define ICIE1  5
+#define TOV1   0
+#define OCF1A  1
+#define OCF1B  2
+#define OCF1C  3
+#define ICF1   5
+#define WGM30  0
+#define WGM31  1
+#define COM3C0 2
+#define COM3C1 3
+#define COM3B0 4
+#define COM3B1 5
+#define COM3A0 6
+#define COM3A1 7
+#define CS30   0
+#define CS31   1
+#define CS32   2
+#define WGM32  3
+#define WGM33  4
+#define TOIE3  0
+#define OCIE3A 1
+#define OCIE3B 2
+#define OCIE3C 3
+#define ICIE3  5
+#define TOV3   0
+#define OCF3A  1
+#define OCF3B  2
+#define OCF3C  3
+#define ICF3   5
+
+// External and pin change interrupts
+_HOST_REG8(EICRA) _HOST_REG8(EICRB) _HOST_REG8(EIMSK) _HOST_REG8(EIFR)
+_HOST_REG8(PCICR) _HOST_REG8(PCIFR) _HOST_REG8(PCMSK0)
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define ISC20 4
+#define ISC21 5
+#define ISC30 6
+#define ISC31 7
+#define ISC40 0
+#define ISC41 1
+#define ISC50 2
+#define ISC51 3
+#define ISC60 4
+#define ISC61 5
+#define ISC70 6
+#define ISC71 7
+#define INT0  0
+#define INT1  1
+#define INT2  2
+#define INT3  3
+#define INT6  6
+#define INTF0 0
+#define INTF1 1
+#define INTF2 2
+#define INTF3 3
+#define INTF6 6
+#define PCIE0 0
+#define PCIF0 0
+enum { _HOST_PORT_BITS(PCINT) };
+
+// ADC
+// ADCSRA goes through an accessor so a conversion started by setting ADSC completes (instantly) the next time the
+// register is touched, which is what the firmware's polling loops need. See Host_ADC_Set in Host_HAL.h.
+extern volatile uint8_t _host_ADCSRA;
+volatile uint8_t* Host_ADCSRA_Access(void);
+#define ADCSRA (*Host_ADCSRA_Access())
+_HOST_REG8(ADCSRB) _HOST_REG8(ADMUX) _HOST_REG8(DIDR0) _HOST_REG8(DIDR2)
+_HOST_REG16(ADC)
+#define ADCW ADC
+#define ADCL _HOST_LO(ADC)
+#define ADCH _HOST_HI(ADC)
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE  3
+#define ADIF  4
+#define ADATE 5
+#define ADSC  6
+#define ADEN  7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ADTS3 3
+#define MUX5  5
+#define ADHSM 7
+#define MUX0  0
+#define MUX1  1
+#define MUX2  2
+#define MUX3  3
+#define MUX4  4
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+
+#endif
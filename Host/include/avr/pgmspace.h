@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for <avr/pgmspace.h>. Flash and RAM share one address space on the host.
+ */
+#ifndef _HOST_AVR_PGMSPACE_H
+#define _HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr)  (*(const uint8_t*)(addr))
+#define pgm_read_word(addr)  (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_float(addr) (*(const float*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif
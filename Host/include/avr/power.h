@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for <avr/power.h>. The emulated core always runs at F_CPU.
+ */
+#ifndef _HOST_AVR_POWER_H
+#define _HOST_AVR_POWER_H
+
+typedef enum { clock_div_1 = 0, clock_div_2, clock_div_4, clock_div_8, clock_div_16, clock_div_32, clock_div_64,
+               clock_div_128, clock_div_256 } clock_div_t;
+
+#define clock_prescale_set(div) do { (void)(div); } while (0)
+
+#endif
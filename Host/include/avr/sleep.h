@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for <avr/sleep.h>. Sleeping is not emulated, the calls return immediately.
+ */
+#ifndef _HOST_AVR_SLEEP_H
+#define _HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+#define set_sleep_mode(mode) do { (void)(mode); } while (0)
+#define sleep_enable()       do { } while (0)
+#define sleep_disable()      do { } while (0)
+#define sleep_cpu()          do { } while (0)
+#define sleep_mode()         do { } while (0)
+
+#endif
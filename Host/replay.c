@@ -0,0 +1,429 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * replay drives the Lab5 firmware (compiled for the host, see Host_HAL.h) with a recorded SerialMonitor session and
+ * checks the telemetry it produces against the recording.
+ *
+ *   replay -s <script.csv> [-r <recording.csv>] [-p] [-o <out.csv>] [-d delay_ms] [-b volts] [-l loop_cycles]
+ *          [-t tol]
+ *
+ *   -s  command script in the SerialMonitor "Load CSV Commands" format, e.g. SerialMonitor/sys_id_file.csv:
+ *       one command per line, "<struct format>, <cmd>, <values...>". Line k is sent k*delay_ms after the first.
+ *   -r  recording saved by SerialMonitor (e.g. Lab5_data.csv): "<host time>, q, <time>, <PWM_L>, <PWM_R>,
+ *       <Encoder_L>, <Encoder_R>". Its encoder columns are fed back to the firmware as encoder edges and the
+ *       regenerated 'q' rows are compared to the recorded row nearest in time. Rows are lined up on their host time
+ *       since the first 'q' row, not on the firmware's <time> column, so a change that resets or scales the
+ *       firmware clock shows up in the diff instead of shifting the comparison. A file written with -o can be
+ *       given back as -r to regression test a later build.
+ *   -p  drive the encoders and battery from the simulated drive train (Zumo_Plant.h) instead of the recording, so
+ *       the firmware runs closed loop. A recording is then only used for the comparison.
+ *   -o  write the regenerated telemetry in the same CSV format (host time is simulated seconds).
+ *   -d  milliseconds between script commands, as entered in SerialMonitor. Default 500.
+ *   -b  battery voltage seen by the firmware. Default 6.0. With -p, the plant's battery open circuit voltage.
+ *   -l  CPU cycles charged per main loop pass (Host_Set_Loop_Cycles). Default 160.
+ *   -t  fail (exit status 1) if any compared column differs by more than this. The fed back encoder counts are
+ *       resampled, so a regression run against a file from -o needs -t 1.
+ *
+ * e.g. make replay && ./replay -s ../SerialMonitor/sys_id_file.csv -r ../SerialMonitor/Lab5_data.csv -d 510
+ *
+ * The run ends once every command has been sent and the time of the last recorded row has passed (2 s after the
+ * last command without a recording). Simulated time only costs what the emulation costs, so runs go many
+ * times faster than real time; the report gives the speed.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Host_HAL.h"
+#include "Zumo_Plant.h"
+
+int Lab5_main( void );  // Lab5-Control.c compiled with -Dmain=Lab5_main
+
+#define MAX_CMD_BYTES 32
+#define N_COLUMNS     4
+
+typedef struct { uint8_t bytes[MAX_CMD_BYTES]; uint8_t len; } Command_t;
+// since: host seconds since the first 'q' row, the time base rows are matched on
+typedef struct { double host_time; double time; double since; int16_t v[N_COLUMNS]; } Telemetry_t;
+typedef struct { Telemetry_t* rows; size_t len; size_t cap; } Telemetry_List_t;
+
+static const char* const _column_names[N_COLUMNS] = { "PWM_L", "PWM_R", "Encoder_L", "Encoder_R" };
+
+static Command_t* _commands;
+static size_t _n_commands;
+static Telemetry_List_t _recorded;
+static Telemetry_List_t _regenerated;
+
+// replay state, advanced by the USBTask hook
+static double _delay_s       = 0.5;
+static double _start_s       = -1;   // simulated time the first command went out
+static size_t _next_command  = 0;
+static double _first_row_s   = -1;   // simulated time the first 'q' row arrived
+static double _end_time      = 2.0;  // seconds after the first 'q' row to stop at
+static double _give_up       = 4.0;  // seconds after the first command to stop at if no 'q' row comes
+static size_t _trace_index   = 0;
+static int32_t _encoder[2]   = { 0, 0 };
+static uint64_t _loops       = 0;
+static uint8_t _rx[512];
+static uint16_t _rx_len      = 0;
+static uint32_t _other_msgs  = 0;
+static bool _use_plant       = false;
+static Zumo_Plant_Params_t _plant_params;
+static Zumo_Plant_State_t _plant;
+
+static void _append( Telemetry_List_t* p_list, const Telemetry_t* p_row )
+{
+    if( p_list->len == p_list->cap ) {
+        p_list->cap  = p_list->cap ? 2 * p_list->cap : 1024;
+        p_list->rows = realloc( p_list->rows, p_list->cap * sizeof( Telemetry_t ) );
+        if( !p_list->rows ) {
+            fprintf( stderr, "replay: out of memory\n" );
+            exit( 2 );
+        }
+    }
+    p_list->rows[p_list->len++] = *p_row;
+}
+
+static char* _trim( char* s )
+{
+    while( *s == ' ' || *s == '\t' )
+        s++;
+    char* end = s + strlen( s );
+    while( end > s && ( end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n' ) )
+        *--end = 0;
+    return s;
+}
+
+/**
+ * Packs one script line the way serial_monitor_lib.write does: struct.pack("<"+format, values...).
+ */
+static bool _pack_command( char* line, Command_t* p_cmd )
+{
+    char* fields[MAX_CMD_BYTES];
+    uint8_t n_fields = 0;
+    for( char* tok = strtok( line, "," ); tok && n_fields < MAX_CMD_BYTES; tok = strtok( NULL, "," ) )
+        fields[n_fields++] = _trim( tok );
+    if( n_fields < 2 )
+        return false;
+
+    const char* format = fields[0];
+    if( strlen( format ) != n_fields - 1u )
+        return false;
+
+    p_cmd->len = 0;
+    for( uint8_t i = 0; format[i]; i++ ) {
+        const char* value = fields[i + 1];
+        union { int8_t b; int16_t h; int32_t i; float f; uint8_t raw[4]; } packed;
+        uint8_t size;
+        switch( format[i] ) {
+            case 'c': packed.raw[0] = (uint8_t)value[0]; size = 1; break;
+            case 'b':
+            case 'B': packed.b = (int8_t)strtol( value, NULL, 0 ); size = 1; break;
+            case 'h':
+            case 'H': packed.h = (int16_t)strtol( value, NULL, 0 ); size = 2; break;
+            case 'i':
+            case 'I':
+            case 'l':
+            case 'L': packed.i = (int32_t)strtol( value, NULL, 0 ); size = 4; break;
+            case 'f': packed.f = strtof( value, NULL ); size = 4; break;
+            default: return false;
+        }
+        if( p_cmd->len + size > MAX_CMD_BYTES )
+            return false;
+        memcpy( p_cmd->bytes + p_cmd->len, packed.raw, size );  // little endian, as the AVR
+        p_cmd->len += size;
+    }
+    return true;
+}
+
+static bool _load_script( const char* path )
+{
+    FILE* f = fopen( path, "r" );
+    if( !f ) {
+        perror( path );
+        return false;
+    }
+    char line[256];
+    unsigned line_no = 0;
+    while( fgets( line, sizeof( line ), f ) ) {
+        line_no++;
+        if( *_trim( line ) == 0 )
+            continue;
+        _commands = realloc( _commands, ( _n_commands + 1 ) * sizeof( Command_t ) );
+        if( !_commands || !_pack_command( line, &_commands[_n_commands] ) ) {
+            fprintf( stderr, "%s:%u: cannot pack command\n", path, line_no );
+            fclose( f );
+            return false;
+        }
+        _n_commands++;
+    }
+    fclose( f );
+    return _n_commands > 0;
+}
+
+static bool _load_recording( const char* path )
+{
+    FILE* f = fopen( path, "r" );
+    if( !f ) {
+        perror( path );
+        return false;
+    }
+    char line[256];
+    while( fgets( line, sizeof( line ), f ) ) {
+        Telemetry_t row;
+        char cmd;
+        int v[N_COLUMNS];
+        if( sscanf( line, "%lf , %c , %lf , %d , %d , %d , %d", &row.host_time, &cmd, &row.time, &v[0], &v[1], &v[2],
+                    &v[3] ) != 7 || cmd != 'q' )
+            continue;
+        for( uint8_t c = 0; c < N_COLUMNS; c++ )
+            row.v[c] = (int16_t)v[c];
+        row.since = _recorded.len ? row.host_time - _recorded.rows[0].host_time : 0;
+        _append( &_recorded, &row );
+    }
+    fclose( f );
+    return _recorded.len > 0;
+}
+
+/**
+ * Recorded encoder count t seconds after the first 'q' row, linearly interpolated. t only moves forward, so a cursor is kept.
+ */
+static int32_t _recorded_count( uint8_t column, double t )
+{
+    const Telemetry_t* rows = _recorded.rows;
+    while( _trace_index + 1 < _recorded.len && rows[_trace_index + 1].since <= t )
+        _trace_index++;
+    const Telemetry_t* a = &rows[_trace_index];
+    if( t <= a->since || _trace_index + 1 >= _recorded.len )
+        return a->v[column];
+    const Telemetry_t* b = &rows[_trace_index + 1];
+    double frac          = ( t - a->since ) / ( b->since - a->since );
+    return (int32_t)( a->v[column] + frac * ( b->v[column] - a->v[column] ) + ( frac >= 0 ? 0.5 : -0.5 ) );
+}
+
+/**
+ * Splits the CDC stream into [len][format\0][cmd][data] messages and keeps the 'q' telemetry.
+ */
+static void _read_telemetry( void )
+{
+    _rx_len += Host_CDC_Read( _rx + _rx_len, sizeof( _rx ) - _rx_len );
+    uint16_t pos = 0;
+    while( pos < _rx_len && pos + 1u + _rx[pos] <= _rx_len ) {
+        uint8_t len         = _rx[pos];
+        const uint8_t* body = _rx + pos + 1;
+        size_t fmt_len      = strnlen( (const char*)body, len );
+        if( fmt_len + 2 <= len && strcmp( (const char*)body, "cf4h" ) == 0 && body[fmt_len + 1] == 'q'
+            && len - fmt_len - 2 == sizeof( float ) + N_COLUMNS * sizeof( int16_t ) ) {
+            const uint8_t* data = body + fmt_len + 2;
+            Telemetry_t row;
+            float t;
+            memcpy( &t, data, sizeof( t ) );
+            memcpy( row.v, data + sizeof( t ), sizeof( row.v ) );
+            row.time      = t;
+            row.host_time = Host_Seconds();
+            if( _first_row_s < 0 )
+                _first_row_s = row.host_time;
+            row.since = row.host_time - _first_row_s;
+            _append( &_regenerated, &row );
+        } else {
+            _other_msgs++;
+        }
+        pos += 1 + len;
+    }
+    memmove( _rx, _rx + pos, _rx_len - pos );
+    _rx_len -= pos;
+}
+
+/**
+ * Runs after every firmware main loop pass: sends due commands, moves the encoders along the recorded trace,
+ * collects telemetry and decides when to stop.
+ */
+static void _replay_hook( void )
+{
+    _loops++;
+    double now = Host_Seconds();
+
+    if( _next_command < _n_commands && ( _start_s < 0 || now - _start_s >= _next_command * _delay_s ) ) {
+        if( _start_s < 0 )
+            _start_s = now;
+        Host_CDC_Write( _commands[_next_command].bytes, _commands[_next_command].len );
+        _next_command++;
+    }
+
+    if( _use_plant ) {
+        Zumo_Plant_Update_HAL( &_plant, &_plant_params );
+    } else if( _recorded.len ) {
+        double t = _first_row_s < 0 ? 0 : now - _first_row_s;
+        for( uint8_t side = 0; side < 2; side++ ) {
+            int32_t target = _recorded_count( 2 + side, t );
+            while( _encoder[side] != target ) {
+                int8_t dir = _encoder[side] < target ? 1 : -1;
+                Host_Encoder_Step( side == 0, dir );
+                _encoder[side] += dir;
+            }
+        }
+    }
+
+    _read_telemetry();
+
+    if( _next_command >= _n_commands
+        && ( ( _first_row_s >= 0 && now - _first_row_s > _end_time ) || now - _start_s > _give_up ) )
+        Host_Stop_Firmware();
+}
+
+/**
+ * Compares every regenerated row with the recorded row nearest in time since the first 'q' row, over the time both
+ * cover.
+ */
+static bool _compare( int tolerance )
+{
+    const Telemetry_t* rec = _recorded.rows;
+    size_t j               = 0;
+    size_t compared        = 0;
+    int max_diff[N_COLUMNS]  = { 0 };
+    double sum_sq[N_COLUMNS] = { 0 };
+    size_t over[N_COLUMNS]   = { 0 };
+
+    for( size_t i = 0; i < _regenerated.len; i++ ) {
+        const Telemetry_t* row = &_regenerated.rows[i];
+        if( row->since < rec[0].since || row->since > rec[_recorded.len - 1].since )
+            continue;
+        while( j + 1 < _recorded.len && rec[j + 1].since - row->since < row->since - rec[j].since )
+            j++;
+        compared++;
+        for( uint8_t c = 0; c < N_COLUMNS; c++ ) {
+            int diff = abs( row->v[c] - rec[j].v[c] );
+            if( diff > max_diff[c] )
+                max_diff[c] = diff;
+            sum_sq[c] += (double)diff * diff;
+            if( diff > tolerance )
+                over[c]++;
+        }
+    }
+
+    printf( "compared %zu rows against %zu recorded rows\n", compared, _recorded.len );
+    printf( "%-10s %10s %10s %10s\n", "column", "max|diff|", "rms", "rows>tol" );
+    bool pass = compared > 0;
+    for( uint8_t c = 0; c < N_COLUMNS; c++ ) {
+        printf( "%-10s %10d %10.2f %10zu\n", _column_names[c], max_diff[c],
+                compared ? sqrt( sum_sq[c] / compared ) : 0.0, over[c] );
+        if( over[c] )
+            pass = false;
+    }
+    return pass;
+}
+
+static void _usage( void )
+{
+    fprintf( stderr, "usage: replay -s script.csv [-r recording.csv] [-p] [-o out.csv] [-d delay_ms] [-b volts] "
+                     "[-l loop_cycles] [-t tol]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* script    = NULL;
+    const char* recording = NULL;
+    const char* out       = NULL;
+    float battery         = 6.0f;
+    long loop_cycles      = 160;
+    int tolerance         = -1;
+
+    int opt;
+    while( ( opt = getopt( argc, argv, "s:r:po:d:b:l:t:" ) ) != -1 ) {
+        switch( opt ) {
+            case 's': script = optarg; break;
+            case 'r': recording = optarg; break;
+            case 'p': _use_plant = true; break;
+            case 'o': out = optarg; break;
+            case 'd': _delay_s = atof( optarg ) / 1000; break;
+            case 'b': battery = atof( optarg ); break;
+            case 'l': loop_cycles = atol( optarg ); break;
+            case 't': tolerance = atoi( optarg ); break;
+            default: _usage();
+        }
+    }
+    if( !script || loop_cycles <= 0 || !_load_script( script ) )
+        _usage();
+    if( recording && !_load_recording( recording ) ) {
+        fprintf( stderr, "%s: no 'q' rows\n", recording );
+        return 2;
+    }
+
+    double last_command = ( _n_commands - 1 ) * _delay_s;
+    _end_time = _recorded.len ? _recorded.rows[_recorded.len - 1].since : last_command + 2.0;
+    _give_up  = last_command + _end_time + 2.0;
+
+    Host_HAL_Reset();
+    Host_Set_Loop_Cycles( (uint32_t)loop_cycles );
+    Host_Battery_Set( battery );
+    Zumo_Plant_Default_Params( &_plant_params );
+    _plant_params.battery_open = battery;
+    Zumo_Plant_Init( &_plant, &_plant_params );
+    Host_Set_USBTask_Hook( _replay_hook );
+
+    struct timespec wall_start, wall_end;
+    clock_gettime( CLOCK_MONOTONIC, &wall_start );
+    Host_Run_Firmware( Lab5_main );
+    clock_gettime( CLOCK_MONOTONIC, &wall_end );
+
+    double wall = ( wall_end.tv_sec - wall_start.tv_sec ) + 1e-9 * ( wall_end.tv_nsec - wall_start.tv_nsec );
+    double sim  = Host_Seconds();
+    printf( "replayed %zu commands, %zu telemetry rows (%u other or malformed messages)\n", _n_commands,
+            _regenerated.len, _other_msgs );
+    printf( "simulated %.3f s in %.3f s wall: %.0fx real time, %.0f rows/s, %.0f loop passes/s\n", sim, wall,
+            sim / wall, _regenerated.len / wall, _loops / wall );
+
+    if( out ) {
+        FILE* f = fopen( out, "w" );
+        if( !f ) {
+            perror( out );
+            return 2;
+        }
+        for( size_t i = 0; i < _regenerated.len; i++ ) {
+            const Telemetry_t* row = &_regenerated.rows[i];
+            fprintf( f, "%.9f, q, %.9g, %d, %d, %d, %d\n", row->host_time, row->time, row->v[0], row->v[1],
+                     row->v[2], row->v[3] );
+        }
+        fclose( f );
+    }
+
+    if( !_recorded.len )
+        return 0;
+    bool pass = _compare( tolerance < 0 ? 0 : tolerance );
+    return ( tolerance >= 0 && !pass ) ? 1 : 0;
+}
@@ -0,0 +1,438 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * sysid fits discrete motor models to 'q' sysData telemetry (time, PWM_L, PWM_R, Encoder_L, Encoder_R), the native
+ * replacement for Lab4_sysID.m. Per wheel the input u is the PWM count and the output y is the wheel speed in
+ * counts/s (or the encoder count with -y position), one sample per 'q' row.
+ *
+ *   sysid [-i csv|bin] [-m arx|fopdt] [-a na] [-b nb] [-k nk] [-D max_delay] [-y speed|position] <log|->
+ *
+ *   -i  csv: SerialMonitor recordings, "<host time>, q, <time>, <PWM_L>, <PWM_R>, <Encoder_L>, <Encoder_R>".
+ *       bin: the raw byte stream from the device ([len][format\0][cmd][data] messages), e.g. captured with
+ *       `cat /dev/ttyACM0 > run.bin`; messages other than 'q' with format "cf4h" are skipped. Default csv.
+ *   -m  arx: least squares A(q) y = B(q) u with na poles, nb zeros and nk samples of input delay (default 2, 2, 1).
+ *       fopdt: first order plus dead time, y[k] = a y[k-1] + b u[k-1-d], fit for every delay d up to max_delay
+ *       (default 10) and the best one kept; prints K, tau and the dead time as well.
+ *   -y  speed (default) or position.
+ *
+ * The log is streamed: only the normal equations of the fit and the last few samples are kept, so logs of any length
+ * run in constant memory. The sample period is taken as the mean spacing of the 'q' time column; the firmware's
+ * 'Q' interval is not exact, so check the reported jitter. A backwards step or a gap of more than ten mean periods in
+ * that column (a new 'Q' or a dropped stretch) restarts the regressor history.
+ *
+ * The models are printed as the numerator/denominator arrays Filter_Init takes (order = array length - 1), so
+ * Filter_Value( &filter, u ) predicts y.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ORDER  8
+#define MAX_DELAY  32
+#define MAX_PARAMS ( 2 * MAX_ORDER )
+#define HISTORY    ( MAX_ORDER + MAX_DELAY + 2 )  // samples of y and u kept per wheel
+
+/** Running normal equations of one least squares fit. */
+typedef struct {
+    uint8_t n;
+    double phiphi[MAX_PARAMS][MAX_PARAMS];
+    double phiy[MAX_PARAMS];
+    double yy;
+    double ysum;
+    unsigned long count;
+} LS_Fit_t;
+
+typedef struct {
+    double y[HISTORY];  // y[0] newest
+    double u[HISTORY];
+    unsigned valid;     // samples in the history since the last restart
+    bool have_last;
+    int32_t last_count;
+    LS_Fit_t arx;
+    LS_Fit_t fopdt[MAX_DELAY + 1];
+} Wheel_t;
+
+static const char* const _wheel_names[2] = { "left", "right" };
+
+static bool _fopdt       = false;
+static bool _position    = false;
+static unsigned _na      = 2;
+static unsigned _nb      = 2;
+static unsigned _nk      = 1;
+static unsigned _delay   = 10;
+static Wheel_t _wheel[2];
+
+// sample timing
+static double _last_time = NAN;
+static double _dt_sum    = 0;
+static double _dt_sq_sum = 0;
+static unsigned long _dt_count = 0;
+static unsigned long _restarts = 0;
+static unsigned long _rows     = 0;
+
+static void _accumulate( LS_Fit_t* p_fit, const double* phi, double y )
+{
+    for( uint8_t i = 0; i < p_fit->n; i++ ) {
+        for( uint8_t j = 0; j <= i; j++ )
+            p_fit->phiphi[i][j] += phi[i] * phi[j];
+        p_fit->phiy[i] += phi[i] * y;
+    }
+    p_fit->yy += y * y;
+    p_fit->ysum += y;
+    p_fit->count++;
+}
+
+/**
+ * Solves the normal equations by Cholesky decomposition, with a small ridge if they are singular (an input that never
+ * changed, for instance). Returns the residual sum of squares through p_rss.
+ */
+static bool _solve( const LS_Fit_t* p_fit, double* theta, double* p_rss )
+{
+    uint8_t n = p_fit->n;
+    if( p_fit->count <= n )
+        return false;
+
+    double trace = 0;
+    for( uint8_t i = 0; i < n; i++ )
+        trace += p_fit->phiphi[i][i];
+
+    for( double ridge = 0; ridge < 1e-3 * trace + 1; ridge = ridge ? ridge * 100 : 1e-12 * trace ) {
+        double L[MAX_PARAMS][MAX_PARAMS] = { { 0 } };
+        bool ok                          = true;
+        for( uint8_t i = 0; i < n && ok; i++ ) {
+            for( uint8_t j = 0; j <= i; j++ ) {
+                double sum = p_fit->phiphi[i][j] + ( i == j ? ridge : 0 );
+                for( uint8_t k = 0; k < j; k++ )
+                    sum -= L[i][k] * L[j][k];
+                if( i == j ) {
+                    if( sum <= 0 ) {
+                        ok = false;
+                        break;
+                    }
+                    L[i][i] = sqrt( sum );
+                } else {
+                    L[i][j] = sum / L[j][j];
+                }
+            }
+        }
+        if( !ok )
+            continue;
+
+        double z[MAX_PARAMS];
+        for( uint8_t i = 0; i < n; i++ ) {
+            double sum = p_fit->phiy[i];
+            for( uint8_t k = 0; k < i; k++ )
+                sum -= L[i][k] * z[k];
+            z[i] = sum / L[i][i];
+        }
+        for( int i = n - 1; i >= 0; i-- ) {
+            double sum = z[i];
+            for( uint8_t k = i + 1; k < n; k++ )
+                sum -= L[k][i] * theta[k];
+            theta[i] = sum / L[i][i];
+        }
+
+        // rss = yy - 2 theta'phiy + theta' phiphi theta, from the sums alone
+        double rss = p_fit->yy;
+        for( uint8_t i = 0; i < n; i++ ) {
+            rss -= 2 * theta[i] * p_fit->phiy[i];
+            for( uint8_t j = 0; j < n; j++ )
+                rss += theta[i] * theta[j] * ( i >= j ? p_fit->phiphi[i][j] : p_fit->phiphi[j][i] );
+        }
+        *p_rss = rss > 0 ? rss : 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * One step ahead fit in percent, 100 * (1 - |e| / |y - mean(y)|).
+ */
+static double _fit_percent( const LS_Fit_t* p_fit, double rss )
+{
+    double var = p_fit->yy - p_fit->ysum * p_fit->ysum / p_fit->count;
+    return var > 0 ? 100 * ( 1 - sqrt( rss / var ) ) : 0;
+}
+
+static void _restart( void )
+{
+    for( uint8_t w = 0; w < 2; w++ ) {
+        _wheel[w].valid     = 0;
+        _wheel[w].have_last = false;
+    }
+    _restarts++;
+}
+
+static void _add_sample( Wheel_t* p_wheel, double u, int32_t count, double dt )
+{
+    double y;
+    if( _position ) {
+        y = count;
+    } else {
+        bool have_last       = p_wheel->have_last;
+        int32_t last         = p_wheel->last_count;
+        p_wheel->have_last   = true;
+        p_wheel->last_count  = count;
+        if( !have_last )
+            return;
+        y = (int16_t)( count - last ) / dt;  // the counts are int16_t on the wire and wrap
+    }
+
+    memmove( p_wheel->y + 1, p_wheel->y, ( HISTORY - 1 ) * sizeof( double ) );
+    memmove( p_wheel->u + 1, p_wheel->u, ( HISTORY - 1 ) * sizeof( double ) );
+    p_wheel->y[0] = y;
+    p_wheel->u[0] = u;
+    if( p_wheel->valid < HISTORY )
+        p_wheel->valid++;
+
+    double phi[MAX_PARAMS];
+    if( _fopdt ) {
+        for( unsigned d = 0; d <= _delay; d++ ) {
+            if( p_wheel->valid < d + 2 )
+                break;
+            phi[0] = p_wheel->y[1];
+            phi[1] = p_wheel->u[1 + d];
+            _accumulate( &p_wheel->fopdt[d], phi, y );
+        }
+    } else if( p_wheel->valid > ( _na > _nk + _nb - 1 ? _na : _nk + _nb - 1 ) ) {
+        for( unsigned i = 0; i < _na; i++ )
+            phi[i] = -p_wheel->y[1 + i];
+        for( unsigned i = 0; i < _nb; i++ )
+            phi[_na + i] = p_wheel->u[_nk + i];
+        _accumulate( &p_wheel->arx, phi, y );
+    }
+}
+
+static void _add_row( double time, const int16_t v[4] )
+{
+    _rows++;
+    double dt = time - _last_time;
+    double mean = _dt_count ? _dt_sum / _dt_count : dt;
+    if( isnan( _last_time ) || dt <= 0 || ( _dt_count > 10 && dt > 10 * mean ) ) {
+        if( !isnan( _last_time ) )
+            _restart();
+        _last_time = time;
+        for( uint8_t w = 0; w < 2; w++ )
+            _add_sample( &_wheel[w], v[w], v[2 + w], 0 );
+        return;
+    }
+    _last_time = time;
+    _dt_sum += dt;
+    _dt_sq_sum += dt * dt;
+    _dt_count++;
+    for( uint8_t w = 0; w < 2; w++ )
+        _add_sample( &_wheel[w], v[w], v[2 + w], dt );
+}
+
+static void _read_csv( FILE* f )
+{
+    char line[256];
+    while( fgets( line, sizeof( line ), f ) ) {
+        double host_time, time;
+        char cmd;
+        int v[4];
+        if( sscanf( line, "%lf , %c , %lf , %d , %d , %d , %d", &host_time, &cmd, &time, &v[0], &v[1], &v[2],
+                    &v[3] ) != 7 || cmd != 'q' )
+            continue;
+        int16_t row[4] = { (int16_t)v[0], (int16_t)v[1], (int16_t)v[2], (int16_t)v[3] };
+        _add_row( time, row );
+    }
+}
+
+static void _read_binary( FILE* f )
+{
+    uint8_t buf[4096];
+    size_t len = 0;
+    size_t got;
+    while( ( got = fread( buf + len, 1, sizeof( buf ) - len, f ) ) > 0 ) {
+        len += got;
+        size_t pos = 0;
+        while( pos < len && pos + 1 + buf[pos] <= len ) {
+            uint8_t msg_len     = buf[pos];
+            const uint8_t* body = buf + pos + 1;
+            size_t fmt_len      = strnlen( (const char*)body, msg_len );
+            if( fmt_len == 4 && memcmp( body, "cf4h", 4 ) == 0 && msg_len == 4 + 1 + 1 + 4 + 8 && body[5] == 'q' ) {
+                float time;
+                int16_t v[4];
+                memcpy( &time, body + 6, sizeof( time ) );
+                memcpy( v, body + 10, sizeof( v ) );  // little endian, as the AVR
+                _add_row( time, v );
+            }
+            pos += 1 + msg_len;
+        }
+        memmove( buf, buf + pos, len - pos );
+        len -= pos;
+    }
+}
+
+static void _print_array( const char* name, const double* values, unsigned n )
+{
+    printf( "float %s[] = {", name );
+    for( unsigned i = 0; i < n; i++ )
+        printf( "%s%.12g", i ? ", " : "", values[i] );
+    printf( "};\n" );
+}
+
+static void _report( uint8_t w, double period )
+{
+    Wheel_t* p_wheel = &_wheel[w];
+    double theta[MAX_PARAMS], rss;
+    double num[MAX_ORDER + MAX_DELAY + 1] = { 0 };
+    double den[MAX_ORDER + MAX_DELAY + 1] = { 0 };
+    unsigned order;
+    char name[32];
+
+    if( _fopdt ) {
+        int best         = -1;
+        double best_rss  = INFINITY;
+        double best_theta[2];
+        for( unsigned d = 0; d <= _delay; d++ ) {
+            if( _solve( &p_wheel->fopdt[d], theta, &rss ) && rss < best_rss ) {
+                best     = d;
+                best_rss = rss;
+                memcpy( best_theta, theta, sizeof( best_theta ) );
+            }
+        }
+        if( best < 0 ) {
+            printf( "// %s: not enough data\n", _wheel_names[w] );
+            return;
+        }
+        double a = best_theta[0], b = best_theta[1];
+        order    = best + 1;
+        den[0]   = 1;
+        den[1]   = -a;
+        num[order] = b;
+        printf( "// %s wheel: FOPDT y[k] = a y[k-1] + b u[k-1-%d], %lu samples, one step fit %.1f%%\n",
+                _wheel_names[w], best, p_wheel->fopdt[best].count, _fit_percent( &p_wheel->fopdt[best], best_rss ) );
+        if( a > 0 && a < 1 )
+            printf( "//   K = %.6g %s per PWM count, tau = %.6g s, dead time = %.6g s\n", b / ( 1 - a ),
+                    _position ? "counts" : "counts/s", -period / log( a ), best * period );
+        else
+            printf( "//   a = %.6g is not a stable first order pole, the data does not fit this model\n", a );
+    } else {
+        if( !_solve( &p_wheel->arx, theta, &rss ) ) {
+            printf( "// %s: not enough data\n", _wheel_names[w] );
+            return;
+        }
+        order  = _na > _nk + _nb - 1 ? _na : _nk + _nb - 1;
+        den[0] = 1;
+        for( unsigned i = 0; i < _na; i++ )
+            den[1 + i] = theta[i];
+        for( unsigned i = 0; i < _nb; i++ )
+            num[_nk + i] = theta[_na + i];
+        printf( "// %s wheel: ARX na=%u nb=%u nk=%u, %lu samples, one step fit %.1f%%\n", _wheel_names[w], _na, _nb,
+                _nk, p_wheel->arx.count, _fit_percent( &p_wheel->arx, rss ) );
+    }
+
+    printf( "//   u = PWM counts, y = %s, T = %.6g s\n", _position ? "encoder counts" : "speed [counts/s]", period );
+    snprintf( name, sizeof( name ), "%sNumerator", _wheel_names[w] );
+    _print_array( name, num, order + 1 );
+    snprintf( name, sizeof( name ), "%sDenominator", _wheel_names[w] );
+    _print_array( name, den, order + 1 );
+    printf( "// Filter_Init( &filter, %sNumerator, %sDenominator, %u );\n\n", _wheel_names[w], _wheel_names[w],
+            order );
+}
+
+static void _usage( void )
+{
+    fprintf( stderr, "usage: sysid [-i csv|bin] [-m arx|fopdt] [-a na] [-b nb] [-k nk] [-D max_delay] "
+                     "[-y speed|position] <log|->\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    bool binary = false;
+    int opt;
+    while( ( opt = getopt( argc, argv, "i:m:a:b:k:D:y:" ) ) != -1 ) {
+        switch( opt ) {
+            case 'i':
+                if( strcmp( optarg, "bin" ) && strcmp( optarg, "csv" ) )
+                    _usage();
+                binary = strcmp( optarg, "bin" ) == 0;
+                break;
+            case 'm':
+                if( strcmp( optarg, "fopdt" ) && strcmp( optarg, "arx" ) )
+                    _usage();
+                _fopdt = strcmp( optarg, "fopdt" ) == 0;
+                break;
+            case 'y':
+                if( strcmp( optarg, "position" ) && strcmp( optarg, "speed" ) )
+                    _usage();
+                _position = strcmp( optarg, "position" ) == 0;
+                break;
+            case 'a': _na = (unsigned)atoi( optarg ); break;
+            case 'b': _nb = (unsigned)atoi( optarg ); break;
+            case 'k': _nk = (unsigned)atoi( optarg ); break;
+            case 'D': _delay = (unsigned)atoi( optarg ); break;
+            default: _usage();
+        }
+    }
+    if( optind != argc - 1 || _na < 1 || _na > MAX_ORDER || _nb < 1 || _nb > MAX_ORDER || _nk > MAX_DELAY
+        || _delay > MAX_DELAY )
+        _usage();
+
+    for( uint8_t w = 0; w < 2; w++ ) {
+        _wheel[w].arx.n = _na + _nb;
+        for( unsigned d = 0; d <= MAX_DELAY; d++ )
+            _wheel[w].fopdt[d].n = 2;
+    }
+
+    const char* path = argv[optind];
+    FILE* f          = strcmp( path, "-" ) ? fopen( path, binary ? "rb" : "r" ) : stdin;
+    if( !f ) {
+        perror( path );
+        return 2;
+    }
+    if( binary )
+        _read_binary( f );
+    else
+        _read_csv( f );
+    if( f != stdin )
+        fclose( f );
+
+    if( _dt_count == 0 ) {
+        fprintf( stderr, "%s: no 'q' rows\n", path );
+        return 1;
+    }
+    double period = _dt_sum / _dt_count;
+    double jitter = sqrt( fmax( _dt_sq_sum / _dt_count - period * period, 0 ) );
+    printf( "// %s: %lu rows, T = %.6g s (jitter %.3g s rms), %lu restarts\n\n", path, _rows, period, jitter,
+            _restarts );
+    for( uint8_t w = 0; w < 2; w++ )
+        _report( w, period );
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * host_test.h is the small check framework the Host/tests programs share. Each test program is one file of static
+ * test functions run from main with HOST_TEST, and exits non-zero if any CHECK failed, so make test can stop on it.
+ *
+ *   static void Test_Something() { CHECK( 1 + 1 == 2 ); CHECK_NEAR( 0.1f * 3, 0.3f, 1e-6 ); }
+ *   int main() { HOST_TEST( Test_Something ); return HOST_TEST_RESULT(); }
+ */
+
+#ifndef _MEGN540_HOST_TEST_H
+#define _MEGN540_HOST_TEST_H
+
+#include <math.h>
+#include <stdio.h>
+
+static int _host_test_checks   = 0;
+static int _host_test_failures = 0;
+
+#define CHECK( cond )                                                                                                 \
+    do {                                                                                                              \
+        _host_test_checks++;                                                                                          \
+        if( !( cond ) ) {                                                                                             \
+            _host_test_failures++;                                                                                    \
+            printf( "  %s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #cond );                                     \
+        }                                                                                                             \
+    } while( 0 )
+
+#define CHECK_NEAR( actual, expected, tol )                                                                           \
+    do {                                                                                                              \
+        double _a = ( actual ), _e = ( expected );                                                                    \
+        _host_test_checks++;                                                                                          \
+        if( !( fabs( _a - _e ) <= ( tol ) ) ) {                                                                       \
+            _host_test_failures++;                                                                                    \
+            printf( "  %s:%d: %s is %g, expected %g\n", __FILE__, __LINE__, #actual, _a, _e );                        \
+        }                                                                                                             \
+    } while( 0 )
+
+#define HOST_TEST( fn )                                                                                               \
+    do {                                                                                                              \
+        int _before = _host_test_failures;                                                                            \
+        fn();                                                                                                         \
+        printf( "%s %s\n", _host_test_failures == _before ? "pass" : "FAIL", #fn );                                   \
+    } while( 0 )
+
+#define HOST_TEST_RESULT()                                                                                            \
+    ( printf( "%d checks, %d failed\n", _host_test_checks, _host_test_failures ), _host_test_failures ? 1 : 0 )
+
+#endif
@@ -0,0 +1,135 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_controller checks PI_Loop_Update against outputs worked by hand, both anti-windup strategies, and that
+ * Cascade_Update chains the position loop into the velocity loop.
+ */
+
+#include <string.h>
+
+#include "Controller.h"
+#include "host_test.h"
+
+static void Test_PI_Step()
+{
+    // kp 2, ki 10 /s at 0.1 s (1 per update), kff 0.5
+    PI_Loop_t loop;
+    PI_Loop_Init( &loop, 2, 10, 0.5f, 100, 0.1f );
+    CHECK_NEAR( PI_Loop_Update( &loop, 1, 2 ), 3, 1e-6 );  // 2 + 0 + 1
+    CHECK_NEAR( loop.integral, 1, 1e-6 );
+    CHECK_NEAR( PI_Loop_Update( &loop, 1, 2 ), 4, 1e-6 );  // 2 + 1 + 1
+    CHECK_NEAR( PI_Loop_Update( &loop, -1, 0 ), 0, 1e-6 ); // -2 + 2 + 0
+    CHECK_NEAR( loop.integral, 1, 1e-6 );
+    CHECK_NEAR( loop.output, 0, 1e-6 );
+}
+
+static void Test_Clamp()
+{
+    PI_Loop_t loop;
+    PI_Loop_Init( &loop, 1, 10, 1, 5, 0.1f );
+
+    // saturated with the error pushing further in: the integral holds
+    CHECK_NEAR( PI_Loop_Update( &loop, 10, 0 ), 5, 1e-6 );
+    CHECK_NEAR( loop.integral, 0, 1e-6 );
+
+    // still saturated by the feedforward, but the error pulls back out: it integrates
+    PI_Loop_Reset( &loop, 4 );
+    CHECK_NEAR( PI_Loop_Update( &loop, -1, 10 ), 5, 1e-6 );
+    CHECK_NEAR( loop.integral, 3, 1e-6 );
+
+    // the integral alone is held to the output limit
+    PI_Loop_Reset( &loop, 20 );
+    CHECK_NEAR( loop.integral, 5, 1e-6 );
+    CHECK_NEAR( loop.output, 5, 1e-6 );
+}
+
+static void Test_Back_Calculation()
+{
+    // kaw 5 /s is scaled by the loop's own 0.1 s update period
+    PI_Loop_t loop;
+    PI_Loop_Init( &loop, 1, 1, 0, 5, 0.1f );
+    PI_Loop_Set_Anti_Windup( &loop, ANTI_WINDUP_BACK_CALC, 5 );
+    CHECK_NEAR( PI_Loop_Update( &loop, 10, 0 ), 5, 1e-6 );
+    CHECK_NEAR( loop.integral, -1.5, 1e-6 );  // 0.1 * 10 + 0.5 * (5 - 10)
+
+    // unsaturated it integrates as usual
+    CHECK_NEAR( PI_Loop_Update( &loop, 1, 0 ), -0.5, 1e-6 );
+    CHECK_NEAR( loop.integral, -1.4, 1e-6 );
+}
+
+static void Test_Cascade()
+{
+    Cascade_Controller_t cascade;
+    PI_Loop_Init( &cascade.position, 2, 0, 1, 10, 0.01f );
+    PI_Loop_Init( &cascade.velocity, 0.5f, 0, 0.1f, 3, 0.01f );
+
+    // the position loop asks for 2 * 1 + 1 = 3, the velocity loop gives 0.5 * (3 - 1) + 0.1 * 1
+    CHECK_NEAR( Cascade_Update( &cascade, 5, 1, 4, 1 ), 1.1, 1e-6 );
+    CHECK_NEAR( cascade.position.output, 3, 1e-6 );
+
+    // the position loop output is the velocity limit, the velocity loop output the actuator limit
+    CHECK_NEAR( Cascade_Update( &cascade, 100, 0, 0, 0 ), 3, 1e-6 );
+    CHECK_NEAR( cascade.position.output, 10, 1e-6 );
+
+    // velocity mode skips the position loop
+    CHECK_NEAR( Cascade_Update_Velocity( &cascade, 4, 2 ), 1.4, 1e-6 );
+}
+
+static void Test_Cascade_Init()
+{
+    // before the gains are set, Cascade_Init only writes the state
+    Cascade_Controller_t cascade;
+    memset( &cascade, 0xff, sizeof( cascade ) );
+    Cascade_Init( &cascade );
+    CHECK( cascade.position.integral == 0 && cascade.velocity.integral == 0 );
+    CHECK( cascade.position.output == 0 && cascade.velocity.output == 0 );
+
+    // after, it restarts from rest and keeps the gains
+    PI_Loop_Init( &cascade.position, 2, 10, 1, 10, 0.01f );
+    PI_Loop_Init( &cascade.velocity, 0.5f, 10, 0, 3, 0.01f );
+    Cascade_Update( &cascade, 1, 0, 0, 0 );
+    CHECK( cascade.position.integral != 0 && cascade.velocity.integral != 0 );
+    Cascade_Init( &cascade );
+    CHECK( cascade.position.integral == 0 && cascade.velocity.integral == 0 );
+    CHECK( cascade.position.output == 0 && cascade.velocity.output == 0 );
+    CHECK_NEAR( cascade.position.kp, 2, 1e-6 );
+    CHECK_NEAR( cascade.velocity.ki_dt, 0.1, 1e-6 );
+}
+
+int main()
+{
+    HOST_TEST( Test_PI_Step );
+    HOST_TEST( Test_Clamp );
+    HOST_TEST( Test_Back_Calculation );
+    HOST_TEST( Test_Cascade );
+    HOST_TEST( Test_Cascade_Init );
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,129 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_filter checks Filter_Value against outputs worked by hand for known coefficients, and Filter_SetTo,
+ * Filter_ShiftBy and Filter_Last_Output.
+ */
+
+#include "Filter.h"
+#include "host_test.h"
+
+static void Test_Moving_Average()
+{
+    // the 5-point moving average of Filter.h
+    float numerator[]   = { 1, 1, 1, 1, 1 };
+    float denominator[] = { 5, 0, 0, 0, 0 };
+    float expected[]    = { 1, 2, 3, 4, 5, 5, 5 };
+
+    Filter_Data_t filter;
+    Filter_Init( &filter, numerator, denominator, 4 );
+    for( int i = 0; i < 7; i++ )
+        CHECK_NEAR( Filter_Value( &filter, 5 ), expected[i], 1e-6 );
+
+    // a step back to zero leaves the average one sample at a time
+    for( int i = 4; i >= 0; i-- )
+        CHECK_NEAR( Filter_Value( &filter, 0 ), i, 1e-6 );
+}
+
+static void Test_First_Order_Low_Pass()
+{
+    // y[k] = 0.5 y[k-1] + 0.5 x[k]
+    float numerator[]   = { 0.5f, 0 };
+    float denominator[] = { 1, -0.5f };
+
+    Filter_Data_t filter;
+    Filter_Init( &filter, numerator, denominator, 1 );
+    CHECK_NEAR( Filter_Value( &filter, 1 ), 0.5, 1e-6 );
+    CHECK_NEAR( Filter_Value( &filter, 1 ), 0.75, 1e-6 );
+    CHECK_NEAR( Filter_Value( &filter, 1 ), 0.875, 1e-6 );
+    CHECK_NEAR( Filter_Value( &filter, 0 ), 0.4375, 1e-6 );
+    CHECK_NEAR( Filter_Last_Output( &filter ), 0.4375, 1e-6 );
+}
+
+static void Test_Second_Order()
+{
+    // 2 y[k] = x[k] + 2 x[k-1] + x[k-2] - y[k-1] - 0.5 y[k-2], driven by an impulse
+    float numerator[]   = { 1, 2, 1 };
+    float denominator[] = { 2, 1, 0.5f };
+
+    Filter_Data_t filter;
+    Filter_Init( &filter, numerator, denominator, 2 );
+    CHECK_NEAR( Filter_Value( &filter, 1 ), 0.5, 1e-6 );      // 1 / 2
+    CHECK_NEAR( Filter_Value( &filter, 0 ), 0.75, 1e-6 );     // (2 - 0.5) / 2
+    CHECK_NEAR( Filter_Value( &filter, 0 ), 0, 1e-6 );        // (1 - 0.75 - 0.5 * 0.5) / 2
+    CHECK_NEAR( Filter_Value( &filter, 0 ), -0.1875, 1e-6 );  // (0 - 0.5 * 0.75) / 2
+}
+
+static void Test_Set_And_Shift()
+{
+    float numerator[]   = { 0.5f, 0 };
+    float denominator[] = { 1, -0.5f };
+
+    Filter_Data_t filter;
+    Filter_Init( &filter, numerator, denominator, 1 );
+
+    // settled at 3, a constant input keeps it there
+    Filter_SetTo( &filter, 3 );
+    CHECK_NEAR( Filter_Last_Output( &filter ), 3, 1e-6 );
+    CHECK_NEAR( Filter_Value( &filter, 3 ), 3, 1e-6 );
+
+    // shifting moves the whole history, so the filter stays settled in the new frame
+    Filter_ShiftBy( &filter, -2 );
+    CHECK_NEAR( Filter_Last_Output( &filter ), 1, 1e-6 );
+    CHECK_NEAR( Filter_Value( &filter, 1 ), 1, 1e-6 );
+}
+
+static void Test_Independent_Filters()
+{
+    float average_num[] = { 1, 1 };
+    float average_den[] = { 2, 0 };
+    float pass_num[]    = { 1 };
+    float pass_den[]    = { 1 };
+
+    Filter_Data_t average, pass;
+    Filter_Init( &average, average_num, average_den, 1 );
+    Filter_Init( &pass, pass_num, pass_den, 0 );
+
+    CHECK_NEAR( Filter_Value( &average, 4 ), 2, 1e-6 );
+    CHECK_NEAR( Filter_Value( &pass, 7 ), 7, 1e-6 );
+    CHECK_NEAR( Filter_Value( &average, 4 ), 4, 1e-6 );
+    CHECK_NEAR( Filter_Value( &pass, -1 ), -1, 1e-6 );
+}
+
+int main()
+{
+    HOST_TEST( Test_Moving_Average );
+    HOST_TEST( Test_First_Order_Low_Pass );
+    HOST_TEST( Test_Second_Order );
+    HOST_TEST( Test_Set_And_Shift );
+    HOST_TEST( Test_Independent_Filters );
+    return HOST_TEST_RESULT();
+}
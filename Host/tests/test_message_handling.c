@@ -0,0 +1,310 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_message_handling checks Message_Handling_Task (MEGN540_MessageHandeling.h) on commands from the emulated CDC
+ * endpoint: sequenced requests get their replies wrapped with the sequence, including replies sent later by the
+ * flags they set, an '&' batch's replies come back as one frame once its flags have fired, or after
+ * BATCH_HOLD_MAX, and setpoint commands queued back to back are coalesced to the newest.
+ */
+
+#include <string.h>
+
+#include "Host_HAL.h"
+#include "MEGN540_MessageHandeling.h"
+#include "MotorPWM.h"
+#include "SerialIO.h"
+#include "Timing.h"
+#include "host_test.h"
+
+static void Start()
+{
+    Host_HAL_Reset();
+    SetupTimer0();
+    USB_SetupHardware();
+    sei();
+    Message_Handling_Init();
+    usb_send_set_sequence( -1 );
+}
+
+/**
+ * Runs passes of a main loop that only does the USB upkeep and message handling. Each upkeep moves one received byte
+ * into the receive buffer and charges 10 us.
+ */
+static void Run_Loop( int passes )
+{
+    for( int i = 0; i < passes; i++ ) {
+        USB_Upkeep_Task();
+        Message_Handling_Task();
+    }
+}
+
+/**
+ * Runs the USB upkeep until everything queued has reached the endpoint and returns the bytes the host received.
+ */
+static uint16_t Read_Sent( uint8_t* p_buf, uint16_t max )
+{
+    for( int i = 0; i < 64; i++ )
+        USB_Upkeep_Task();
+    return Host_CDC_Read( p_buf, max );
+}
+
+/**
+ * Writes an arithmetic command ('+', '-', '*' or '/') on two floats into p_buf and returns its length.
+ */
+static uint8_t Arithmetic( uint8_t* p_buf, char command, float a, float b )
+{
+    p_buf[0] = command;
+    memcpy( &p_buf[1], &a, sizeof( a ) );
+    memcpy( &p_buf[5], &b, sizeof( b ) );
+    return 9;
+}
+
+static void Test_Sequenced_Request()
+{
+    Start();
+    uint8_t request[11] = { '#', 7 };
+    Arithmetic( &request[2], '+', 1.0f, 2.5f );
+
+    // nothing happens until the whole request is in
+    Host_CDC_Write( request, 6 );
+    Run_Loop( 16 );
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 0 );
+    CHECK( usb_msg_length() == 6 );
+
+    // then the reply comes back wrapped with the sequence: [12]["cBcf"]['#'][7]['+'][3.5]
+    Host_CDC_Write( &request[6], sizeof( request ) - 6 );
+    Run_Loop( 16 );
+    float sum = 3.5f;
+    uint8_t expected[13] = { 12, 'c', 'B', 'c', 'f', 0, '#', 7, '+' };
+    memcpy( &expected[9], &sum, sizeof( sum ) );
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( expected ) );
+    CHECK( memcmp( buf, expected, sizeof( expected ) ) == 0 );
+    CHECK( usb_msg_length() == 0 );
+
+    // a plain request after it is answered plainly
+    uint8_t plain[9];
+    Host_CDC_Write( plain, Arithmetic( plain, '-', 1.0f, 2.5f ) );
+    Run_Loop( 16 );
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 );
+    CHECK( buf[0] == 8 && buf[4] == '-' );
+}
+
+static void Test_Sequenced_Flag_Reply()
+{
+    Start();
+
+    // 't' 0 only sets mf_send_time, the flag remembers the sequence for the main loop's reply
+    uint8_t request[4] = { '#', 200, 't', 0 };
+    Host_CDC_Write( request, sizeof( request ) );
+    Run_Loop( 8 );
+    CHECK( mf_send_time.active && mf_send_time.seq == 200 );
+
+    CHECK( MSG_FLAG_Execute( &mf_send_time ) );
+    float now = 0.25f;
+    usb_send_msg_seq( mf_send_time.seq, "cf", '0', &now, sizeof( now ) );
+
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 13 );
+    CHECK( buf[6] == '#' && buf[7] == 200 && buf[8] == '0' );
+
+    // set again without a sequence, the flag forgets it
+    uint8_t plain[2] = { 't', 0 };
+    Host_CDC_Write( plain, sizeof( plain ) );
+    Run_Loop( 8 );
+    CHECK( mf_send_time.seq == -1 );
+}
+
+/**
+ * Writes an '&' batch of a '+' on 1 and 2 followed by one more command into p_buf and returns its length.
+ */
+static uint8_t Batch( uint8_t* p_buf, const uint8_t* p_cmd, uint8_t cmd_len )
+{
+    p_buf[0] = '&';
+    p_buf[1] = 9 + cmd_len;
+    Arithmetic( &p_buf[2], '+', 1.0f, 2.0f );
+    memcpy( &p_buf[11], p_cmd, cmd_len );
+    return 11 + cmd_len;
+}
+
+static void Test_Batch_One_Frame()
+{
+    Start();
+    uint8_t minus[9];
+    Arithmetic( minus, '-', 1.0f, 2.0f );
+    uint8_t batch[32];
+    Host_CDC_Write( batch, Batch( batch, minus, sizeof( minus ) ) );
+    Run_Loop( 32 );
+
+    // [24]["c18s"]['&'] then the '+' and '-' replies
+    uint8_t buf[64];
+    uint8_t header[7] = { 24, 'c', '1', '8', 's', 0, '&' };
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 25 );
+    CHECK( memcmp( buf, header, sizeof( header ) ) == 0 );
+    CHECK( buf[7] == 8 && buf[11] == '+' );
+    CHECK( buf[16] == 8 && buf[20] == '-' );
+}
+
+static void Test_Batch_Waits_For_Flags()
+{
+    Start();
+    uint8_t battery = 'b';  // only sets mf_battery_voltage, the reply is the main loop's
+    uint8_t batch[32];
+    Host_CDC_Write( batch, Batch( batch, &battery, 1 ) );
+    Run_Loop( 24 );
+
+    // a command after the batch waits with it
+    uint8_t minus[9];
+    Host_CDC_Write( minus, Arithmetic( minus, '-', 1.0f, 2.0f ) );
+    Run_Loop( 16 );
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 0 );
+    CHECK( mf_battery_voltage.batch != 0 );
+
+    // the flag's block runs, then the next pass sends the batch with both replies, then answers the '-'
+    CHECK( MSG_FLAG_Execute( &mf_battery_voltage ) );
+    float volts = 5.0f;
+    usb_send_msg_seq( mf_battery_voltage.seq, "cf", 'V', &volts, sizeof( volts ) );
+    mf_battery_voltage.active = false;
+    Run_Loop( 2 );
+
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 25 + 9 );
+    CHECK( buf[0] == 24 && buf[6] == '&' );
+    CHECK( buf[11] == '+' && buf[20] == 'V' );
+    CHECK( buf[25] == 8 && buf[29] == '-' );
+}
+
+static void Test_Batch_Hold_Max()
+{
+    Start();
+    uint8_t battery = 'b';
+    uint8_t batch[32];
+    Host_CDC_Write( batch, Batch( batch, &battery, 1 ) );
+    Run_Loop( 24 );
+
+    // the flag never fires: still held well inside BATCH_HOLD_MAX (10 ms at 10 us a pass)
+    Run_Loop( 500 );
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 0 );
+
+    // after it, the replies so far go out, a lone '+' unwrapped
+    Run_Loop( 600 );
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 );
+    CHECK( buf[0] == 8 && buf[4] == '+' );
+
+    // the flag firing late no longer counts against any batch
+    CHECK( MSG_FLAG_Execute( &mf_battery_voltage ) );
+    CHECK( mf_battery_voltage.batch == 0 );
+}
+
+/**
+ * Writes a 'p' PWM setpoint into p_buf and returns its length.
+ */
+static uint8_t PWM_Setpoint( uint8_t* p_buf, int16_t left, int16_t right )
+{
+    p_buf[0] = 'p';
+    memcpy( &p_buf[1], &left, sizeof( left ) );
+    memcpy( &p_buf[3], &right, sizeof( right ) );
+    return 5;
+}
+
+static void Test_Setpoint_Mailbox()
+{
+    Start();
+    uint8_t cmds[64];
+    uint8_t len = 0;
+    len += PWM_Setpoint( &cmds[len], 10, 10 );
+    len += PWM_Setpoint( &cmds[len], 20, 20 );
+    len += PWM_Setpoint( &cmds[len], 30, -30 );
+    cmds[len++] = 'v';                          // a different class ends the run
+    float velocity[2] = { 0.1f, 0.0f };
+    memcpy( &cmds[len], velocity, sizeof( velocity ) );
+    len += sizeof( velocity );
+    len += PWM_Setpoint( &cmds[len], 40, 40 );
+    Host_CDC_Write( cmds, len );
+    for( int i = 0; i < len; i++ )
+        USB_Upkeep_Task();
+
+    // one pass applies only the newest of the three queued 'p'
+    Message_Handling_Task();
+    CHECK( mf_set_PWM.active );
+    CHECK( PWM_data.left_PWM == 30 && PWM_data.right_PWM == -30 );
+
+    // the 'v' and the 'p' after it each run on their own
+    Message_Handling_Task();
+    CHECK( mf_velocity.active );
+    CHECK_NEAR( velocity_data.linear, 0.1, 1e-6 );
+    Message_Handling_Task();
+    CHECK( PWM_data.left_PWM == 40 );
+    CHECK( usb_msg_length() == 0 );
+
+    // 'k' counts what was dropped, PWM then velocity
+    uint8_t count = 'k';
+    Host_CDC_Write( &count, 1 );
+    Run_Loop( 4 );
+    uint8_t buf[64];
+    uint16_t dropped[2];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 10 );
+    CHECK( buf[0] == 9 && buf[5] == 'k' );
+    memcpy( dropped, &buf[6], sizeof( dropped ) );
+    CHECK( dropped[0] == 2 && dropped[1] == 0 );
+}
+
+static void Test_Setpoint_Not_Yet_Arrived()
+{
+    Start();
+
+    // a newer setpoint still arriving is not waited for, the one that is whole runs
+    uint8_t cmds[10];
+    PWM_Setpoint( &cmds[0], 10, 10 );
+    PWM_Setpoint( &cmds[5], 20, 20 );
+    Host_CDC_Write( cmds, 8 );
+    for( int i = 0; i < 8; i++ )
+        USB_Upkeep_Task();
+    Message_Handling_Task();
+    CHECK( PWM_data.left_PWM == 10 );
+
+    Host_CDC_Write( &cmds[8], 2 );
+    Run_Loop( 4 );
+    CHECK( PWM_data.left_PWM == 20 );
+}
+
+int main()
+{
+    HOST_TEST( Test_Sequenced_Request );
+    HOST_TEST( Test_Sequenced_Flag_Reply );
+    HOST_TEST( Test_Batch_One_Frame );
+    HOST_TEST( Test_Batch_Waits_For_Flags );
+    HOST_TEST( Test_Batch_Hold_Max );
+    HOST_TEST( Test_Setpoint_Mailbox );
+    HOST_TEST( Test_Setpoint_Not_Yet_Arrived );
+    return HOST_TEST_RESULT();
+}
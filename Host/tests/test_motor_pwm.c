@@ -0,0 +1,262 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_motor_pwm checks the Timer 1 motor PWM (MotorPWM.h) on the emulated timer: direction reversals never drive a
+ * pulse in the wrong direction, the command watchdog brakes the motors when feeds stop, duties stay within TOP, and
+ * run time TOP changes survive a late TOP interrupt.
+ */
+
+#include <stdbool.h>
+
+#include "Host_HAL.h"
+#include "MotorPWM.h"
+#include "Timing.h"
+#include "host_test.h"
+
+#define PERIOD_200 400  // cycles per PWM period at TOP 200 (dual slope)
+
+static void Start_PWM( uint16_t top )
+{
+    Host_HAL_Reset();
+    Motor_PWM_Init( top );
+    Motor_PWM_Enable( true );
+    sei();
+}
+
+/**
+ * Steps one cycle at a time and fails if the left direction pin (PB2) changes while the left output (PB6) is high,
+ * as seen right after each cycle. Returns the number of cycles with the output high in reverse.
+ */
+static uint32_t Step_Watching_Left( uint32_t cycles, bool* p_glitch )
+{
+    bool prev_rev     = Host_Pin_Read( 'B', PB2 );
+    uint32_t high_rev = 0;
+    for( uint32_t i = 0; i < cycles; i++ ) {
+        Host_Advance_Cycles( 1 );
+        bool high = Host_Pin_Read( 'B', PB6 );
+        bool rev  = Host_Pin_Read( 'B', PB2 );
+        if( rev != prev_rev && high )
+            *p_glitch = true;
+        if( high && rev )
+            high_rev++;
+        prev_rev = rev;
+    }
+    return high_rev;
+}
+
+static void Test_Reversal_Switches_While_Low()
+{
+    Start_PWM( 200 );
+    Motor_PWM_Set( 150, 150 );
+    Host_Advance_Cycles( 3 * PERIOD_200 + 10 );  // just after a BOTTOM, mid pulse
+    CHECK( Host_Pin_Read( 'B', PB6 ) );
+
+    bool glitch = false;
+    Motor_PWM_Set( -150, 150 );
+    uint32_t high_rev = Step_Watching_Left( 4 * PERIOD_200, &glitch );
+    CHECK( !glitch );
+    CHECK( high_rev > 0 );  // and it does drive in reverse afterwards
+    CHECK( Get_Motor_PWM_Left() == -150 );
+    CHECK( Get_Motor_PWM_Right() == 150 );
+}
+
+static void Test_Reversal_With_Late_Interrupt()
+{
+    Start_PWM( 200 );
+    Motor_PWM_Set( 150, 150 );
+    Host_Advance_Cycles( 3 * PERIOD_200 + 150 );  // counting up, before TOP
+
+    bool glitch = false;
+    Motor_PWM_Set( -150, 150 );
+    cli();  // hold the BOTTOM interrupt off well past BOTTOM
+    Step_Watching_Left( PERIOD_200 / 2 + 150, &glitch );
+    sei();
+    uint32_t high_rev = Step_Watching_Left( 3 * PERIOD_200, &glitch );
+    CHECK( !glitch );
+    CHECK( high_rev > 0 );
+    CHECK( Get_Motor_PWM_Left() == -150 );
+}
+
+static void Test_Reversal_Cancelled()
+{
+    Start_PWM( 200 );
+    Motor_PWM_Set( 150, 150 );
+    Host_Advance_Cycles( 3 * PERIOD_200 + 150 );
+
+    Motor_PWM_Set( -150, 150 );
+    Motor_PWM_Set( 120, 150 );
+    Host_Advance_Cycles( 3 * PERIOD_200 );
+    CHECK( !Host_Pin_Read( 'B', PB2 ) );
+    CHECK( Get_Motor_PWM_Left() == 120 );
+}
+
+static void Test_Most_Negative_Duty()
+{
+    Start_PWM( 200 );
+    Motor_PWM_Set( INT16_MIN, INT16_MIN );
+    Host_Advance_Cycles( 4 * PERIOD_200 );
+    CHECK( Host_Pin_Read( 'B', PB1 ) && Host_Pin_Read( 'B', PB2 ) );
+    CHECK( (int16_t)OCR1B > 0 && (int16_t)OCR1A > 0 );  // a positive magnitude, not -INT16_MIN wrapped around
+    CHECK( Get_Motor_PWM_Left() < 0 );
+    CHECK( Get_Motor_PWM_Right() < 0 );
+}
+
+static void Test_Duty_Limited_To_Top()
+{
+    Start_PWM( 200 );
+    CHECK( Motor_PWM_Set_Profile( PWM_PROFILE_MAX_FREQ ) == 80 );
+    Host_Advance_Cycles( 4 * PERIOD_200 );
+    CHECK( ICR1 == 80 );
+
+    // a duty that was valid at the old TOP is full duty at the new one, not past TOP
+    Motor_PWM_Set( -150, 150 );
+    Host_Advance_Cycles( 4 * PERIOD_200 );
+    CHECK( OCR1A == 80 && OCR1B == 80 );
+    CHECK( Get_Motor_PWM_Left() == -80 );
+    CHECK( Get_Motor_PWM_Right() == 80 );
+}
+
+static void Test_Watchdog_Trip()
+{
+    Start_PWM( 200 );
+    SetupTimer0();  // the watchdog counts Timer 0 milliseconds
+    Motor_PWM_Watchdog_Init( 5 );
+    Motor_PWM_Set( 100, -100 );
+    Motor_PWM_Watchdog_Feed( 0 );
+
+    // a feed restarts the countdown
+    Host_Advance_Micros( 4000 );
+    Motor_PWM_Watchdog_Feed( 0 );
+    Host_Advance_Micros( 4000 );
+    CHECK( Is_Motor_PWM_Enabled() );
+    CHECK( !Motor_PWM_Watchdog_Tripped() );
+
+    // it runs out: duty zeroed and outputs disconnected, reported once
+    Host_Advance_Micros( 2000 );
+    CHECK( !Is_Motor_PWM_Enabled() );
+    CHECK( OCR1A == 0 && OCR1B == 0 );
+    CHECK( !Host_Pin_Read( 'B', PB5 ) && !Host_Pin_Read( 'B', PB6 ) );
+    CHECK( Motor_PWM_Watchdog_Tripped() );
+    CHECK( !Motor_PWM_Watchdog_Tripped() );
+
+    // the pending reversal does not bring the duty back
+    Host_Advance_Micros( 2000 );
+    CHECK( OCR1A == 0 && OCR1B == 0 );
+}
+
+static void Test_Watchdog_Hold()
+{
+    Start_PWM( 200 );
+    SetupTimer0();
+    Motor_PWM_Watchdog_Init( 5 );
+    Motor_PWM_Set( 100, 100 );
+    Motor_PWM_Watchdog_Feed( 20 );  // a timed command adds its duration
+
+    Host_Advance_Micros( 24000 );
+    CHECK( Is_Motor_PWM_Enabled() );
+    Host_Advance_Micros( 2000 );
+    CHECK( !Is_Motor_PWM_Enabled() );
+    CHECK( Motor_PWM_Watchdog_Tripped() );
+}
+
+/**
+ * Steps through a TOP change from 200 to 80 with the TOP interrupt held off from cli_at to sei_at cycles after the
+ * call. Checks the counter never runs past the old TOP and every high pulse is one of the three the change allows:
+ * old duty (2*100), the transition (100 down + 40 up) or new duty (2*40).
+ */
+static void Check_Top_Change( uint32_t start, uint32_t cli_at, uint32_t sei_at )
+{
+    Start_PWM( 200 );
+    Motor_PWM_Set( 50, 100 );  // right (OCR1A, PB5) 100, left (OCR1B) 50
+    Host_Advance_Cycles( start );
+    CHECK( Motor_PWM_Set_Profile( PWM_PROFILE_MAX_FREQ ) == 80 );
+
+    uint16_t max_count = 0;
+    uint32_t run = 0;
+    bool seen_low = false;  // the call lands mid pulse, only time whole pulses
+    bool bad_run = false;
+    for( uint32_t i = 0; i < 6 * PERIOD_200; i++ ) {
+        if( i == cli_at )
+            cli();
+        if( i == sei_at )
+            sei();
+        Host_Advance_Cycles( 1 );
+        if( TCNT1 > max_count )
+            max_count = TCNT1;
+        if( Host_Pin_Read( 'B', PB5 ) ) {
+            if( seen_low )
+                run++;
+        } else {
+            if( run && !( run >= 199 && run <= 201 ) && !( run >= 139 && run <= 141 ) && !( run >= 79 && run <= 81 ) )
+                bad_run = true;
+            run      = 0;
+            seen_low = true;
+        }
+    }
+    CHECK( max_count <= 200 );
+    CHECK( !bad_run );
+    CHECK( ICR1 == 80 );
+    CHECK( OCR1A == 40 );
+    CHECK( OCR1B == 20 );
+    CHECK( !( TIMSK1 & ( 1 << ICIE1 ) ) );
+}
+
+static void Test_Top_Change_On_Time()
+{
+    Check_Top_Change( 3 * PERIOD_200 + 10, 0, 0 );
+}
+
+static void Test_Top_Change_Late_Before_Bottom()
+{
+    // TOP comes 190 cycles after the call, the interrupt runs 60 cycles later, still well before BOTTOM
+    Check_Top_Change( 3 * PERIOD_200 + 10, 100, 250 );
+}
+
+static void Test_Top_Change_Late_After_Bottom()
+{
+    // the interrupt runs 150 counts into the next up-count, above the new TOP: it must wait for the next TOP
+    Check_Top_Change( 3 * PERIOD_200 + 10, 100, 190 + 200 + 150 );
+}
+
+int main()
+{
+    HOST_TEST( Test_Reversal_Switches_While_Low );
+    HOST_TEST( Test_Reversal_With_Late_Interrupt );
+    HOST_TEST( Test_Reversal_Cancelled );
+    HOST_TEST( Test_Most_Negative_Duty );
+    HOST_TEST( Test_Watchdog_Trip );
+    HOST_TEST( Test_Watchdog_Hold );
+    HOST_TEST( Test_Duty_Limited_To_Top );
+    HOST_TEST( Test_Top_Change_On_Time );
+    HOST_TEST( Test_Top_Change_Late_Before_Bottom );
+    HOST_TEST( Test_Top_Change_Late_After_Bottom );
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,265 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_serial_io checks SerialIO.h against the emulated CDC endpoint: the usb_send_msg frame layout, plain, as a
+ * sequenced reply and staged in a batch, messages the send buffer cannot take being dropped whole and counted,
+ * telemetry going out behind replies and outside batches, and bytes from the host reaching the receive buffer in order.
+ */
+
+#include <string.h>
+
+#include "Host_HAL.h"
+#include "SerialIO.h"
+#include "host_test.h"
+
+static void Start_USB()
+{
+    Host_HAL_Reset();
+    USB_SetupHardware();
+    usb_send_set_sequence( -1 );
+    usb_send_stats_reset();
+}
+
+/**
+ * Runs the USB upkeep until everything queued has reached the endpoint and returns the bytes the host received.
+ */
+static uint16_t Read_Sent( uint8_t* p_buf, uint16_t max )
+{
+    for( int i = 0; i < 64; i++ )
+        USB_Upkeep_Task();
+    return Host_CDC_Read( p_buf, max );
+}
+
+static void Test_Frame_Layout()
+{
+    Start_USB();
+    float value = 1.5f;
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+
+    uint8_t expected[9] = { 8, 'c', 'f', 0, '+' };
+    memcpy( &expected[5], &value, sizeof( value ) );
+
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( expected ) );
+    CHECK( memcmp( buf, expected, sizeof( expected ) ) == 0 );
+}
+
+static void Test_Frame_Without_Data()
+{
+    Start_USB();
+    usb_send_msg( "c", 'r', NULL, 0 );
+
+    uint8_t expected[4] = { 3, 'c', 0, 'r' };
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( expected ) );
+    CHECK( memcmp( buf, expected, sizeof( expected ) ) == 0 );
+}
+
+static void Test_Sequenced_Frame_Layout()
+{
+    Start_USB();
+    float value = 1.5f;
+    usb_send_msg_seq( 7, "cf", '+', &value, sizeof( value ) );
+    usb_send_msg( "cf", 'V', &value, sizeof( value ) );  // the sequence applied to the one message only
+
+    uint8_t expected[13 + 9] = { 12, 'c', 'B', 'c', 'f', 0, '#', 7, '+' };
+    memcpy( &expected[9], &value, sizeof( value ) );
+    uint8_t plain[5] = { 8, 'c', 'f', 0, 'V' };
+    memcpy( &expected[13], plain, sizeof( plain ) );
+    memcpy( &expected[18], &value, sizeof( value ) );
+
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( expected ) );
+    CHECK( memcmp( buf, expected, sizeof( expected ) ) == 0 );
+}
+
+static void Test_Batch_Frame_Layout()
+{
+    Start_USB();
+    float value = 1.5f;
+    uint8_t frame[9] = { 8, 'c', 'f', 0, '+' };
+    memcpy( &frame[5], &value, sizeof( value ) );
+
+    // two staged messages share one frame: [24]["c18s"]['&'][frame][frame]
+    usb_send_batch_begin();
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 0 );  // held until the flush
+    usb_send_batch_flush();
+
+    uint8_t header[7] = { 24, 'c', '1', '8', 's', 0, '&' };
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( header ) + 2 * sizeof( frame ) );
+    CHECK( memcmp( buf, header, sizeof( header ) ) == 0 );
+    CHECK( memcmp( &buf[7], frame, sizeof( frame ) ) == 0 );
+    CHECK( memcmp( &buf[16], frame, sizeof( frame ) ) == 0 );
+
+    // a lone staged message goes out unwrapped
+    usb_send_batch_begin();
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    usb_send_batch_flush();
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == sizeof( frame ) );
+    CHECK( memcmp( buf, frame, sizeof( frame ) ) == 0 );
+}
+
+static void Test_Overflow_Drops_Whole_Messages()
+{
+    Start_USB();
+    float value = 1.5f;
+
+    // 7 nine byte messages fill the 63 bytes the send buffer holds, the ones after are dropped and counted
+    for( int i = 0; i < 7; i++ )
+        usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    usb_send_msg( "cf", 'V', &value, sizeof( value ) );
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+
+    const USB_Send_Stats_t* p_stats = usb_send_stats();
+    CHECK( p_stats->dropped == 3 );
+    CHECK( p_stats->send_high_water == 63 );
+    CHECK( p_stats->by_cmd[0].cmd == '+' && p_stats->by_cmd[0].dropped == 2 );
+    CHECK( p_stats->by_cmd[1].cmd == 'V' && p_stats->by_cmd[1].dropped == 1 );
+    CHECK( p_stats->by_cmd[2].cmd == 0 );
+
+    // what was sent is whole frames
+    uint8_t buf[128];
+    uint16_t len = Read_Sent( buf, sizeof( buf ) );
+    CHECK( len == 63 );
+    for( uint16_t i = 0; i < len; i += 9 )
+        CHECK( buf[i] == 8 && buf[i + 4] == '+' );
+
+    // with the buffer drained, messages go out again
+    usb_send_msg( "cf", 'V', &value, sizeof( value ) );
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 );
+    CHECK( p_stats->dropped == 3 );
+
+    usb_send_stats_reset();
+    CHECK( p_stats->dropped == 0 && p_stats->by_cmd[0].cmd == 0 );
+}
+
+static void Test_Drop_Table_Overflow()
+{
+    Start_USB();
+    uint8_t fill[59] = { 0 };
+    usb_send_msg( "c", 'x', fill, sizeof( fill ) );  // 63 bytes, nothing else fits
+
+    // a slot per command until the last, which counts the rest as '.'
+    const char cmds[] = "abcdefgha";
+    for( int i = 0; cmds[i]; i++ )
+        usb_send_msg( "c", cmds[i], NULL, 0 );
+
+    const USB_Send_Stats_t* p_stats = usb_send_stats();
+    CHECK( p_stats->dropped == 9 );
+    CHECK( p_stats->by_cmd[0].cmd == 'a' && p_stats->by_cmd[0].dropped == 2 );
+    for( int i = 1; i < USB_DROP_SLOTS - 1; i++ )
+        CHECK( p_stats->by_cmd[i].cmd == cmds[i] && p_stats->by_cmd[i].dropped == 1 );
+    CHECK( p_stats->by_cmd[USB_DROP_SLOTS - 1].cmd == '.' );
+    CHECK( p_stats->by_cmd[USB_DROP_SLOTS - 1].dropped == 3 );
+}
+
+static void Test_Telemetry_Drops_Counted()
+{
+    Start_USB();
+    uint8_t fill[59] = { 0 };
+    usb_send_telemetry( "c", 'q', fill, sizeof( fill ) );
+    usb_send_telemetry( "c", 'q', fill, sizeof( fill ) );
+
+    const USB_Send_Stats_t* p_stats = usb_send_stats();
+    CHECK( p_stats->dropped == 1 );
+    CHECK( p_stats->telemetry_high_water == 63 );
+    CHECK( p_stats->by_cmd[0].cmd == 'q' && p_stats->by_cmd[0].dropped == 1 );
+
+    // replies have their own buffer and still go out, ahead of the telemetry
+    float value = 1.5f;
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    uint8_t buf[128];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 + 63 );
+    CHECK( buf[0] == 8 && buf[4] == '+' );
+    CHECK( buf[9] == 62 && buf[12] == 'q' );
+
+    // one frame of each class was timed
+    const USB_Latency_t* p_latency = usb_send_latency();
+    CHECK( p_latency[USB_CLASS_REPLY].frames == 1 );
+    CHECK( p_latency[USB_CLASS_TELEMETRY].frames == 1 );
+}
+
+static void Test_Telemetry_Not_Batched()
+{
+    Start_USB();
+    float value = 1.5f;
+
+    // telemetry sent while a batch is open goes out straight away, the batch's reply waits for the flush
+    usb_send_batch_begin();
+    usb_send_msg( "cf", '+', &value, sizeof( value ) );
+    usb_send_telemetry( "cf", 'q', &value, sizeof( value ) );
+    uint8_t buf[64];
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 );
+    CHECK( buf[4] == 'q' );
+
+    usb_send_batch_flush();
+    CHECK( Read_Sent( buf, sizeof( buf ) ) == 9 );
+    CHECK( buf[4] == '+' );
+}
+
+static void Test_Receive()
+{
+    Start_USB();
+    float values[2] = { 2.5f, -4.0f };
+    uint8_t command[9] = { '*' };
+    memcpy( &command[1], values, sizeof( values ) );
+    Host_CDC_Write( command, sizeof( command ) );
+
+    for( int i = 0; i < 16; i++ )  // one byte per upkeep
+        USB_Upkeep_Task();
+    CHECK( usb_msg_length() == sizeof( command ) );
+    CHECK( usb_msg_peek() == '*' );
+    CHECK( usb_msg_get() == '*' );
+
+    float received[2];
+    CHECK( usb_msg_read_into( received, sizeof( received ) ) );
+    CHECK( received[0] == 2.5f && received[1] == -4.0f );
+    CHECK( usb_msg_length() == 0 );
+}
+
+int main()
+{
+    HOST_TEST( Test_Frame_Layout );
+    HOST_TEST( Test_Frame_Without_Data );
+    HOST_TEST( Test_Sequenced_Frame_Layout );
+    HOST_TEST( Test_Batch_Frame_Layout );
+    HOST_TEST( Test_Overflow_Drops_Whole_Messages );
+    HOST_TEST( Test_Drop_Table_Overflow );
+    HOST_TEST( Test_Telemetry_Drops_Counted );
+    HOST_TEST( Test_Telemetry_Not_Batched );
+    HOST_TEST( Test_Receive );
+    return HOST_TEST_RESULT();
+}
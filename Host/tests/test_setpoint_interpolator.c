@@ -0,0 +1,146 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_setpoint_interpolator checks the target Setpoint_Interpolator renders between, past and after timestamped
+ * setpoints, how it learns the host clock offset, and the acceleration and jerk limits on its output.
+ */
+
+#include "Setpoint_Interpolator.h"
+#include "host_test.h"
+
+static void Test_Interpolation()
+{
+    // rendered 0.1 s behind the host, whose clock runs 8 s ahead of the device's
+    Setpoint_Interpolator_t interp;
+    Setpoint_Interpolator_Init( &interp, 0, 0, 0.1f, 0.5f );
+    CHECK( !Setpoint_Interpolator_Active( &interp, 1.0f ) );
+
+    // with one setpoint the target is that setpoint
+    Setpoint_Interpolator_Add( &interp, 10.0f, 1, 2.0f );
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.05f ), 1, 1e-4 );
+
+    // with two it is the line through them, host time 10.05 is half way
+    Setpoint_Interpolator_Add( &interp, 10.1f, 2, 2.12f );
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.15f ), 1.5, 1e-4 );
+
+    // past the newest the slope carries on for one update period, then holds
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.25f ), 2.5, 1e-4 );
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.4f ), 3, 1e-4 );
+    CHECK( Setpoint_Interpolator_Active( &interp, 2.4f ) );
+
+    // no setpoint for longer than the timeout and the target falls to zero
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.63f ), 0, 1e-6 );
+}
+
+static void Test_Clock_Offset()
+{
+    // the second setpoint was delivered faster, so it sets the offset
+    Setpoint_Interpolator_t interp;
+    Setpoint_Interpolator_Init( &interp, 0, 0, 0.1f, 0.5f );
+    Setpoint_Interpolator_Add( &interp, 10.0f, 0, 2.05f );
+    Setpoint_Interpolator_Add( &interp, 10.1f, 1, 2.1f );
+    CHECK_NEAR( interp.offset, -8, 1e-4 );
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.15f ), 0.5, 1e-4 );
+
+    // an older time stamp (the host restarted) starts a new stream
+    Setpoint_Interpolator_Add( &interp, 5.0f, 3, 2.2f );
+    CHECK( interp.count == 1 );
+    CHECK_NEAR( interp.offset, -2.8, 1e-4 );
+    CHECK_NEAR( Setpoint_Interpolator_Target( &interp, 2.25f ), 3, 1e-4 );
+}
+
+static void Test_Acceleration_Limit()
+{
+    Setpoint_Interpolator_t interp;
+    Setpoint_Interpolator_Init( &interp, 1, 0, 0, 5 );
+    Setpoint_Interpolator_Add( &interp, 0, 1, 0 );
+
+    // 1 per second squared takes a second to reach a step of 1
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.1f, 0.1f ), 0.1, 1e-5 );
+    for( int i = 2; i <= 5; i++ )
+        Setpoint_Interpolator_Update( &interp, 0.1f * i, 0.1f );
+    CHECK_NEAR( interp.value, 0.5, 1e-5 );
+    for( int i = 6; i <= 11; i++ )
+        Setpoint_Interpolator_Update( &interp, 0.1f * i, 0.1f );
+    CHECK_NEAR( interp.value, 1, 1e-6 );
+    CHECK_NEAR( interp.rate, 0, 1e-6 );
+}
+
+static void Test_Jerk_Limit()
+{
+    // the rate rises by at most 10 * 0.1 each update
+    Setpoint_Interpolator_t interp;
+    Setpoint_Interpolator_Init( &interp, 0, 10, 0, 5 );
+    Setpoint_Interpolator_Add( &interp, 0, 1, 0 );
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.1f, 0.1f ), 0.1, 1e-5 );
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.2f, 0.1f ), 0.3, 1e-5 );
+
+    // and it lands on the target without passing it
+    float peak = 0;
+    for( int i = 3; i < 40; i++ ) {
+        float value = Setpoint_Interpolator_Update( &interp, 0.1f * i, 0.1f );
+        if( value > peak )
+            peak = value;
+    }
+    CHECK_NEAR( peak, 1, 1e-5 );
+    CHECK_NEAR( interp.value, 1, 1e-5 );
+}
+
+static void Test_Comes_To_Rest()
+{
+    Setpoint_Interpolator_t interp;
+    Setpoint_Interpolator_Init( &interp, 0, 0, 0, 0.5f );
+    Setpoint_Interpolator_Add( &interp, 0, 2, 0 );
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.1f, 0.1f ), 2, 1e-6 );
+
+    // after the timeout the output returns to zero, and once its rate has too the interpolator goes idle
+    CHECK( Setpoint_Interpolator_Active( &interp, 0.6f ) );
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.6f, 0.5f ), 0, 1e-6 );
+    CHECK( Setpoint_Interpolator_Active( &interp, 0.6f ) );
+    CHECK_NEAR( Setpoint_Interpolator_Update( &interp, 0.7f, 0.1f ), 0, 1e-6 );
+    CHECK( !Setpoint_Interpolator_Active( &interp, 0.7f ) );
+
+    // Reset drops a live stream
+    Setpoint_Interpolator_Add( &interp, 1, 2, 1 );
+    Setpoint_Interpolator_Update( &interp, 1.1f, 0.1f );
+    Setpoint_Interpolator_Reset( &interp, 0 );
+    CHECK( !Setpoint_Interpolator_Active( &interp, 1.1f ) );
+}
+
+int main()
+{
+    HOST_TEST( Test_Interpolation );
+    HOST_TEST( Test_Clock_Offset );
+    HOST_TEST( Test_Acceleration_Limit );
+    HOST_TEST( Test_Jerk_Limit );
+    HOST_TEST( Test_Comes_To_Rest );
+    return HOST_TEST_RESULT();
+}
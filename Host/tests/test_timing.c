@@ -0,0 +1,131 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * test_timing checks the Timer0 millisecond clock of Timing.h and the Timer1 emulation it and the motor PWM rely on:
+ * whole milliseconds from the compare interrupt, microseconds from TCNT0, and Timer1 counting in CTC and dual slope
+ * modes.
+ */
+
+#include "Host_HAL.h"
+#include "Timing.h"
+#include "host_test.h"
+
+static void Test_Timer0_Counts_Milliseconds()
+{
+    Host_HAL_Reset();
+    SetupTimer0();
+
+    for( uint32_t ms = 1; ms <= 5; ms++ ) {
+        Host_Advance_Micros( 1000 );
+        CHECK( GetMilli() == ms );
+        CHECK( GetMicro() == 0 );
+    }
+    CHECK_NEAR( GetTimeSec(), 0.005, 1e-6 );
+}
+
+static void Test_Timer0_Counts_Microseconds()
+{
+    Host_HAL_Reset();
+    SetupTimer0();
+
+    Host_Advance_Micros( 2500 );
+    CHECK( GetMilli() == 2 );
+    CHECK( GetMicro() == 500 );  // 4us per Timer0 tick at clk/64
+
+    Host_Advance_Micros( 2 );  // half a tick does not show
+    CHECK( GetMicro() == 500 );
+    Host_Advance_Micros( 2 );
+    CHECK( GetMicro() == 504 );
+    CHECK_NEAR( GetTimeSec(), 0.002504, 1e-6 );
+}
+
+static void Test_Seconds_Since()
+{
+    Host_HAL_Reset();
+    SetupTimer0();
+
+    Host_Advance_Micros( 1700 );
+    Time_t start = GetTime();
+    CHECK( start.millisec == 1 );
+    CHECK( start.microsec == 700 );
+
+    Host_Advance_Micros( 12600 );  // across several millisecond interrupts and a microsecond wrap
+    CHECK_NEAR( SecondsSince( &start ), 0.0126, 1e-6 );
+}
+
+static void Test_Timer1_CTC()
+{
+    Host_HAL_Reset();
+    TCCR1B = ( 1 << WGM12 ) | ( 1 << CS11 );  // mode 4, TOP = OCR1A, clk/8
+    OCR1A  = 1999;                           // 1ms period
+
+    Host_Advance_Cycles( 8000 );
+    CHECK( TCNT1 == 1000 );
+    CHECK( !( TIFR1 & ( 1 << OCF1A ) ) );
+
+    Host_Advance_Cycles( 8000 );
+    CHECK( TCNT1 == 0 );
+    CHECK( TIFR1 & ( 1 << OCF1A ) );
+    CHECK( !( TIFR1 & ( 1 << TOV1 ) ) );  // CTC clears the counter without an overflow
+}
+
+static void Test_Timer1_Dual_Slope()
+{
+    Host_HAL_Reset();
+    ICR1   = 100;
+    TCCR1B = ( 1 << WGM13 ) | ( 1 << CS10 );  // mode 8, TOP = ICR1, clk/1
+
+    Host_Advance_Cycles( 60 );
+    CHECK( TCNT1 == 60 );
+    CHECK( !( TIFR1 & ( 1 << ICF1 ) ) );
+
+    Host_Advance_Cycles( 90 );  // up to TOP and back down
+    CHECK( TCNT1 == 50 );
+    CHECK( TIFR1 & ( 1 << ICF1 ) );
+    CHECK( !( TIFR1 & ( 1 << TOV1 ) ) );
+
+    Host_Advance_Cycles( 50 );
+    CHECK( TCNT1 == 0 );
+    CHECK( TIFR1 & ( 1 << TOV1 ) );  // overflow flag at BOTTOM in mode 8
+
+    Host_Advance_Cycles( 10 );
+    CHECK( TCNT1 == 10 );
+}
+
+int main()
+{
+    HOST_TEST( Test_Timer0_Counts_Milliseconds );
+    HOST_TEST( Test_Timer0_Counts_Microseconds );
+    HOST_TEST( Test_Seconds_Since );
+    HOST_TEST( Test_Timer1_CTC );
+    HOST_TEST( Test_Timer1_Dual_Slope );
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,266 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * virtual_zumo presents the Lab5 firmware (compiled for the host, see Host_HAL.h) as a serial device on a
+ * pseudo-terminal, so SerialMonitor and the Python tools can be run and load tested without a robot. The firmware's
+ * PWM drives the simulated drive train (Zumo_Plant.h), whose encoders and battery feed back to it.
+ *
+ *   virtual_zumo [-L link] [-x speed] [-a period_ms] [-l loop_cycles] [-b volts] [-v]
+ *
+ *   -L  symlink created to the pty so clients can open a fixed name. Default /tmp/ttyZumoCarVirtual.
+ *   -x  simulated seconds per wall second. Default 1 (real time); 0 runs as fast as the emulation goes, which is
+ *       how the host stack is pushed past the real USB link's rates.
+ *   -a  start streaming 'q' telemetry every period_ms as if a 'Q' command had been sent. Like a real 'Q', the
+ *       firmware waits period_ms *seconds* before the first message.
+ *   -l  CPU cycles charged per main loop pass (Host_Set_Loop_Cycles). Default 160.
+ *   -b  battery open circuit voltage. Default 6.0.
+ *   -v  print throughput once a second.
+ *
+ * e.g. make virtual_zumo && ./virtual_zumo -x 0 -a 1 &
+ *      python3 ../SerialMonitor/experiment_runner.py -p /tmp/ttyZumoCarVirtual ...
+ *
+ * Bytes written to the pty reach the firmware through the emulated CDC OUT endpoint; everything the firmware sends
+ * is written back to the pty. When the client stops reading, writes to the pty stall and the back pressure reaches the
+ * firmware's IN endpoint as it would over USB. Baud rate settings are ignored. Stop with Ctrl-C.
+ */
+
+#define _GNU_SOURCE  // posix_openpt, ptsname
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Host_HAL.h"
+#include "Zumo_Plant.h"
+
+int Lab5_main( void );  // Lab5-Control.c compiled with -Dmain=Lab5_main
+
+// pty I/O is polled at most this often in simulated time, a syscall every loop pass would dominate the run time
+#define IO_PERIOD_S 50e-6
+
+static int _master = -1;
+static int _slave  = -1;  // kept open so the master does not see EIO while no client has the pty open
+static const char* _link = "/tmp/ttyZumoCarVirtual";
+static volatile sig_atomic_t _stop = 0;
+
+static double _speed   = 1.0;
+static bool _verbose   = false;
+static Zumo_Plant_Params_t _plant_params;
+static Zumo_Plant_State_t _plant;
+
+static double _last_io_s = -1;
+static struct timespec _wall_start;
+static uint8_t _to_host[4096];  // firmware output not yet accepted by the pty
+static size_t _to_host_len = 0;
+static size_t _to_host_pos = 0;
+static uint8_t _to_fw[4096];  // pty input not yet accepted by the CDC OUT FIFO
+static size_t _to_fw_len = 0;
+static size_t _to_fw_pos = 0;
+
+static uint64_t _bytes_in  = 0;
+static uint64_t _bytes_out = 0;
+static uint64_t _loops     = 0;
+static double _report_s    = 1.0;
+
+static double _wall_seconds( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - _wall_start.tv_sec ) + 1e-9 * ( now.tv_nsec - _wall_start.tv_nsec );
+}
+
+static void _on_signal( int sig )
+{
+    (void)sig;
+    _stop = 1;
+}
+
+static bool _open_pty( void )
+{
+    _master = posix_openpt( O_RDWR | O_NOCTTY );
+    if( _master < 0 || grantpt( _master ) || unlockpt( _master ) ) {
+        perror( "virtual_zumo: pty" );
+        return false;
+    }
+    const char* name = ptsname( _master );
+    _slave           = open( name, O_RDWR | O_NOCTTY );
+    if( _slave < 0 ) {
+        perror( name );
+        return false;
+    }
+
+    // raw bytes both ways, no echo or line editing
+    struct termios tio;
+    tcgetattr( _slave, &tio );
+    cfmakeraw( &tio );
+    tcsetattr( _slave, TCSANOW, &tio );
+    fcntl( _master, F_SETFL, fcntl( _master, F_GETFL ) | O_NONBLOCK );
+
+    struct stat st;
+    if( lstat( _link, &st ) == 0 && S_ISLNK( st.st_mode ) )
+        unlink( _link );
+    if( symlink( name, _link ) ) {
+        perror( _link );
+        return false;
+    }
+    printf( "virtual_zumo: %s -> %s\n", _link, name );
+    fflush( stdout );
+    return true;
+}
+
+/**
+ * Moves bytes between the pty and the emulated CDC endpoints. Each side keeps what the other could not take yet.
+ */
+static void _pump( void )
+{
+    if( _to_fw_pos == _to_fw_len ) {
+        ssize_t n = read( _master, _to_fw, sizeof( _to_fw ) );
+        _to_fw_pos = 0;
+        _to_fw_len = n > 0 ? (size_t)n : 0;
+        _bytes_in += _to_fw_len;
+    }
+    if( _to_fw_pos < _to_fw_len )
+        _to_fw_pos += Host_CDC_Write( _to_fw + _to_fw_pos, (uint16_t)( _to_fw_len - _to_fw_pos ) );
+
+    if( _to_host_pos == _to_host_len ) {
+        _to_host_pos = 0;
+        _to_host_len = Host_CDC_Read( _to_host, sizeof( _to_host ) );
+    }
+    if( _to_host_pos < _to_host_len ) {
+        ssize_t n = write( _master, _to_host + _to_host_pos, _to_host_len - _to_host_pos );
+        if( n > 0 ) {
+            _to_host_pos += (size_t)n;
+            _bytes_out += (size_t)n;
+        }
+    }
+}
+
+/**
+ * Runs after every firmware main loop pass: steps the plant, and every IO_PERIOD_S of simulated time moves pty data
+ * and holds the simulation back to the requested speed.
+ */
+static void _device_hook( void )
+{
+    _loops++;
+    Zumo_Plant_Update_HAL( &_plant, &_plant_params );
+
+    double now = Host_Seconds();
+    if( now - _last_io_s < IO_PERIOD_S )
+        return;
+    _last_io_s = now;
+
+    _pump();
+
+    double wall = _wall_seconds();
+    if( _speed > 0 && now / _speed > wall ) {
+        double ahead          = now / _speed - wall;
+        struct timespec delay = { (time_t)ahead, (long)( ( ahead - (time_t)ahead ) * 1e9 ) };
+        nanosleep( &delay, NULL );
+    }
+
+    if( _verbose && wall >= _report_s ) {
+        printf( "virtual_zumo: sim %.1f s  wall %.1f s  in %llu B  out %llu B (%.0f B/s)  %.0f loops/s\n", now, wall,
+                (unsigned long long)_bytes_in, (unsigned long long)_bytes_out, _bytes_out / wall, _loops / wall );
+        fflush( stdout );
+        _report_s = wall + 1.0;
+    }
+
+    if( _stop )
+        Host_Stop_Firmware();
+}
+
+static void _usage( void )
+{
+    fprintf( stderr, "usage: virtual_zumo [-L link] [-x speed] [-a period_ms] [-l loop_cycles] [-b volts] [-v]\n" );
+    exit( 2 );
+}
+
+int main( int argc, char** argv )
+{
+    float autostream = 0;
+    float battery    = 6.0f;
+    long loop_cycles = 160;
+
+    int opt;
+    while( ( opt = getopt( argc, argv, "L:x:a:l:b:v" ) ) != -1 ) {
+        switch( opt ) {
+            case 'L': _link = optarg; break;
+            case 'x': _speed = atof( optarg ); break;
+            case 'a': autostream = atof( optarg ); break;
+            case 'l': loop_cycles = atol( optarg ); break;
+            case 'b': battery = atof( optarg ); break;
+            case 'v': _verbose = true; break;
+            default: _usage();
+        }
+    }
+    if( loop_cycles <= 0 || _speed < 0 || autostream < 0 )
+        _usage();
+
+    signal( SIGINT, _on_signal );
+    signal( SIGTERM, _on_signal );
+    signal( SIGPIPE, SIG_IGN );
+    if( !_open_pty() )
+        return 1;
+
+    Host_HAL_Reset();
+    Host_Set_Loop_Cycles( (uint32_t)loop_cycles );
+    Zumo_Plant_Default_Params( &_plant_params );
+    _plant_params.battery_open = battery;
+    Zumo_Plant_Init( &_plant, &_plant_params );
+    Host_Battery_Set( battery );
+    Host_Set_USBTask_Hook( _device_hook );
+
+    if( autostream > 0 ) {
+        uint8_t cmd[1 + sizeof( float )] = { 'Q' };
+        memcpy( cmd + 1, &autostream, sizeof( float ) );
+        Host_CDC_Write( cmd, sizeof( cmd ) );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &_wall_start );
+    Host_Run_Firmware( Lab5_main );
+
+    double wall = _wall_seconds();
+    printf( "virtual_zumo: simulated %.1f s in %.1f s wall, %llu bytes in, %llu bytes out\n", Host_Seconds(), wall,
+            (unsigned long long)_bytes_in, (unsigned long long)_bytes_out );
+    unlink( _link );
+    close( _slave );
+    close( _master );
+    return 0;
+}
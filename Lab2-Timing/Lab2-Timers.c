@@ -66,7 +66,7 @@ int main(void)
             // variable for current time
             float timer0 = GetTimeSec();
             // send current time
-            usb_send_msg("cf", '0', &timer0, sizeof(timer0));
+            usb_send_msg_seq(mf_send_time.seq, "cf", '0', &timer0, sizeof(timer0));
             //set variables for future calls
             mf_send_time.last_trigger_time = GetTime();
             if (mf_send_time.duration <= 0){
@@ -80,12 +80,12 @@ int main(void)
             // float to send for opperation
             float value = 42.024;
             // send the float
-            usb_send_msg("cf", 'N', &value, sizeof(value));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", 'N', &value, sizeof(value));
             // calculate the time to send the value
             float timer1 = SecondsSince(&sentTime);
             //send the time to send the float
             USB_Upkeep_Task();
-            usb_send_msg("cf", '1', &timer1, sizeof(timer1));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", '1', &timer1, sizeof(timer1));
             //set variables for future calls
             mf_time_float_send.last_trigger_time = GetTime();
             if (mf_time_float_send.duration <= 0){
@@ -102,7 +102,7 @@ int main(void)
                 // loop time
                 float timer2 = SecondsSince(&startTime);
                 //send message
-                usb_send_msg("cf", '1', &timer2, sizeof(timer2));
+                usb_send_msg_seq(mf_loop_timer.seq, "cf", '1', &timer2, sizeof(timer2));
                 //set variables for future calls
                 mf_loop_timer.last_trigger_time = GetTime();
                 firstCall = true;
@@ -107,7 +107,7 @@ int main(void)
             // variable for current time
             float timer0 = GetTimeSec();
             // send current time
-            usb_send_msg("cf", '0', &timer0, sizeof(timer0));
+            usb_send_msg_seq(mf_send_time.seq, "cf", '0', &timer0, sizeof(timer0));
             //set variables for future calls
             mf_send_time.last_trigger_time = GetTime();
             if (mf_send_time.duration <= 0){
@@ -122,12 +122,12 @@ int main(void)
             // float to send for opperation
             float value = 42.024;
             // send the float
-            usb_send_msg("cf", 'N', &value, sizeof(value));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", 'N', &value, sizeof(value));
             // calculate the time to send the value
             float timer1 = SecondsSince(&sentTime);
             //send the time to send the float
             USB_Upkeep_Task();
-            usb_send_msg("cf", '1', &timer1, sizeof(timer1));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", '1', &timer1, sizeof(timer1));
             //set variables for future calls
             mf_time_float_send.last_trigger_time = GetTime();
             if (mf_time_float_send.duration <= 0){
@@ -145,7 +145,7 @@ int main(void)
                 // loop time
                 float timer2 = SecondsSince(&startTime);
                 //send message
-                usb_send_msg("cf", '1', &timer2, sizeof(timer2));
+                usb_send_msg_seq(mf_loop_timer.seq, "cf", '1', &timer2, sizeof(timer2));
                 //set variables for future calls
                 mf_loop_timer.last_trigger_time = GetTime();
                 firstCall = true;
@@ -161,8 +161,8 @@ int main(void)
             struct __attribute__((__packed__)) { float cleft; float cright; } data;
             data.cleft = Counts_Left();
             data.cright = Counts_Right();
-            usb_send_msg("cf", 'L', &data.cleft, sizeof(data.cleft));
-            usb_send_msg("cf", 'R', &data.cright, sizeof(data.cright));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'L', &data.cleft, sizeof(data.cleft));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'R', &data.cright, sizeof(data.cright));
             //set variables for future calls
             mf_encoder_count.last_trigger_time = GetTime();
             if (mf_encoder_count.duration <= 0){
@@ -186,7 +186,7 @@ int main(void)
         
         // checks battery message flag
         if ( MSG_FLAG_Execute( &mf_battery_voltage ) ) {
-            usb_send_msg("cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
+            usb_send_msg_seq(mf_battery_voltage.seq, "cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
             //set variables for future calls
             mf_battery_voltage.last_trigger_time = GetTime();
             if (mf_battery_voltage.duration <= 0){
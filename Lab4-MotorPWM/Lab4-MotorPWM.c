@@ -35,7 +35,7 @@ struct __attribute__((__packed__)) { float time; int16_t PWM_L; int16_t PWM_R; i
 struct __attribute__((__packed__)) { float t_interval; Time_t start_time; Time_t last_send_time; bool active; } sys_send_info;
 
 
-void Set_Send_sysData();
+void Set_Send_sysData(MSG_FLAG_t* p_request);
 
 void Set_Motor_Directions(int16_t left, int16_t right);
 
@@ -111,7 +111,7 @@ int main(void)
             // variable for current time
             float timer0 = GetTimeSec();
             // send current time
-            usb_send_msg("cf", '0', &timer0, sizeof(timer0));
+            usb_send_msg_seq(mf_send_time.seq, "cf", '0', &timer0, sizeof(timer0));
             //set variables for future calls
             mf_send_time.last_trigger_time = GetTime();
             if (mf_send_time.duration <= 0){
@@ -126,12 +126,12 @@ int main(void)
             // float to send for opperation
             float value = 42.024;
             // send the float
-            usb_send_msg("cf", 'N', &value, sizeof(value));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", 'N', &value, sizeof(value));
             // calculate the time to send the value
             float timer1 = SecondsSince(&sentTime);
             //send the time to send the float
             USB_Upkeep_Task();
-            usb_send_msg("cf", '1', &timer1, sizeof(timer1));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", '1', &timer1, sizeof(timer1));
             //set variables for future calls
             mf_time_float_send.last_trigger_time = GetTime();
             if (mf_time_float_send.duration <= 0){
@@ -149,7 +149,7 @@ int main(void)
                 // loop time
                 float timer2 = SecondsSince(&startTime);
                 //send message
-                usb_send_msg("cf", '1', &timer2, sizeof(timer2));
+                usb_send_msg_seq(mf_loop_timer.seq, "cf", '1', &timer2, sizeof(timer2));
                 //set variables for future calls
                 mf_loop_timer.last_trigger_time = GetTime();
                 firstCall = true;
@@ -165,8 +165,8 @@ int main(void)
             struct __attribute__((__packed__)) { float cleft; float cright; } data;
             data.cleft = Counts_Left();
             data.cright = Counts_Right();
-            usb_send_msg("cf", 'L', &data.cleft, sizeof(data.cleft));
-            usb_send_msg("cf", 'R', &data.cright, sizeof(data.cright));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'L', &data.cleft, sizeof(data.cleft));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'R', &data.cright, sizeof(data.cright));
             //set variables for future calls
             mf_encoder_count.last_trigger_time = GetTime();
             if (mf_encoder_count.duration <= 0){
@@ -190,7 +190,7 @@ int main(void)
         
         // checks battery message flag
         if ( MSG_FLAG_Execute( &mf_battery_voltage ) ) {
-            usb_send_msg("cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
+            usb_send_msg_seq(mf_battery_voltage.seq, "cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
             //set variables for future calls
             mf_battery_voltage.last_trigger_time = GetTime();
             if (mf_battery_voltage.duration <= 0){
@@ -212,7 +212,7 @@ int main(void)
 
         // checks if sys_send_info is active - first time
         if (sys_send_info.active && (SecondsSince(&sys_send_info.last_send_time) >= (sys_send_info.t_interval/1000))) {
-            Set_Send_sysData();
+            Set_Send_sysData(NULL);
         }
 
 	    // checks set PWM message flag
@@ -266,7 +266,7 @@ int main(void)
             if (mf_send_sys.duration > 0) {
                 sys_send_info.active = true;
                 sys_send_info.t_interval = mf_send_sys.duration;
-                Set_Send_sysData();
+                Set_Send_sysData(&mf_send_sys);
             } 
             else sys_send_info.active = false;
 
@@ -276,13 +276,13 @@ int main(void)
 
         // checks if sys_send_info is active - second time
         if (sys_send_info.active && (SecondsSince(&sys_send_info.last_send_time) >= (sys_send_info.t_interval/1000))) {
-            Set_Send_sysData();
+            Set_Send_sysData(NULL);
         }
 
    }
 }
 
-void Set_Send_sysData()
+void Set_Send_sysData(MSG_FLAG_t* p_request)
 {
     sys_send_info.last_send_time = GetTime();
     sysData.time = SecondsSince(&sys_send_info.start_time);
@@ -290,7 +290,11 @@ void Set_Send_sysData()
     sysData.PWM_R = Get_Motor_PWM_Right();
     sysData.Encoder_L = Counts_Left();
     sysData.Encoder_R = Counts_Right();
-    usb_send_msg("cf4h", 'q', &sysData, sizeof(sysData));
+    // the frame answering a 'Q' request is a reply, the periodic ones that follow are telemetry
+    if (p_request)
+        usb_send_msg_seq(p_request->seq, "cf4h", 'q', &sysData, sizeof(sysData));
+    else
+        usb_send_telemetry("cf4h", 'q', &sysData, sizeof(sysData));
 }
 /**
  * Set_Motor_direction() takes a float value for each motor and depending on their sign (+/-) sets the 
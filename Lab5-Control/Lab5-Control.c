@@ -7,11 +7,23 @@
 #include "../c_lib/Encoder.h"
 #include "../c_lib/Battery_Monitor.h"
 #include "../c_lib/Filter.h"
+#include "../c_lib/Controller.h"
 #include "../c_lib/MEGN540_MessageHandeling.h"
 #include "../c_lib/MotorPWM.h"
+#include "../c_lib/Profiler.h"
+#include "../c_lib/Setpoint_Interpolator.h"
 
 
 #define PWM_TOP 380
+#define MOTOR_WATCHDOG_MS 500	// motors brake if no new setpoint arrives within this time
+#define INTERP_DELAY 0.1	// 'z' setpoints are rendered this far behind the host (s), one game pad update period
+#define INTERP_TIMEOUT 0.5	// the 'z' velocity target falls to zero if no setpoint arrives within this time (s)
+#define CONTROL_PERIOD 0.01	// wheel controller update period (s), long enough that one encoder count is only 100 counts/s
+#define COUNTS_PER_METER 7425	// 909.7 counts per revolution of the 39 mm wheels
+#define HALF_TRACK 0.049	// half the distance between the tracks (m)
+
+// profiler probe ids, dumped in this order by the 'x' command
+enum { PROF_LOOP, PROF_USB_UPKEEP, PROF_MESSAGE_HANDLING, PROF_BATTERY, PROF_TELEMETRY, PROF_PWM_UPDATE };
 
 // timer for power off
 Time_t Pwr_check;
@@ -20,6 +32,32 @@ Time_t Pwr_check;
 Time_t PWM_timer;
 bool PWM_timer_active;
 
+// 'z' velocity setpoint interpolation, updated every loop pass
+Setpoint_Interpolator_t Interp_Linear;
+Setpoint_Interpolator_t Interp_Angular;
+Time_t Interp_Timer;
+
+// wheel controllers, encoder counts in and motor volts out. 'd'/'D' run the whole cascade, 'v'/'V' only its velocity loop
+typedef enum { CONTROL_OFF, CONTROL_DISTANCE, CONTROL_VELOCITY } Control_Mode_t;
+Control_Mode_t Control_Mode;
+Cascade_Controller_t Wheel_Left;
+Cascade_Controller_t Wheel_Right;
+float Target_Left;	// counts in distance mode, counts/s in velocity mode
+float Target_Right;
+int32_t Last_Counts_Left;
+int32_t Last_Counts_Right;
+Time_t Control_Timer;
+
+void Wheel_Controller_Init(Cascade_Controller_t* p_wheel);
+
+void Start_Control(Control_Mode_t mode);
+
+void Run_Control();
+
+void Set_Wheel_Velocity(float linear, float angular);
+
+void Stop_Setpoint_Stream();
+
 // initiate battery filter
 Filter_Data_t Battery_Filter;
 bool first_voltage;
@@ -34,12 +72,10 @@ float denominator[] = {1, -3.44897255468215e-11, 3.01641584463356e-22, 6.5385109
 
 // system data that is sent with q or Q command
 struct __attribute__((__packed__)) { float time; int16_t PWM_L; int16_t PWM_R; int16_t Encoder_L; int16_t Encoder_R;} sysData;
-// info used to send sysData  -  t_interval in milliseconds
-struct __attribute__((__packed__)) { float t_interval; Time_t start_time; Time_t last_send_time; bool active; } sys_send_info;
+// info used to send sysData  -  t_interval in milliseconds, kept on the device so not packed
+struct { float t_interval; Time_t start_time; Time_t last_send_time; bool active; } sys_send_info;
 
-void Set_Send_sysData();
-
-void Set_Motor_Directions(int16_t left, int16_t right);
+void Set_Send_sysData(MSG_FLAG_t* p_request);
 
 void Start_PWM_Timer(bool timer); 
 
@@ -68,6 +104,8 @@ int main(void)
     GlobalInterruptEnable();
     Message_Handling_Init(); // initialize message handling
     Motor_PWM_Init(PWM_TOP);
+    Motor_PWM_Watchdog_Init(MOTOR_WATCHDOG_MS);
+    Profiler_Init();
 
     // variable needed for timing the while loop
     Time_t startTime;
@@ -102,11 +140,25 @@ int main(void)
     Filter_Init(&Battery_Filter, numerator, denominator, filter_order+1);
     first_voltage = true;
 
+    Setpoint_Interpolator_Init(&Interp_Linear, 0, 0, INTERP_DELAY, INTERP_TIMEOUT);
+    Setpoint_Interpolator_Init(&Interp_Angular, 0, 0, INTERP_DELAY, INTERP_TIMEOUT);
+    Interp_Timer = GetTime();
+
+    Wheel_Controller_Init(&Wheel_Left);
+    Wheel_Controller_Init(&Wheel_Right);
+    Control_Mode = CONTROL_OFF;
+
     while( true ) {
+        PROFILE_BEGIN(PROF_LOOP);
+
+        PROFILE_BEGIN(PROF_USB_UPKEEP);
         USB_Upkeep_Task();
+        PROFILE_END(PROF_USB_UPKEEP);
 
         //USB_Echo_Task();// you'll want to remove this once you get your serial sorted
+        PROFILE_BEGIN(PROF_MESSAGE_HANDLING);
         Message_Handling_Task();
+        PROFILE_END(PROF_MESSAGE_HANDLING);
         
         // Below here you'll process state-machine flags.
         if ( MSG_FLAG_Execute( &mf_restart ) ) {
@@ -117,6 +169,9 @@ int main(void)
             GlobalInterruptEnable();
             Message_Handling_Init(); 
     	    Motor_PWM_Init(PWM_TOP);	// initiate the PWM top to 380, for a frequency of 21 kHz
+    	    Motor_PWM_Watchdog_Init(MOTOR_WATCHDOG_MS);
+            Profiler_Init();
+            Control_Mode = CONTROL_OFF;
         }   
         
         // checks send time message flag
@@ -124,7 +179,7 @@ int main(void)
             // variable for current time
             float timer0 = GetTimeSec();
             // send current time
-            usb_send_msg("cf", '0', &timer0, sizeof(timer0));
+            usb_send_msg_seq(mf_send_time.seq, "cf", '0', &timer0, sizeof(timer0));
             //set variables for future calls
             mf_send_time.last_trigger_time = GetTime();
             if (mf_send_time.duration <= 0){
@@ -139,12 +194,12 @@ int main(void)
             // float to send for opperation
             float value = 42.024;
             // send the float
-            usb_send_msg("cf", 'N', &value, sizeof(value));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", 'N', &value, sizeof(value));
             // calculate the time to send the value
             float timer1 = SecondsSince(&sentTime);
             //send the time to send the float
             USB_Upkeep_Task();
-            usb_send_msg("cf", '1', &timer1, sizeof(timer1));
+            usb_send_msg_seq(mf_time_float_send.seq, "cf", '1', &timer1, sizeof(timer1));
             //set variables for future calls
             mf_time_float_send.last_trigger_time = GetTime();
             if (mf_time_float_send.duration <= 0){
@@ -162,7 +217,7 @@ int main(void)
                 // loop time
                 float timer2 = SecondsSince(&startTime);
                 //send message
-                usb_send_msg("cf", '1', &timer2, sizeof(timer2));
+                usb_send_msg_seq(mf_loop_timer.seq, "cf", '1', &timer2, sizeof(timer2));
                 //set variables for future calls
                 mf_loop_timer.last_trigger_time = GetTime();
                 firstCall = true;
@@ -178,8 +233,8 @@ int main(void)
             struct __attribute__((__packed__)) { float cleft; float cright; } data;
             data.cleft = Counts_Left();
             data.cright = Counts_Right();
-            usb_send_msg("cf", 'L', &data.cleft, sizeof(data.cleft));
-            usb_send_msg("cf", 'R', &data.cright, sizeof(data.cright));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'L', &data.cleft, sizeof(data.cleft));
+            usb_send_msg_seq(mf_encoder_count.seq, "cf", 'R', &data.cright, sizeof(data.cright));
             //set variables for future calls
             mf_encoder_count.last_trigger_time = GetTime();
             if (mf_encoder_count.duration <= 0){
@@ -189,6 +244,7 @@ int main(void)
         
         // updates the battery voltage every 2 ms
         if( SecondsSince(&FilterTimer) >= 0.002) {
+            PROFILE_BEGIN(PROF_BATTERY);
             FilterTimer = GetTime();
             raw_voltage = Battery_Voltage();
             if (first_voltage) {
@@ -197,13 +253,15 @@ int main(void)
     	    }
 
             filteredVoltage = Filter_Value(&Battery_Filter, raw_voltage);
+            Motor_PWM_Set_Supply_Voltage(filteredVoltage);	// keep volts->counts scaling current
+            PROFILE_END(PROF_BATTERY);
         }
 
         msg.volt = filteredVoltage;
         
         // checks battery message flag
         if ( MSG_FLAG_Execute( &mf_battery_voltage ) ) {
-            usb_send_msg("cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
+            usb_send_msg_seq(mf_battery_voltage.seq, "cf", 'V', &filteredVoltage, sizeof(filteredVoltage));
             //set variables for future calls
             mf_battery_voltage.last_trigger_time = GetTime();
             if (mf_battery_voltage.duration <= 0){
@@ -225,7 +283,7 @@ int main(void)
 
         // checks if sys_send_info is active - first time
         if (sys_send_info.active && (SecondsSince(&sys_send_info.last_send_time) >= (sys_send_info.t_interval/1000))) {
-            Set_Send_sysData();
+            Set_Send_sysData(NULL);
         }
 
 	    // checks set PWM message flag
@@ -245,11 +303,13 @@ int main(void)
 	    else if (Filter_Last_Output(&Battery_Filter) > 4.75) 		// if voltage is high enough for Motors
 	    {
 	    	Motor_PWM_Enable(1);
+	    	Control_Mode = CONTROL_OFF;	// an open loop duty replaces any running controller or 'z' stream
+	    	Stop_Setpoint_Stream();
 
-		    Set_Motor_Directions(PWM_data.left_PWM, PWM_data.right_PWM);
-	    	
-	    	Motor_PWM_Left(abs(PWM_data.left_PWM));		// set the left motor pwm
-	    	Motor_PWM_Right(abs(PWM_data.right_PWM));	// set the right motor PWM
+	    	PROFILE_BEGIN(PROF_PWM_UPDATE);
+	    	Motor_PWM_Set(PWM_data.left_PWM, PWM_data.right_PWM);	// direction and duty for both motors
+	    	PROFILE_END(PROF_PWM_UPDATE);
+	    	Motor_PWM_Watchdog_Feed(PWM_data.time_limit ? (PWM_data.duration < 60000 ? PWM_data.duration : 60000) : 0);
 
 		    Start_PWM_Timer(PWM_data.time_limit);		// start timer if needed (P call)
 
@@ -266,8 +326,9 @@ int main(void)
             //set variables for future calls
             mf_stop_PWM.last_trigger_time = GetTime();
 	        mf_set_PWM.active = false;
-	        Motor_PWM_Left(0);
-	        Motor_PWM_Right(0);
+	        Control_Mode = CONTROL_OFF;
+	        Stop_Setpoint_Stream();
+	        Motor_PWM_Set(0, 0);
 	        Motor_PWM_Enable(0);
 	        mf_stop_PWM.active = false;
         }
@@ -279,7 +340,7 @@ int main(void)
             if (mf_send_sys.duration > 0) {
                 sys_send_info.active = true;
                 sys_send_info.t_interval = mf_send_sys.duration;
-                Set_Send_sysData();
+                Set_Send_sysData(&mf_send_sys);
             } 
             else sys_send_info.active = false;
 
@@ -289,50 +350,105 @@ int main(void)
 
         // checks if sys_send_info is active - second time
         if (sys_send_info.active && (SecondsSince(&sys_send_info.last_send_time) >= (sys_send_info.t_interval/1000))) {
-            Set_Send_sysData();
+            Set_Send_sysData(NULL);
         }
 
-        // check position mode
+        // checks PWM profile message flag, replies with the profile and its TOP (0 if the profile was invalid)
+        if ( MSG_FLAG_Execute( &mf_pwm_profile ) ) {
+            struct __attribute__((__packed__)) { uint8_t profile; uint16_t top; } profile_msg;
+            profile_msg.top = Motor_PWM_Set_Profile(PWM_data.profile);
+            profile_msg.profile = Get_Motor_PWM_Profile();
+            usb_send_msg_seq(mf_pwm_profile.seq, "cBH", 'f', &profile_msg, sizeof(profile_msg));
+            mf_pwm_profile.active = false;
+        }
+
+        // checks profiler flags, the table goes out one probe per loop pass
+        if ( MSG_FLAG_Execute( &mf_profile_reset ) ) {
+            Profiler_Reset();
+            mf_profile_reset.active = false;
+        }
+        if ( MSG_FLAG_Execute( &mf_profile_dump ) ) {
+            usb_send_set_sequence(mf_profile_dump.seq);
+            mf_profile_dump.active = Profiler_Dump_Next('x');
+            usb_send_set_sequence(-1);
+        }
+
+        // check position mode, the distance is driven from where the wheels are now
         if( MSG_FLAG_Execute( &mf_distance ) )
         {
+            if (Filter_Last_Output(&Battery_Filter) > 4.75) {	// same battery limit as 'p'/'P'
+                Target_Left = Counts_Left() + (distance_data.linear - distance_data.angular * HALF_TRACK) * COUNTS_PER_METER;
+                Target_Right = Counts_Right() + (distance_data.linear + distance_data.angular * HALF_TRACK) * COUNTS_PER_METER;
+                Start_Control(CONTROL_DISTANCE);
+            }
+            Stop_Setpoint_Stream();
+            // a timed 'D' holds the watchdog off for its duration, as a timed 'P' does
+            float hold_ms = distance_data.duration * 1000;
+            Motor_PWM_Watchdog_Feed(hold_ms > 0 ? (hold_ms < 60000 ? hold_ms : 60000) : 0);
+            mf_distance.active = false;
+        }
+
+        // timestamped velocity setpoints and interpolator settings
+        if( MSG_FLAG_Execute( &mf_velocity_stream ) ) {
+            float now = GetTimeSec();
+            Setpoint_Interpolator_Add(&Interp_Linear, velocity_stream.time, velocity_stream.linear, now);
+            Setpoint_Interpolator_Add(&Interp_Angular, velocity_stream.time, velocity_stream.angular, now);
+            Motor_PWM_Watchdog_Feed(0);
+            mf_velocity_stream.active = false;
+        }
+        if( MSG_FLAG_Execute( &mf_interpolator_config ) ) {
+            Setpoint_Interpolator_Limits(&Interp_Linear, interpolator_config.max_accel, interpolator_config.max_jerk,
+                                         interpolator_config.delay, interpolator_config.timeout);
+            Setpoint_Interpolator_Limits(&Interp_Angular, interpolator_config.max_accel, interpolator_config.max_jerk,
+                                         interpolator_config.delay, interpolator_config.timeout);
+            mf_interpolator_config.active = false;
+        }
 
+        // while a 'z' stream runs (and until its output comes to rest) it sets the wheel velocity targets every pass.
+        // The interpolator's own timeout brings a stalled stream to rest, so the watchdog is held off until then.
+        float interp_now = GetTimeSec();
+        float interp_dt = SecondsSince(&Interp_Timer);
+        Interp_Timer = GetTime();
+        if( Setpoint_Interpolator_Active(&Interp_Linear, interp_now) || Setpoint_Interpolator_Active(&Interp_Angular, interp_now) ) {
+            float linear = Setpoint_Interpolator_Update(&Interp_Linear, interp_now, interp_dt);
+            float angular = Setpoint_Interpolator_Update(&Interp_Angular, interp_now, interp_dt);
+            Set_Wheel_Velocity(linear, angular);
+            Motor_PWM_Watchdog_Feed(0);
         }
 
         // check velocity mode
         if( MSG_FLAG_Execute( &mf_velocity ))
         {
-
+            Set_Wheel_Velocity(velocity_data.linear, velocity_data.angular);
+            Stop_Setpoint_Stream();
+            // a timed 'V' holds the watchdog off for its duration, as a timed 'P' does
+            float hold_ms = velocity_data.duration * 1000;
+            Motor_PWM_Watchdog_Feed(hold_ms > 0 ? (hold_ms < 60000 ? hold_ms : 60000) : 0);
+            mf_velocity.active = false;
         }
 
+        Run_Control();
+
+        PROFILE_END(PROF_LOOP);
    }
 }
 
-void Set_Send_sysData()
+void Set_Send_sysData(MSG_FLAG_t* p_request)
 {
+    PROFILE_BEGIN(PROF_TELEMETRY);
     sys_send_info.last_send_time = GetTime();
     sysData.time = SecondsSince(&sys_send_info.start_time);
     sysData.PWM_L = Get_Motor_PWM_Left();
     sysData.PWM_R = Get_Motor_PWM_Right();
     sysData.Encoder_L = Counts_Left();
     sysData.Encoder_R = Counts_Right();
-    usb_send_msg("cf4h", 'q', &sysData, sizeof(sysData));
+    // the frame answering a 'Q' request is a reply, the periodic ones that follow are telemetry
+    if (p_request)
+        usb_send_msg_seq(p_request->seq, "cf4h", 'q', &sysData, sizeof(sysData));
+    else
+        usb_send_telemetry("cf4h", 'q', &sysData, sizeof(sysData));
+    PROFILE_END(PROF_TELEMETRY);
 }
-/**
- * Set_Motor_direction() takes a float value for each motor and depending on their sign (+/-) sets the 
- * motor directions
- * @param left - controls the left direction
- * @param right - controls the right direction
- */
-void Set_Motor_Directions(int16_t left, int16_t right)
-{
-	// set left motor directions - pins pb1 and pb2 control right and left directions - fwd = 0; bwd = 1
-	if (left >= 0) PORTB &= ~(1 << PORTB2);
-	else if (left < 0) PORTB |= (1 << PORTB2);
-	
-	if (right >= 0) PORTB &= ~(1 << PORTB1); 	// set right motor directions
-	else if (right < 0) PORTB |= (1 << PORTB1);
-}
-
 /*
  * Start_PWM_Timer() takes a boolean value to determine if PWM_timer should be active and started
  * @param timer - true if start timer, false if timer not to start
@@ -351,16 +467,106 @@ void Check_PWM_Timer_and_PWR()
 	// if the motor is turned off while running
 	if (((Get_Motor_PWM_Left() > 0) || (Get_Motor_PWM_Right() > 0)) && Filter_Last_Output(&Battery_Filter) < 4.75) {
 		Motor_PWM_Enable(0);
-		Motor_PWM_Left(0);
-		Motor_PWM_Right(0);
+		Motor_PWM_Set(0, 0);
+		PWM_timer_active = false;
+		Control_Mode = CONTROL_OFF;
+	}
+
+	// the command watchdog already braked the motors, forget any running 'P' timer or controller
+	if (Motor_PWM_Watchdog_Tripped()) {
 		PWM_timer_active = false;
+		Control_Mode = CONTROL_OFF;
 	}
 
 	// for the PWM_timer 
 	if ( PWM_timer_active && (SecondsSince(&PWM_timer) >= mf_set_PWM.duration)) {
-	    Motor_PWM_Left(0);			// set the left motor pwm
-	    Motor_PWM_Right(0);			// set the right motor PWM
+	    Motor_PWM_Set(0, 0);			// stop both motors
 	    PWM_timer_active = false;
 	}
 }
 
+/*
+ * Wheel_Controller_Init() sets the gains of one wheel's cascade. The velocity loop feeds forward the inverse of the
+ * 1015 counts/s/V motor gain and puts its integral zero at the 0.06 s motor time constant. The position loop limits
+ * the speed to about 0.4 m/s.
+ * @param p_wheel - cascade to set up
+ */
+void Wheel_Controller_Init(Cascade_Controller_t* p_wheel)
+{
+	PI_Loop_Init(&p_wheel->position, 5, 0, 1, 3000, CONTROL_PERIOD);
+	PI_Loop_Init(&p_wheel->velocity, 0.002, 0.033, 1.0/1015, 5, CONTROL_PERIOD);
+}
+
+/*
+ * Start_Control() switches the wheel controllers to a mode for the targets just set. Starting from off they begin from
+ * rest, otherwise they carry on from their current state so a new setpoint does not jerk the motors.
+ * @param mode - CONTROL_DISTANCE or CONTROL_VELOCITY
+ */
+void Start_Control(Control_Mode_t mode)
+{
+	if (Control_Mode == CONTROL_OFF) {
+		Cascade_Init(&Wheel_Left);
+		Cascade_Init(&Wheel_Right);
+		Last_Counts_Left = Counts_Left();
+		Last_Counts_Right = Counts_Right();
+		Control_Timer = GetTime();
+		Motor_PWM_Enable(1);
+	}
+	Control_Mode = mode;
+}
+
+/*
+ * Run_Control() updates the wheel controllers once every CONTROL_PERIOD while a mode is running and applies their
+ * output in volts
+ */
+void Run_Control()
+{
+	if (Control_Mode == CONTROL_OFF || SecondsSince(&Control_Timer) < CONTROL_PERIOD)
+		return;
+
+	float dt = SecondsSince(&Control_Timer);
+	Control_Timer = GetTime();
+	int32_t counts_left = Counts_Left();
+	int32_t counts_right = Counts_Right();
+	float speed_left = (counts_left - Last_Counts_Left) / dt;
+	float speed_right = (counts_right - Last_Counts_Right) / dt;
+	Last_Counts_Left = counts_left;
+	Last_Counts_Right = counts_right;
+
+	// the velocity loops saturate at what the battery can give, so clamping stops the integral where the PWM does
+	Wheel_Left.velocity.out_max = Filter_Last_Output(&Battery_Filter);
+	Wheel_Right.velocity.out_max = Wheel_Left.velocity.out_max;
+
+	float volts_left, volts_right;
+	if (Control_Mode == CONTROL_DISTANCE) {
+		volts_left = Cascade_Update(&Wheel_Left, Target_Left, 0, counts_left, speed_left);
+		volts_right = Cascade_Update(&Wheel_Right, Target_Right, 0, counts_right, speed_right);
+	} else {
+		volts_left = Cascade_Update_Velocity(&Wheel_Left, Target_Left, speed_left);
+		volts_right = Cascade_Update_Velocity(&Wheel_Right, Target_Right, speed_right);
+	}
+	Motor_Voltage_Set(volts_left, volts_right);
+}
+
+/*
+ * Set_Wheel_Velocity() runs the wheel velocity loops towards a linear (m/s) and angular (rad/s, positive turns left)
+ * velocity, if the battery is high enough for the motors (the same limit as 'p'/'P')
+ */
+void Set_Wheel_Velocity(float linear, float angular)
+{
+	if (Filter_Last_Output(&Battery_Filter) <= 4.75)
+		return;
+
+	Target_Left = (linear - angular * HALF_TRACK) * COUNTS_PER_METER;
+	Target_Right = (linear + angular * HALF_TRACK) * COUNTS_PER_METER;
+	Start_Control(CONTROL_VELOCITY);
+}
+
+/*
+ * Stop_Setpoint_Stream() drops any 'z' stream so it does not take the motors back from the command that replaced it
+ */
+void Stop_Setpoint_Stream()
+{
+	Setpoint_Interpolator_Reset(&Interp_Linear, 0);
+	Setpoint_Interpolator_Reset(&Interp_Angular, 0);
+}
@@ -0,0 +1,380 @@
+#!/usr/bin/env python
+
+'''
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+'''
+
+'''
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+'''
+
+'''
+    Binary recording format used by RecordData.
+
+    A log is a header followed by a stream of entries. Every entry starts with a one byte tag:
+        tag 0      schema definition:  uint8 schema id (1-255), uint8 format length, format (ascii, python struct
+                   codes as sent by the zumo, without the leading '<')
+        tag 1-255  record of that schema: float64 host time (time.perf_counter), then the message bytes exactly as
+                   they came off the serial port, struct.calcsize('<'+format) long
+
+    Schemas known up front are written right after the header; a message with a new format gets its definition
+    written inline before its first record, so a log can be read back however it was cut off. Records of one schema
+    all have the same size, so the reader only needs the tag to step from one entry to the next.
+
+    Everything is little endian, matching the zumo.
+
+    Run as a script to convert a log:
+        python binary_log.py capture.m540log                 -> capture.csv (same layout the old text recorder wrote)
+        python binary_log.py capture.m540log -o out.csv -c q -> only the 'q' messages
+        python binary_log.py capture.m540log --npz out.npz   -> one structured array per schema (needs numpy)
+        python binary_log.py capture.m540log --info          -> schemas and record counts
+'''
+
+import mmap
+import os
+import struct
+import sys
+
+LOG_MAGIC = b'MEGN540L'
+LOG_VERSION = 1
+LOG_EXTENSION = '.m540log'
+
+_HEADER = struct.Struct('<8sHH')   # magic, version, reserved
+_SCHEMA = struct.Struct('<BBB')    # tag (0), schema id, format length
+_RECORD = struct.Struct('<Bd')     # schema id, host time
+
+_plan_cache = {}
+
+
+def decodePlan(fmt):
+    '''Splits a struct format (without '<') into (kind, count) steps for decodeValues. Runs of 'c' become one string,
+       's' is decoded to a string, everything else passes through. Plans are cached per format.'''
+    plan = _plan_cache.get(fmt)
+    if plan is not None:
+        return plan
+
+    plan = []
+    count = ''
+    for code in fmt:
+        if code.isdigit():
+            count += code
+            continue
+        n = int(count) if count else 1
+        count = ''
+        if code == 'c':
+            plan.append(('c', n))
+        elif code == 's':
+            plan.append(('s', 1))
+        elif code == 'x':
+            continue
+        elif plan and plan[-1][0] == 'v':
+            plan[-1] = ('v', plan[-1][1] + n)
+        else:
+            plan.append(('v', n))
+
+    plan = tuple(plan)
+    _plan_cache[fmt] = plan
+    return plan
+
+
+def decodeValues(fmt, values):
+    '''Turns the tuple struct.unpack returns into the list SerialData callbacks receive: chars and strings decoded
+       to str (a run like '3c' joined into one), numbers unchanged.'''
+    data = []
+    ind = 0
+    for kind, n in decodePlan(fmt):
+        if kind == 'v':
+            data.extend(values[ind:ind + n])
+        elif kind == 'c':
+            data.append(b''.join(values[ind:ind + n]).decode('ascii', 'replace'))
+        else:
+            data.append(values[ind].decode('ascii', 'replace'))
+        ind += n
+    return data
+
+
+class BinaryLogWriter:
+    '''Streams records to a log through a large write buffer. Not thread safe, callers serialize writes.'''
+
+    def __init__(self, filename, schemas=(), buffer_size=1 << 20):
+        self.filename = filename
+        self.schema_ids = {}
+        self.record_size = {}
+        self.records = 0
+        self.file = open(filename, 'wb', buffering=buffer_size)
+        self.file.write(_HEADER.pack(LOG_MAGIC, LOG_VERSION, 0))
+        for fmt in schemas:
+            self.addSchema(fmt)
+
+    def addSchema(self, fmt):
+        schema_id = self.schema_ids.get(fmt)
+        if schema_id is not None:
+            return schema_id
+
+        if len(self.schema_ids) >= 255:
+            raise ValueError('binary log supports at most 255 message formats')
+
+        encoded = fmt.encode('ascii')
+        size = struct.calcsize('<' + fmt)  # raises struct.error on bad formats before anything is written
+        if len(encoded) > 255:
+            raise ValueError('message format too long: ' + fmt)
+
+        schema_id = len(self.schema_ids) + 1
+        self.file.write(_SCHEMA.pack(0, schema_id, len(encoded)) + encoded)
+        self.schema_ids[fmt] = schema_id
+        self.record_size[schema_id] = size
+        return schema_id
+
+    def write(self, fmt, payload, timestamp):
+        '''Appends one message. payload is the raw message (bytes-like) and must match fmt's size.'''
+        schema_id = self.schema_ids.get(fmt)
+        if schema_id is None:
+            schema_id = self.addSchema(fmt)
+        if len(payload) != self.record_size[schema_id]:
+            raise ValueError('payload size does not match format ' + fmt)
+
+        self.file.write(_RECORD.pack(schema_id, timestamp))
+        self.file.write(payload)
+        self.records += 1
+
+    def flush(self):
+        self.file.flush()
+
+    def close(self):
+        if not self.file.closed:
+            self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+class BinaryLogReader:
+    '''Memory maps a log so captures larger than RAM can be walked or converted. A record cut short at the end of the
+       file (e.g. the recorder was killed) is ignored.'''
+
+    def __init__(self, filename):
+        self.filename = filename
+        self.file = open(filename, 'rb')
+        size = os.fstat(self.file.fileno()).st_size
+        if size < _HEADER.size:
+            self.file.close()
+            raise ValueError(filename + ' is not a MEGN540 binary log')
+
+        self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, self.version, _ = _HEADER.unpack_from(self.map, 0)
+        if magic != LOG_MAGIC or self.version > LOG_VERSION:
+            self.close()
+            raise ValueError(filename + ' is not a MEGN540 binary log (or is from a newer version)')
+
+        self.schemas = {}    # schema id -> format
+        self.structs = {}    # schema id -> struct.Struct of the message
+        self._index = None
+
+    def close(self):
+        if self.map is not None:
+            self.map.close()
+            self.map = None
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def _defineSchema(self, schema_id, fmt):
+        self.schemas[schema_id] = fmt
+        self.structs[schema_id] = struct.Struct('<' + fmt)
+
+    def entries(self):
+        '''Yields (schema id, host time, payload offset) for every complete record, in file order.'''
+        buf = self.map
+        end = len(buf)
+        pos = _HEADER.size
+        structs = self.structs
+        record_unpack = _RECORD.unpack_from
+        record_size = _RECORD.size
+
+        while pos < end:
+            tag = buf[pos]
+            if tag == 0:
+                if pos + _SCHEMA.size > end:
+                    return
+                _, schema_id, length = _SCHEMA.unpack_from(buf, pos)
+                pos += _SCHEMA.size
+                if pos + length > end:
+                    return
+                if schema_id not in structs:
+                    self._defineSchema(schema_id, bytes(buf[pos:pos + length]).decode('ascii'))
+                pos += length
+                continue
+
+            msg = structs.get(tag)
+            if msg is None:
+                raise ValueError('record of undefined schema %d at offset %d' % (tag, pos))
+            if pos + record_size + msg.size > end:
+                return
+            _, t = record_unpack(buf, pos)
+            pos += record_size
+            yield tag, t, pos
+            pos += msg.size
+
+    def records(self, cmd=None):
+        '''Yields (host time, format, values) with values decoded as SerialData hands them to callbacks. cmd limits
+           the output to messages whose first field is that command character.'''
+        for schema_id, t, offset in self.entries():
+            msg = self.structs[schema_id]
+            fmt = self.schemas[schema_id]
+            if cmd is not None and (not fmt.startswith('c') or chr(self.map[offset]) != cmd):
+                continue
+            yield t, fmt, decodeValues(fmt, msg.unpack_from(self.map, offset))
+
+    def index(self):
+        '''Offsets of every record per schema id, built by one pass over the file and kept.'''
+        if self._index is None:
+            index = {}
+            for schema_id, _, offset in self.entries():
+                index.setdefault(schema_id, []).append(offset)
+            self._index = index
+        return self._index
+
+    def counts(self):
+        return {self.schemas[k]: len(v) for k, v in self.index().items()}
+
+    def toCSV(self, out, cmd=None):
+        '''Writes "host_time, value, value, ..." lines, the layout the text recorder produced. out is a file name or an
+           open text file. Returns the number of rows.'''
+        close = False
+        if isinstance(out, str):
+            out = open(out, 'w', buffering=1 << 20)
+            close = True
+
+        rows = 0
+        lines = []
+        try:
+            for t, _, values in self.records(cmd):
+                lines.append(str(t) + ', ' + ', '.join(map(str, values)) + '\n')
+                if len(lines) >= 4096:
+                    out.writelines(lines)
+                    rows += len(lines)
+                    lines = []
+            out.writelines(lines)
+            rows += len(lines)
+        finally:
+            if close:
+                out.close()
+        return rows
+
+    def toNumpy(self):
+        '''Returns {format: structured array} with a 'time' field followed by one field per format code ('f0', 'f1',
+           ...). Counted codes stay one field: a string for '3c', a sub-array for '4h'. Records are gathered with one
+           fancy-index copy per schema.'''
+        import numpy as np  # optional dependency, only needed here
+
+        buf = np.frombuffer(self.map, dtype=np.uint8)
+        result = {}
+        for schema_id, offsets in self.index().items():
+            fmt = self.schemas[schema_id]
+            dtype = numpyDtype(fmt)
+            offsets = np.asarray(offsets, dtype=np.int64)
+            size = self.structs[schema_id].size
+
+            times = buf[(offsets - 8)[:, None] + np.arange(8)].copy().view('<f8').reshape(-1)
+            payload = buf[offsets[:, None] + np.arange(size)].copy().view(dtype).reshape(-1)
+
+            out = np.empty(len(offsets), dtype=[('time', '<f8')] + [(n, payload.dtype.fields[n][0])
+                                                                   for n in payload.dtype.names])
+            out['time'] = times
+            for name in payload.dtype.names:
+                out[name] = payload[name]
+            result[fmt] = out
+        return result
+
+
+_NUMPY_CODES = {'c': 'S1', 'b': 'i1', 'B': 'u1', '?': '?', 'h': '<i2', 'H': '<u2', 'i': '<i4', 'I': '<u4',
+                'l': '<i4', 'L': '<u4', 'q': '<i8', 'Q': '<u8', 'e': '<f2', 'f': '<f4', 'd': '<f8'}
+
+
+def numpyDtype(fmt):
+    '''Packed numpy dtype matching struct.Struct('<'+fmt).'''
+    import numpy as np
+
+    fields = []
+    count = ''
+    for code in fmt:
+        if code.isdigit():
+            count += code
+            continue
+        n = int(count) if count else 1
+        count = ''
+        name = 'f%d' % len(fields)
+        if code == 'x':
+            fields.append((name, 'V%d' % n))
+        elif code == 's':
+            fields.append((name, 'S%d' % n))
+        elif code == 'c' and n > 1:
+            fields.append((name, 'S%d' % n))
+        elif n > 1:
+            fields.append((name, _NUMPY_CODES[code], (n,)))
+        else:
+            fields.append((name, _NUMPY_CODES[code]))
+    return np.dtype(fields)
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description='Convert a MEGN540 binary log to CSV or NumPy.')
+    parser.add_argument('log', help='binary log recorded by the serial monitor')
+    parser.add_argument('-o', '--output', help='CSV file to write (default: log name with .csv)')
+    parser.add_argument('-c', '--cmd', help='only convert messages with this command character')
+    parser.add_argument('--npz', help='write a numpy .npz with one structured array per format instead of CSV')
+    parser.add_argument('--info', action='store_true', help='print the formats and record counts and exit')
+    args = parser.parse_args(argv)
+
+    with BinaryLogReader(args.log) as log:
+        if args.info:
+            for fmt, n in log.counts().items():
+                print('%-20s %d' % (fmt, n))
+            return 0
+
+        if args.npz:
+            import numpy as np
+            arrays = log.toNumpy()
+            np.savez(args.npz, **{'schema%d_%s' % (i, fmt): a for i, (fmt, a) in enumerate(arrays.items())})
+            print('wrote %d formats to %s' % (len(arrays), args.npz))
+            return 0
+
+        output = args.output or os.path.splitext(args.log)[0] + '.csv'
+        rows = log.toCSV(output, args.cmd)
+        print('wrote %d rows to %s' % (rows, output))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,219 @@
+#!/usr/bin/env python
+
+'''
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+'''
+
+'''
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+'''
+
+'''
+    Headless command script runner. Plays the same command CSV files the serial monitor's "Load CSV Commands" button
+    takes (one command per line: format, value, value, ...), but schedules every command against an absolute
+    deadline on the monotonic clock, so a late command does not push the rest of the run back. Everything the zumo
+    sends while the script runs is written to a binary log (see binary_log.py) and the achieved command times are
+    compared with the requested ones.
+
+        python experiment_runner.py -p /dev/ttyZumoCar -d 510 Lab5_cmds.csv
+        python experiment_runner.py -d 10 -r 20 -s 2 sys_id_file.csv step_test.csv   (unattended batch)
+
+    With --timed the first column of every line is the time in seconds from the start of the run instead of using a
+    fixed spacing. Each run writes <script>[_<repeat>].m540log next to the script (or into --out-dir) and, with
+    --timing, a CSV of requested versus sent time per command.
+'''
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import time
+
+import binary_log
+import serial_monitor_lib
+
+
+def parseValue(code, text):
+    text = "".join(text.split())
+    if code in 'cs':
+        return text.encode('ascii')
+    if code in 'efd':
+        return float(text)
+    return int(text, 0)
+
+
+def packCommand(fmt, values):
+    # fmt may use repeat counts ('c3f'); every value gets its own column except 's' strings
+    codes = []
+    count = ''
+    for code in fmt:
+        if code.isdigit():
+            count += code
+            continue
+        n = int(count) if count else 1
+        count = ''
+        if code == 's':
+            codes.append('s')
+        elif code != 'x':
+            codes.extend(code * n)
+    if len(codes) != len(values):
+        raise ValueError("format " + fmt + " needs " + str(len(codes)) + " values, got " + str(len(values)))
+    return struct.pack('<' + fmt, *[parseValue(c, v) for c, v in zip(codes, values)])
+
+
+def loadScript(filename, delay, timed):
+    # returns [(offset seconds, packed message, text)] in send order
+    commands = []
+    with open(filename, newline='') as csvfile:
+        for line_number, row in enumerate(csv.reader(csvfile, delimiter=','), 1):
+            row = [e.strip() for e in row]
+            if not row or not row[0] or row[0].startswith('#'):
+                continue
+            try:
+                if timed:
+                    offset = float(row[0])
+                    row = row[1:]
+                else:
+                    offset = len(commands) * delay
+                commands.append((offset, packCommand(row[0], row[1:]), ",".join(row)))
+            except (ValueError, struct.error, IndexError) as e:
+                raise ValueError(filename + ":" + str(line_number) + ": " + str(e))
+
+    if timed:
+        commands.sort(key=lambda c: c[0])
+    return commands
+
+
+def waitUntil(deadline):
+    # sleeps most of the way, then spins the last millisecond; sleep alone overshoots by the scheduler tick
+    while True:
+        remaining = deadline - time.perf_counter()
+        if remaining <= 0:
+            return
+        if remaining > 0.002:
+            time.sleep(remaining - 0.001)
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    return sorted_values[min(len(sorted_values) - 1, int(p / 100.0 * len(sorted_values)))]
+
+
+def runScript(serial_data, commands, log_name, settle):
+    # returns ([(requested time, sent time)] relative to the start of the run, number of messages logged)
+    writer = binary_log.BinaryLogWriter(log_name)
+
+    def record(batch):
+        for (timestamp, fmt, raw, _) in batch:
+            writer.write(fmt, raw, timestamp)
+
+    serial_data.registerBatchCallback(record, maxlen=None)
+    sent = []
+    try:
+        start = time.perf_counter() + 0.05 # first deadline a little ahead so it is not already late
+        for (offset, msg, _) in commands:
+            waitUntil(start + offset)
+            ok, err = serial_data.writeBytes(msg)
+            sent.append((offset, time.perf_counter() - start))
+            if not ok:
+                raise IOError(err)
+        waitUntil(time.perf_counter() + settle)
+    finally:
+        serial_data.removeBatchCallback(record) # returns once everything received is written
+        writer.close()
+    return sent, writer.records
+
+
+def report(name, sent, records):
+    lateness = sorted((actual - requested) * 1000.0 for requested, actual in sent)
+    intervals = [(sent[i][1] - sent[i - 1][1]) - (sent[i][0] - sent[i - 1][0]) for i in range(1, len(sent))]
+    jitter = (sum(d * d for d in intervals) / len(intervals)) ** 0.5 * 1000.0 if intervals else 0.0
+    print("%s: %d commands, %d messages received" % (name, len(sent), records))
+    print("    send lateness [ms]  mean %.3f  p50 %.3f  p99 %.3f  max %.3f" % (
+        sum(lateness) / len(lateness), percentile(lateness, 50), percentile(lateness, 99), lateness[-1]))
+    print("    interval error rms [ms] %.3f" % jitter)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Run serial command scripts without the GUI.')
+    parser.add_argument('scripts', nargs='+', help='command CSV files (format, value, ...) run one after another')
+    parser.add_argument('-p', '--port', default='/dev/ttyZumoCar')
+    parser.add_argument('-b', '--baud', type=int, default=256000)
+    parser.add_argument('-d', '--delay', type=float, default=500.0, help='milliseconds between commands')
+    parser.add_argument('--timed', action='store_true', help='first column is the send time in seconds')
+    parser.add_argument('-r', '--repeat', type=int, default=1, help='run every script this many times')
+    parser.add_argument('-s', '--settle', type=float, default=1.0,
+                        help='seconds to keep recording after the last command')
+    parser.add_argument('-o', '--out-dir', help='directory for the logs (default: next to each script)')
+    parser.add_argument('--timing', action='store_true', help='also write <log>_timing.csv')
+    args = parser.parse_args(argv)
+
+    try:
+        scripts = [(name, loadScript(name, args.delay / 1000.0, args.timed)) for name in args.scripts]
+    except (IOError, ValueError) as e:
+        print(e)
+        return 1
+
+    serial_data = serial_monitor_lib.SerialData()
+    serial_data.setDataFormat("Dynamic")
+    serial_data.openPort(args.port, args.baud)
+    if not serial_data.isConnected():
+        return 1
+
+    try:
+        for name, commands in scripts:
+            for repeat in range(args.repeat):
+                base = os.path.splitext(name)[0]
+                if args.out_dir:
+                    base = os.path.join(args.out_dir, os.path.basename(base))
+                if args.repeat > 1:
+                    base += "_" + str(repeat)
+                log_name = base + binary_log.LOG_EXTENSION
+
+                sent, records = runScript(serial_data, commands, log_name, args.settle)
+                report(log_name, sent, records)
+
+                if args.timing:
+                    with open(base + "_timing.csv", 'w') as timing:
+                        timing.write("command, requested_s, sent_s, late_ms\n")
+                        for (requested, actual), (_, _, text) in zip(sent, commands):
+                            timing.write('"%s", %.6f, %.6f, %.3f\n' % (text, requested, actual,
+                                                                       (actual - requested) * 1000.0))
+
+                if not serial_data.isConnected():
+                    print("Connection lost, stopping")
+                    return 1
+    except KeyboardInterrupt:
+        print("Interrupted")
+        return 1
+    finally:
+        serial_data.close(on_shutdown=True)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,226 @@
+#!/usr/bin/env python
+
+'''
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+'''
+
+'''
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+'''
+
+'''
+    Round trip latency benchmark using the Lab 1 arithmetic commands ('+', '-', '*', '/'), which every lab firmware
+    answers with a "cf" message carrying the command and the result. The request number is the first operand and the
+    second one leaves it unchanged (x+0, x-0, x*1, x/1), so each reply names the request it answers even when replies
+    are lost; numbers stay exact in a float up to 2^24 requests.
+
+        python latency_bench.py -p /dev/ttyZumoCar -n 10000 -w 1            serialized ping
+        python latency_bench.py -n 100000 -w 16 -r 2000 --mix "+:3,*:1"     pipelined at 2000 requests/s
+        python latency_bench.py --virtual -n 20000 -w 8                      against ../Host/virtual_zumo
+
+    -w is the number of requests in flight (1 waits for each reply before sending the next). -r spaces the requests
+    on absolute deadlines; without it they go out as fast as the window allows. A request not answered within
+    --timeout seconds counts as lost. Round trip times run from just before the write to the reply being parsed, so
+    they include the host's serial stack on both sides. --fail-p99 and --fail-loss turn the report into a pass/fail
+    check for catching regressions in USB_Upkeep_Task or Message_Handling_Task.
+'''
+
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+import serial_monitor_lib
+from experiment_runner import percentile, waitUntil
+
+# command -> second operand that returns the first unchanged
+IDENTITY = {'+': 0.0, '-': 0.0, '*': 1.0, '/': 1.0}
+VIRTUAL_ZUMO = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'Host', 'virtual_zumo')
+
+
+class EchoBench:
+    def __init__(self, serial_data, window, timeout):
+        self.serial_data = serial_data
+        self.window = window
+        self.timeout = timeout
+        self.pending = {}       # (command, request number) -> send time
+        self.rtts = []          # seconds, in reply order
+        self.lost = 0
+        self.unmatched = 0
+        self.last_reply = None
+        self.condition = threading.Condition()
+
+    def onBatch(self, batch):
+        with self.condition:
+            for (timestamp, fmt, _, values) in batch:
+                if fmt != 'cf' or values[0] not in IDENTITY:
+                    continue
+                sent = self.pending.pop((values[0], int(values[1])), None)
+                if sent is None:
+                    self.unmatched += 1 # late reply to a request already counted lost, or a stray message
+                    continue
+                self.rtts.append(timestamp - sent)
+                self.last_reply = timestamp
+            self.condition.notify_all()
+
+    def expire(self, now):
+        # call with the condition held
+        for key in [k for k, sent in self.pending.items() if now - sent > self.timeout]:
+            del self.pending[key]
+            self.lost += 1
+
+    def run(self, count, rate, mix):
+        commands = [c for c, weight in mix for _ in range(weight)]
+        messages = [struct.pack('<cff', c.encode(), float(i), IDENTITY[c])
+                    for i, c in ((i, random.choice(commands)) for i in range(count))]
+
+        start = time.perf_counter()
+        for i, msg in enumerate(messages):
+            if rate:
+                waitUntil(start + i / rate)
+            with self.condition:
+                while len(self.pending) >= self.window:
+                    if not self.condition.wait(self.timeout):
+                        self.expire(time.perf_counter())
+                # stamped before the write: the parser stamps replies on arrival, possibly before write() returns
+                self.pending[(chr(msg[0]), i)] = time.perf_counter()
+                ok, err = self.serial_data.writeBytes(msg)
+            if not ok:
+                raise IOError(err)
+        sent_end = time.perf_counter()
+
+        with self.condition:
+            deadline = time.perf_counter() + self.timeout
+            while self.pending and time.perf_counter() < deadline:
+                self.condition.wait(deadline - time.perf_counter())
+            self.expire(float('inf'))
+        return start, sent_end
+
+
+def parseMix(text):
+    mix = []
+    for item in text.split(','):
+        command, _, weight = item.strip().partition(':')
+        if command not in IDENTITY:
+            raise ValueError("unknown command in mix: " + command)
+        mix.append((command, int(weight) if weight else 1))
+    return mix
+
+
+def startVirtual(link):
+    process = subprocess.Popen([VIRTUAL_ZUMO, '-L', link], stdout=subprocess.DEVNULL)
+    for _ in range(100):
+        if os.path.exists(link):
+            return process
+        time.sleep(0.05)
+    process.terminate()
+    raise IOError("virtual_zumo did not start, build it with make -C Host virtual_zumo")
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Round trip latency benchmark using the arithmetic echo commands.')
+    parser.add_argument('-p', '--port', default='/dev/ttyZumoCar')
+    parser.add_argument('-b', '--baud', type=int, default=256000)
+    parser.add_argument('--virtual', action='store_true', help='start ../Host/virtual_zumo and benchmark it')
+    parser.add_argument('-n', '--count', type=int, default=10000, help='requests to send')
+    parser.add_argument('-w', '--window', type=int, default=1, help='requests in flight')
+    parser.add_argument('-r', '--rate', type=float, default=0, help='requests per second (0: as fast as possible)')
+    parser.add_argument('--mix', default='+:1,-:1,*:1,/:1', help='command weights, e.g. "+:3,*:1"')
+    parser.add_argument('--timeout', type=float, default=1.0, help='seconds before a request counts as lost')
+    parser.add_argument('--seed', type=int, default=540)
+    parser.add_argument('--csv', help='write every round trip time [ms] to this file')
+    parser.add_argument('--fail-p99', type=float, help='exit 1 if the p99 round trip exceeds this many ms')
+    parser.add_argument('--fail-loss', type=float, help='exit 1 if more than this fraction of requests is lost')
+    args = parser.parse_args(argv)
+
+    if args.count <= 0 or args.count > 1 << 24 or args.window <= 0:
+        print("count must be 1 to 2^24 and window at least 1")
+        return 2
+    try:
+        mix = parseMix(args.mix)
+    except ValueError as e:
+        print(e)
+        return 2
+    random.seed(args.seed)
+
+    virtual = None
+    port = args.port
+    if args.virtual:
+        port = '/tmp/ttyZumoCarBench%d' % os.getpid()
+        virtual = startVirtual(port)
+
+    serial_data = serial_monitor_lib.SerialData()
+    serial_data.setDataFormat("Dynamic")
+    try:
+        serial_data.openPort(port, args.baud)
+        if not serial_data.isConnected():
+            return 1
+        time.sleep(0.2) # let the reader flush whatever the device sent before we connected
+
+        bench = EchoBench(serial_data, args.window, args.timeout)
+        serial_data.registerBatchCallback(bench.onBatch, maxlen=None)
+        start, sent_end = bench.run(args.count, args.rate, mix)
+        serial_data.removeBatchCallback(bench.onBatch)
+    finally:
+        serial_data.close(on_shutdown=True)
+        if virtual is not None:
+            virtual.terminate()
+            virtual.wait()
+
+    rtts = sorted(t * 1000.0 for t in bench.rtts)
+    received = len(rtts)
+    elapsed = (bench.last_reply or sent_end) - start
+    print("%d requests, window %d, %s" % (args.count, args.window,
+                                          ("%.0f/s requested" % args.rate) if args.rate else "unpaced"))
+    print("    received %d  lost %d (%.3f%%)  unmatched %d" % (received, bench.lost, 100.0 * bench.lost / args.count,
+                                                              bench.unmatched))
+    print("    throughput %.0f replies/s  send rate %.0f requests/s" % (received / elapsed,
+                                                                       args.count / (sent_end - start)))
+    if rtts:
+        print("    rtt [ms]  min %.3f  p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f  mean %.3f" % (
+            rtts[0], percentile(rtts, 50), percentile(rtts, 99), percentile(rtts, 99.9), rtts[-1],
+            sum(rtts) / received))
+
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            f.write("rtt_ms\n")
+            f.writelines("%.6f\n" % (t * 1000.0) for t in bench.rtts)
+
+    failed = False
+    if args.fail_p99 is not None and (not rtts or percentile(rtts, 99) > args.fail_p99):
+        print("FAIL: p99 above %.3f ms" % args.fail_p99)
+        failed = True
+    if args.fail_loss is not None and bench.lost > args.fail_loss * args.count:
+        print("FAIL: loss above %.3f%%" % (100.0 * args.fail_loss))
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
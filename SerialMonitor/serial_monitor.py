@@ -61,7 +61,7 @@ class GuiSetup:
 
         # Setup Serial Object
         self.serial_object = serial_monitor_lib.SerialData()
-        self.serial_object.registerCallback(self.addValue)
+        self.serial_object.registerBatchCallback(self.addValues)
         
         self.serial_data_lock = Lock()
         self.serial_data = collections.deque()
@@ -240,6 +240,11 @@ class GuiSetup:
         self.serial_data.append(value)
         self.serial_data_lock.release()
 
+    def addValues(self, batch):
+        self.serial_data_lock.acquire()
+        self.serial_data.extend(message[3] for message in batch)
+        self.serial_data_lock.release()
+
     def connectToSerial(self):
         """The function initiates the Connection to the UART device with the Port and Buad fed through the Entry
         boxes in the application.
@@ -388,7 +393,7 @@ class GuiSetup:
     def plotWindowOpenClose(self):
         if self.plotObject is None and self.serial_object.isConnected():
             self.plotObject = serial_monitor_lib.RealTimePlot()
-            self.serial_object.registerCallback(self.plotObject.addValue)
+            self.serial_object.registerBatchCallback(self.plotObject.addBatch, maxlen=self.plotObject.capacity, interval=self.plotObject.pltInterval/1000.0)
             self.plotObject.Start(self.gui)
             self.plot_select.config(state='enabled')
             self.graphing.configure(text="Close Plot")
@@ -396,7 +401,7 @@ class GuiSetup:
             
         elif self.plotObject is not None:
             self.plotObject.close()
-            self.serial_object.removeCallback(self.plotObject.addValue)
+            self.serial_object.removeBatchCallback(self.plotObject.addBatch)
             self.plotObject = None
             self.plot_select.config(state='disabled')
             self.graphing.configure(text="Open Plot")
@@ -406,12 +411,12 @@ class GuiSetup:
     def dataRecordingStartStop(self):
         if self.recordObject is None and self.serial_object.isConnected():
             self.recordObject = serial_monitor_lib.RecordData()
-            self.serial_object.registerCallback(self.recordObject.addData)
+            self.serial_object.registerBatchCallback(self.recordObject.addBatch, maxlen=None) # lossless
             self.recordObject.startRecording()
             self.recording.configure(text="Stop Recording")
         elif self.recordObject is not None:
+            self.serial_object.removeBatchCallback(self.recordObject.addBatch) # returns once the queue is written
             self.recordObject.stopRecording()
-            self.serial_object.removeCallback(self.recordObject.addData)
             self.recordObject.saveData()
             self.recordObject = None
             self.recording.configure(text="Start Recording")
@@ -61,6 +61,7 @@ class GuiSetup:
         self.game_pad = gpi.MEGN540_GamePadInterface()
         self.game_pad.connect()
         self.game_pad_timeout = 0.5
+        self.game_pad_time0 = time.perf_counter() # 'z' time stamps count from here so they stay precise as floats
         self.game_pad_last_send_info = [None, 0 ,0]
         
         # Contact Info
@@ -71,7 +72,7 @@ class GuiSetup:
 
         # Setup Serial Object
         self.serial_object = serial_monitor_lib.SerialData()
-        self.serial_object.registerCallback(self.addValue)
+        self.serial_object.registerBatchCallback(self.addValues)
         
         self.serial_data_lock = Lock()
         self.serial_data = collections.deque()
@@ -250,6 +251,11 @@ class GuiSetup:
         self.serial_data.append(value)
         self.serial_data_lock.release()
 
+    def addValues(self, batch):
+        self.serial_data_lock.acquire()
+        self.serial_data.extend(message[3] for message in batch)
+        self.serial_data_lock.release()
+
     def connectToSerial(self):
         """The function initiates the Connection to the UART device with the Port and Buad fed through the Entry
         boxes in the application.
@@ -347,7 +353,7 @@ class GuiSetup:
             self.plotWindowOpenClose() #will disconnect the grap and call close and change buttons etc
             
         # TODO:  Add enable gamepad button/call?    
-        if( self.game_pad_last_send_info[0] and (time.perf_counter()-self.game_pad_last_send_info[0]) > self.game_pad_timeout/2 and self.data_entry[0].get() is 'V' ):
+        if( self.game_pad_last_send_info[0] and (time.perf_counter()-self.game_pad_last_send_info[0]) > self.game_pad_timeout/2 and self.data_entry[0].get() == 'z' ):
             self.GamePadCallback(self.game_pad_last_send_info[1],self.game_pad_last_send_info[2]) # resend command before timeout
             
             
@@ -410,7 +416,7 @@ class GuiSetup:
     def plotWindowOpenClose(self):
         if self.plotObject is None and self.serial_object.isConnected():
             self.plotObject = serial_monitor_lib.RealTimePlot()
-            self.serial_object.registerCallback(self.plotObject.addValue)
+            self.serial_object.registerBatchCallback(self.plotObject.addBatch, maxlen=self.plotObject.capacity, interval=self.plotObject.pltInterval/1000.0)
             self.plotObject.Start(self.gui)
             self.plot_select.config(state='enabled')
             self.graphing.configure(text="Close Plot")
@@ -418,7 +424,7 @@ class GuiSetup:
             
         elif self.plotObject is not None:
             self.plotObject.close()
-            self.serial_object.removeCallback(self.plotObject.addValue)
+            self.serial_object.removeBatchCallback(self.plotObject.addBatch)
             self.plotObject = None
             self.plot_select.config(state='disabled')
             self.graphing.configure(text="Open Plot")
@@ -428,12 +434,12 @@ class GuiSetup:
     def dataRecordingStartStop(self):
         if self.recordObject is None and self.serial_object.isConnected():
             self.recordObject = serial_monitor_lib.RecordData()
-            self.serial_object.registerCallback(self.recordObject.addData)
+            self.serial_object.registerBatchCallback(self.recordObject.addBatch, maxlen=None) # lossless
             self.recordObject.startRecording()
             self.recording.configure(text="Stop Recording")
         elif self.recordObject is not None:
+            self.serial_object.removeBatchCallback(self.recordObject.addBatch) # returns once the queue is written
             self.recordObject.stopRecording()
-            self.serial_object.removeCallback(self.recordObject.addData)
             self.recordObject.saveData()
             self.recordObject = None
             self.recording.configure(text="Start Recording")
@@ -504,10 +510,11 @@ class GuiSetup:
             for e in self.data_entry:
                 e.delete(0,'end')
             
-            self.data_entry[0].insert(END,"V")
-            self.data_entry[1].insert(END,str(lin_vel))
-            self.data_entry[2].insert(END,str(ang_vel))
-            self.data_entry[3].insert(END,0.5) #Half second timeout
+            # timestamped setpoint, the robot interpolates between them (and stops if they stop for half a second)
+            self.data_entry[0].insert(END,"z")
+            self.data_entry[1].insert(END,str(time.perf_counter() - self.game_pad_time0))
+            self.data_entry[2].insert(END,str(lin_vel))
+            self.data_entry[3].insert(END,str(ang_vel))
 
             self.game_pad_last_send_info = [ time.perf_counter(), lin_vel, ang_vel]
             
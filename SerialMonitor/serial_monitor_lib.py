@@ -35,30 +35,117 @@ from tkinter import filedialog
 from tkinter import *
 
 # FOR THREADING AND MUTEX PROTECTION (used in serial interface primarily) 
-from threading import Thread, Lock
+from threading import Thread, Lock, Event
 import collections  # FOR DEQUEUE USED IN DATA STORAGE AND CALLBACK QUEUES
+import concurrent.futures # FOR SEQUENCED REQUESTS
 
 # FOR SERIAL COMMUNICATIONS
 import serial # FOR SERIAL INTERFACE
 import struct # FOR BINARY DATA INTERFACING
 import time   # FOR TIME STAMPING DATA
 
+# FOR RECORDING
+import os
+import shutil
+import tempfile
+import binary_log
+
 
 
 # FOR REALTIME PLOT
-import matplotlib.pyplot as plt 
-import matplotlib.animation as animation
+import numpy as np
+from matplotlib.figure import Figure
 from matplotlib.backends.backend_tkagg import(FigureCanvasTkAgg,NavigationToolbar2Tk)
 
 
+class Consumer:
+    # One subscriber to SerialData's message stream. The parser thread appends messages to a queue and returns right
+    # away; the consumer's own thread drains the queue and calls the function, so a slow consumer only falls behind
+    # itself. A bounded queue (maxlen messages) drops its oldest messages when full and counts them in dropped; with
+    # maxlen None nothing is ever dropped. kind picks how function is called: 'batch' with a list of (host time,
+    # format, raw bytes, values), 'message' with each message's values, 'raw' with each message's (format, raw bytes).
+    # interval (seconds) rate limits the deliveries, e.g. to a plot's refresh period.
+    def __init__(self, function, kind='batch', maxlen=100000, interval=0):
+        self.function = function
+        self.kind = kind
+        self.maxlen = maxlen
+        self.interval = interval
+        self.queue = collections.deque() # append and popleft are atomic, the parser never waits on the consumer
+        self.wakeup = Event()
+        self.received = 0
+        self.dropped = 0
+        self.isRun = True
+        self.thread = Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def put(self, batch):
+        # called by the parser thread only
+        self.queue.extend(batch)
+        self.received += len(batch)
+        if self.maxlen is not None:
+            while len(self.queue) > self.maxlen:
+                try:
+                    self.queue.popleft()
+                    self.dropped += 1
+                except IndexError:
+                    break
+        self.wakeup.set()
+
+    def drain(self):
+        batch = []
+        try:
+            while True:
+                batch.append(self.queue.popleft())
+        except IndexError:
+            pass
+        return batch
+
+    def run(self):
+        while True:
+            self.wakeup.wait(0.1)
+            self.wakeup.clear()
+            batch = self.drain()
+            if batch:
+                try:
+                    if self.kind == 'batch':
+                        self.function(batch)
+                    elif self.kind == 'raw':
+                        for message in batch:
+                            self.function(message[1], message[2])
+                    else:
+                        for message in batch:
+                            self.function(message[3])
+                except Exception as e:
+                    print("Serial callback " + str(self.function) + " failed: " + str(e))
+            elif not self.isRun:
+                return
+
+            if self.interval and self.isRun:
+                time.sleep(self.interval)
+
+    def stop(self):
+        # delivers whatever is still queued, then ends the thread
+        self.isRun = False
+        self.wakeup.set()
+        self.thread.join()
+
+
 class SerialData:
     def __init__(self):
 
         self.isRun = False
         # self.isReceiving = False
         self.thread = None
-        self.callbackfunction = collections.deque()
+        self.parserThread = None
+        self.chunks = collections.deque() # bytes read and not parsed yet, reader thread -> parser thread
+        self.chunkReady = Event()
+        self.consumers = () # replaced, never modified, so the parser can iterate it without locking
         self.callback_list_mutex = Lock()
+        self.bytesRead = 0
+        self.messagesParsed = 0
+        self.pending = {} # sequence number -> Future of a request waiting for its reply
+        self.pending_mutex = Lock()
+        self.nextSequence = 0
         self.serial_read_write_mutex = Lock()
         self.port = None
         self.baud = None
@@ -67,7 +154,10 @@ class SerialData:
         self.defined_data_mode = True
         self.dataNumBytes = -1
         self.dataFormat = "<"
-        self.rawData = None
+        self.fixedFormat = ("", None) # (format, struct.Struct) used in defined data mode
+
+        self.readBufferSize = 1 << 16
+        self.structCache = {} # format bytes from the stream -> (format, struct.Struct or None if invalid)
 
     def openPort (self, serialPort='COM5', serialBaud=9600):
         
@@ -79,7 +169,8 @@ class SerialData:
 
         print('Trying to connect to: ' + str(serialPort) + ' at ' + str(serialBaud) + ' BAUD.')
         try:
-            self.serialConnection = serial.Serial(serialPort, serialBaud)
+            # the timeout bounds how long a blocking read can hold up close()
+            self.serialConnection = serial.Serial(serialPort, serialBaud, timeout=0.05)
             if(self.serialConnection.isOpen() == False):
                 self.serialConnection.open()
                 
@@ -93,72 +184,99 @@ class SerialData:
 
     def readSerialStart(self):
         if not self.isRun:
-            self.thread = Thread(target=self.backgroundThread)
+            self.chunks.clear()
             self.isRun = True
+            self.thread = Thread(target=self.backgroundThread)
+            self.parserThread = Thread(target=self.parserThreadLoop)
+            self.parserThread.start()
             self.thread.start()
 
-    def parseData(self):
-        try:
-            value = struct.unpack(self.dataFormat, self.rawData)
-        except:
-            return
-        
-        data = [];
-        
-        '''for i in range(len(value)):         
-            if self.dataFormat[i+1-rep_ind] == 'c':
-                data.append(value[i].decode('ascii'))
-            elif self.dataFormat[i+1-rep_ind] == 'b' or self.dataFormat[i] == 'h':
-                data.append(int(value[i]))
-            else:
-                data.append(value[i])'''
-        rep = 1
-        ind = 0
-        for fmt in self.dataFormat:
-            if fmt is '<':
+    def dispatch(self, batch):
+        # batch is a list of (host time, format, raw bytes, decoded values) in arrival order
+        self.messagesParsed += len(batch)
+        if self.pending:
+            self.resolveRequests(batch)
+        for consumer in self.consumers:
+            consumer.put(batch)
+
+    def resolveRequests(self, batch):
+        # Replies to sequenced requests are wrapped as ['#'][sequence][reply], format "cB" + the reply's format.
+        for now, fmt, raw, values in batch:
+            if fmt.startswith('cB') and values[0] == '#':
+                with self.pending_mutex:
+                    future = self.pending.pop(values[1], None)
+                if future is not None and future.set_running_or_notify_cancel():
+                    future.set_result((now, fmt[2:], raw[2:], values[2:]))
+
+    def lookupFormat(self, key):
+        # key is the format as sent (bytes, no terminator). Valid formats get a cached struct, invalid ones are
+        # remembered as None so a garbled stream does not re-parse them.
+        entry = self.structCache.get(key)
+        if entry is None:
+            try:
+                fmt = key.decode('ascii')
+                entry = (fmt, struct.Struct('<' + fmt))
+            except:
+                print("invalid format received: " + str(key))
+                entry = (None, None)
+            if len(self.structCache) > 1024: # garbage keeps making new keys
+                self.structCache.clear()
+            self.structCache[key] = entry
+        return entry
+
+    def parseFrames(self, buffer, pos, end, now, batch):
+        # Dynamic mode frames are [length][format\0][data], length (signed byte) counting the format, its terminator
+        # and the data. Parses complete frames in buffer[pos:end] into batch and returns the first unparsed index.
+        # Anything that does not check out is skipped one byte at a time until the stream lines up again.
+        while pos < end:
+            length = buffer[pos]
+            if length == 0 or length > 127:
+                pos += 1
                 continue
-            
-            if rep == 1:
-                try:
-                    rep = int(str(fmt))
-                    continue
-                except:
-                    rep = 1
-
-            for i in range(rep):
-                if fmt == 'c':
-                    if rep == 1 or i == 0:
-                        data.append(value[ind].decode('ascii'))
-                    else:
-                        data[-1] += value[ind].decode('ascii')
-                        
-                elif fmt == 's':
-                    data.append(value[ind].decode('ascii'))
-                    ind += 1
-                    break
-                elif fmt == 'b' or fmt == 'h':
-                    data.append(int(value[ind]))
-                else:
-                    data.append(value[ind])
-                    
-                ind += 1
-            rep = 1
 
-                
-        self.callback_list_mutex.acquire()
-        try:
-            for function in self.callbackfunction:
-                function(data)
-        finally:
-            self.callback_list_mutex.release()
+            frame_end = pos + 1 + length
+            if frame_end > end:
+                break
+
+            nul = buffer.find(0, pos + 1, frame_end)
+            if nul < 0:
+                pos += 1
+                continue
+
+            fmt, msg = self.lookupFormat(bytes(buffer[pos + 1:nul]))
+            if msg is None or msg.size != frame_end - nul - 1:
+                pos += 1
+                continue
+
+            raw = bytes(buffer[nul + 1:frame_end])
+            if raw[:1] == b'&' and fmt[0] == 'c' and fmt[-1] == 's':
+                # replies to an '&' batch, format "c<N>s": ['&'][N bytes of frames], handed on one by one
+                self.parseFrames(raw, 1, len(raw), now, batch)
+            else:
+                batch.append((now, fmt, raw, binary_log.decodeValues(fmt, msg.unpack(raw))))
+            pos = frame_end
+        return pos
+
+    def parseFixed(self, buffer, pos, end, now, batch):
+        # Defined mode: back to back messages of the format set with setDataFormat.
+        fmt, msg = self.fixedFormat
+        if msg is None or msg.size == 0:
+            return end
+
+        size = msg.size
+        while pos + size <= end:
+            raw = bytes(buffer[pos:pos + size])
+            batch.append((now, fmt, raw, binary_log.decodeValues(fmt, msg.unpack(raw))))
+            pos += size
+        return pos
 
     def setDataFormat(self, new_format):
         if new_format != "Dynamic":
             try:
-                self.defined_data_mode = True
+                self.fixedFormat = (new_format, struct.Struct("<"+new_format))
                 self.dataFormat = "<"+new_format
-                self.dataNumBytes = struct.calcsize(self.dataFormat)
-                self.rawData = bytearray(self.dataNumBytes)
+                self.dataNumBytes = self.fixedFormat[1].size
+                self.defined_data_mode = True
             except:
                 print("Invalid Format: " + new_format)
                 return False
@@ -166,81 +284,67 @@ class SerialData:
             self.defined_data_mode = False
             self.dataFormat = "<"
             self.dataNumBytes = -1
-            self.rawData = None
         
         return True
 
     def backgroundThread(self):  # retrieve data
         self.serialConnection.reset_input_buffer()
         print('Serial Monitoring Thread Started\n')
-        
-        self.rawData = bytearray(0)
-        
+
+        # Only moves bytes: whatever has arrived (at least one byte, blocking up to the port timeout) is handed to the
+        # parser thread, so the port is drained at the rate USB delivers no matter what the consumers are doing.
+        max_read = self.readBufferSize // 2
         while self.isRun:
             try:
-                if self.defined_data_mode and self.serialConnection.in_waiting >= self.dataNumBytes and self.dataNumBytes > 0:
-                    self.rawData = bytearray(self.dataNumBytes)
-                    self.serial_read_write_mutex.acquire()
-                    try:
-                        self.serialConnection.readinto(self.rawData)
-                    finally:
-                        self.serial_read_write_mutex.release()
-                    self.parseData()
-                
-                elif (not self.defined_data_mode) and self.serialConnection.in_waiting and  self.dataNumBytes == -1:
-                    self.dataNumBytes = struct.unpack('b',self.serialConnection.read(1))[0]
-                
-                elif (not self.defined_data_mode) and self.serialConnection.in_waiting >= self.dataNumBytes and self.dataNumBytes > 0 :
-                    self.serial_read_write_mutex.acquire()
-                    try:
-                        tmp = self.serialConnection.read(1)
-                    finally:
-                        self.serial_read_write_mutex.release()
-                    
-                    self.dataNumBytes -= 1
-                    tmp_uchar = struct.unpack('b',tmp)[0]
-                    
-                    if tmp_uchar is not 0:
-                        self.dataFormat = self.dataFormat + struct.unpack('c',tmp)[0].decode('ascii')
-                        try:
-                            try:
-                                i = int(self.dataFormat[-1])
-                            except:
-                                i = None
-                                
-                            if i is None:
-                                struct.calcsize(self.dataFormat) # check if its a valid format skip ones that end in a number
-                        except:
-                            print("num bytes: " + str(self.dataNumBytes) + " attempt fmt: " + self.dataFormat)
-                            self.dataNumBytes = -1
-                            self.dataFormat = "<"
-                    else:
-                        if struct.calcsize(self.dataFormat) == self.dataNumBytes:
-                            # all is as expected
-                            self.rawData = bytearray(self.dataNumBytes)
-                            self.serial_read_write_mutex.acquire()
-                            try:
-                                self.serialConnection.readinto(self.rawData)
-                            finally:
-                                self.serial_read_write_mutex.release()
-                            self.parseData()
-                        self.dataNumBytes = -1
-                        self.dataFormat = "<"
-                
-                elif self.dataNumBytes == 0:
-                    self.dataNumBytes = -1
-                
-                else:
-                    time.sleep(0.001) # recheck serial every 5ms
-                    
-                        
-            
+                data = self.serialConnection.read(max(1, min(self.serialConnection.in_waiting, max_read)))
+                if data:
+                    self.bytesRead += len(data)
+                    self.chunks.append(data)
+                    self.chunkReady.set()
+
             except:
                 self.isRun = False
                 self.thread = None
                 self.serialConnection.close()
                 print('Connection Lost\n')
-                
+
+        self.chunkReady.set()
+
+    def parserThreadLoop(self):
+        # Copies chunks into a preallocated buffer and parses every complete message in place. A partial message at
+        # the end waits for the next chunk. Keeps going after the reader stops until every chunk is parsed.
+        buffer = bytearray(self.readBufferSize)
+        start = 0 # first unparsed byte
+        end = 0   # one past the last byte copied in
+
+        while True:
+            self.chunkReady.wait(0.1)
+            self.chunkReady.clear()
+
+            while self.chunks:
+                data = self.chunks.popleft()
+                if end + len(data) > len(buffer):
+                    buffer[0:end - start] = buffer[start:end]
+                    end -= start
+                    start = 0
+                buffer[end:end + len(data)] = data
+                end += len(data)
+
+                batch = []
+                if self.defined_data_mode:
+                    start = self.parseFixed(buffer, start, end, time.perf_counter(), batch)
+                else:
+                    start = self.parseFrames(buffer, start, end, time.perf_counter(), batch)
+
+                if start == end:
+                    start = end = 0
+
+                if batch:
+                    self.dispatch(batch)
+
+            if not self.isRun and not self.chunks:
+                return
+
     def write(self, data, data_format):
         try:
             index = 0
@@ -275,6 +379,10 @@ class SerialData:
         except:
             return (False, "Format/Entry Mismatch" )
             
+        return self.writeBytes(msg)
+
+    def writeBytes(self, msg):
+        # sends an already packed message
         if self.isConnected():    
             if self.serialConnection:
                 self.serial_read_write_mutex.acquire()
@@ -288,201 +396,425 @@ class SerialData:
         else:
             return (False, 'Not Connected')
 
+    def request(self, msg):
+        # Sends an already packed message as a sequenced request, ['#'][sequence][msg], and returns a
+        # concurrent.futures.Future that resolves to (host time, format, raw bytes, values) of the first reply, with
+        # the sequence wrapper taken off. Replies still reach the registered callbacks (wrapped), so any number of
+        # requests can be in flight. Commands that do not reply leave their future pending until the sequence number
+        # comes around again 256 requests later, which cancels it.
+        future = concurrent.futures.Future()
+        with self.pending_mutex:
+            seq = self.nextSequence
+            self.nextSequence = (seq + 1) & 0xFF
+            stale = self.pending.get(seq)
+            self.pending[seq] = future
+        if stale is not None:
+            stale.cancel()
+
+        ok, error = self.writeBytes(b'#' + bytes((seq,)) + msg)
+        if not ok:
+            with self.pending_mutex:
+                if self.pending.get(seq) is future:
+                    del self.pending[seq]
+            if future.set_running_or_notify_cancel():
+                future.set_exception(IOError(error))
+        return future
+
+    @staticmethod
+    def packBatch(msgs):
+        # Packs already packed commands into one '&' batch command, ['&'][length][commands]. The firmware runs them in
+        # order and sends all their replies in one frame, which the parser splits up again. At most 59 bytes of
+        # commands fit in a batch.
+        body = b''.join(msgs)
+        if len(body) > 59:
+            raise ValueError("batch of " + str(len(body)) + " bytes, at most 59 fit")
+        return b'&' + bytes((len(body),)) + body
+
+    def writeBatch(self, msgs):
+        return self.writeBytes(self.packBatch(msgs))
+
     def close(self, on_shutdown=False):
         if self.isConnected():
             self.isRun = False
             self.thread.join()
             self.thread = None
+            self.parserThread.join()
+            self.parserThread = None
             self.serialConnection.close()
             if not on_shutdown:
                 print('Serial Port ' + self.port + ' Disconnected.\n')
+                for consumer in self.consumers:
+                    if consumer.dropped:
+                        print(str(consumer.function) + " dropped " + str(consumer.dropped) + " of " + str(consumer.received) + " messages")
 
-    def registerCallback(self, function):
+    def statistics(self):
+        # (bytes read, messages parsed, {function: messages dropped}) since the object was created
+        return self.bytesRead, self.messagesParsed, {c.function: c.dropped for c in self.consumers}
+
+    def addConsumer(self, function, kind, maxlen, interval=0):
         self.callback_list_mutex.acquire()
         try:
-            self.callbackfunction.append(function)
+            consumer = Consumer(function, kind, maxlen, interval)
+            self.consumers = self.consumers + (consumer,)
         finally:
             self.callback_list_mutex.release()
-            
+        return consumer
 
-    def removeCallback(self, function):
+    def removeConsumer(self, function, kind):
         self.callback_list_mutex.acquire()
         try:
-            self.callbackfunction.remove(function)
+            matches = [c for c in self.consumers if c.function == function and c.kind == kind]
+            if not matches:
+                raise ValueError("callback not registered")
+            consumer = matches[0]
+            self.consumers = tuple(c for c in self.consumers if c is not consumer)
         finally:
             self.callback_list_mutex.release()
-            
+        consumer.stop() # outside the lock, it waits for the queue to drain
+        return consumer
+
+    # Every callback runs on its own thread fed by its own queue, see Consumer. maxlen bounds that queue (oldest
+    # messages dropped first), None makes the callback lossless. interval rate limits the calls. The remove functions
+    # return once everything already queued for the callback has been delivered.
+
+    def registerCallback(self, function, maxlen=100000, interval=0):
+        # function(values) for each message
+        return self.addConsumer(function, 'message', maxlen, interval)
+
+    def removeCallback(self, function):
+        return self.removeConsumer(function, 'message')
+
+    def registerBatchCallback(self, function, maxlen=100000, interval=0):
+        # function(batch) with a list of (host time, format, raw bytes, values), everything queued since the last call
+        return self.addConsumer(function, 'batch', maxlen, interval)
+
+    def removeBatchCallback(self, function):
+        return self.removeConsumer(function, 'batch')
+
+    def registerRawCallback(self, function, maxlen=100000, interval=0):
+        # function(format without '<', message bytes) for each message
+        return self.addConsumer(function, 'raw', maxlen, interval)
+
+    def removeRawCallback(self, function):
+        return self.removeConsumer(function, 'raw')
+
 
 
 class RecordData:
-    def __init__(self):
-        self.csvData = collections.deque(maxlen=100000)
-        self.csvTime = collections.deque(maxlen=100000)
+    # Streams every message to a binary log (see binary_log.py) as it arrives, so there is no cap on the recording
+    # length. Register addBatch with SerialData.registerBatchCallback (or addRawData with registerRawCallback).
+    # saveData converts the log to CSV or keeps it as is depending on the extension picked.
+    def __init__(self, filename=None):
+        if filename is None:
+            fd, filename = tempfile.mkstemp(prefix='megn540_', suffix=binary_log.LOG_EXTENSION)
+            os.close(fd)
+            self.is_temporary = True
+        else:
+            self.is_temporary = False
+
+        self.filename = filename
+        self.writer = None
+        self.writer_mutex = Lock()
         self.is_recording = False
 
     def startRecording(self):
-        self.is_recording = True
+        self.writer_mutex.acquire()
+        try:
+            if self.writer is None:
+                self.writer = binary_log.BinaryLogWriter(self.filename)
+            self.is_recording = True
+        finally:
+            self.writer_mutex.release()
         print("start recording")
 
-    def addData(self, value):
+    def addRawData(self, fmt, raw):
         if self.is_recording is True:
             currentTimer = time.perf_counter()
-            self.csvData.append(value)
-            self.csvTime.append(currentTimer)
+            self.writer_mutex.acquire()
+            try:
+                if self.writer is not None:
+                    self.writer.write(fmt, raw, currentTimer)
+            finally:
+                self.writer_mutex.release()
+
+    def addBatch(self, batch):
+        if self.is_recording is True:
+            self.writer_mutex.acquire()
+            try:
+                if self.writer is not None:
+                    for (timestamp, fmt, raw, _) in batch:
+                        self.writer.write(fmt, raw, timestamp)
+            finally:
+                self.writer_mutex.release()
 
     def stopRecording(self):
         if self.is_recording:
-            self.is_recording = False
-            print("Stop recording")
+            self.writer_mutex.acquire()
+            try:
+                self.is_recording = False
+                self.writer.close()
+            finally:
+                self.writer_mutex.release()
+            print("Stop recording: " + str(self.writer.records) + " messages")
     
     def isRecording(self):
         return self.is_recording
 
     def saveData(self):
-        if self.csvData:
-            filename = filedialog.asksaveasfilename(title="test", filetypes=(("csv files", "*.csv"), ("all files", "*.*")))
-            if filename:
-                file = open(filename,'w');
-                time_ind = 0;
-                for val in self.csvData:
-                    file.write(str(self.csvTime[time_ind]))
-                    time_ind += 1
-                    for e in val:
-                        file.write(", " + str(e) )
-                    
-                    file.write('\n')
-                
-                file.close()
+        self.stopRecording()
+        if self.writer is None or self.writer.records == 0:
+            self.discard()
+            return
+
+        filename = filedialog.asksaveasfilename(title="test", filetypes=(("csv files", "*.csv"), ("binary log", "*" + binary_log.LOG_EXTENSION), ("all files", "*.*")), defaultextension='.csv')
+        if filename:
+            if filename.lower().endswith('.csv'):
+                with binary_log.BinaryLogReader(self.filename) as log:
+                    log.toCSV(filename)
+            else:
+                shutil.move(self.filename, filename)
+                self.is_temporary = False
+                self.filename = filename
+        self.discard()
+
+    def discard(self):
+        # removes the temporary log, a log that was saved or given by name is kept
+        if self.is_temporary and os.path.exists(self.filename):
+            os.remove(self.filename)
+        self.is_temporary = False
 
 
 class RealTimePlot():
-    def __init__(self, plotLength=500, refreshTime=10):
+    # Scrolling plot of one or more fields of the incoming messages, one subplot per field. Samples go into a
+    # preallocated ring (capacity samples, numpy) so any input rate is accepted; every refresh the last timeSpan
+    # seconds are reduced to a min/max pair per pixel column, which keeps spikes visible at any rate, and only the line
+    # artists are redrawn onto a cached background (blitting). The axes are only redrawn when the y limits have to
+    # change, the window is resized or the channels change. The latest values are shown in a label under the plot,
+    # rendering text on the canvas every frame would cost more than the lines.
+    def __init__(self, plotLength=500, refreshTime=10, timeSpan=None, capacity=1 << 17):
                
         self.gui_main = None       
         self.window = None
         self.plotMaxLength = plotLength
-        
-        self.data  = collections.deque( maxlen=plotLength)
-        self.times = collections.deque( maxlen=plotLength)
-        self.plotTimer = 0
-        self.previousTimer = 0
-        self.valueLast = None
-        self.p = None
-        self.fig = None
-        
-        self.t_start = time.perf_counter()
-        self.values_queue = collections.deque(maxlen=plotLength)
-        self.times_queue  = collections.deque(maxlen=plotLength)
-        
-        self.plotTimer = 0
-        self.previousTimer = 0
-        self.timeText = None
-        
-        self.input_index = 0;
-        
         self.pltInterval = refreshTime  # Refresh period [ms]
+        self.timeSpan = timeSpan if timeSpan is not None else plotLength * refreshTime / 1000.0 # seconds shown
         
+        self.t_start = time.perf_counter()
+        self.capacity = capacity
+        self.channels = [0]
+        self.times = np.zeros(capacity)
+        self.values = np.zeros((len(self.channels), capacity))
+        self.head = 0  # next slot to write
+        self.count = 0 # valid samples in the ring
         self.data_mutex = Lock()
 
-    def updatePlotData(self,args=None): #, frame, lines, lineValueText, lineLabel, timeText):
-#        while self.isRunning:
-        
-        if len(self.times_queue):
-            currentTimer = time.perf_counter()
-            self.plotTimer = int((currentTimer - self.previousTimer) * 1000)
-            if self.plotTimer > 1:
-                self.previousTimer = currentTimer
-                self.timeText.set_text('Plot Interval = ' + str(self.plotTimer) + 'ms')
-        else:
+        self.fig = None
+        self.canvas = None
+        self.axes = []
+        self.lines = []
+        self.statusText = None
+        self.statusTimer = 0
+        self.backgrounds = None
+        self.job = None
+        self.previousTimer = 0
+
+    def addValue(self, value):
+        self.addSamples([time.perf_counter()], [value])
+
+    def addBatch(self, batch):
+        # SerialData batch callback, (host time, format, raw bytes, values) per message
+        self.addSamples([message[0] for message in batch], [message[3] for message in batch])
+
+    def addSamples(self, times, values):
+        # messages without a number at every plotted index are skipped
+        channels = self.channels
+        rows = []
+        row_times = []
+        for t, value in zip(times, values):
+            try:
+                rows.append([float(value[i]) for i in channels])
+                row_times.append(t - self.t_start)
+            except (IndexError, ValueError, TypeError):
+                continue
+        if not rows:
             return
-       
-        valueLast = []
 
         self.data_mutex.acquire()
+        try:
+            if channels is not self.channels: # changed while converting
+                return
+            n = len(rows)
+            if n > self.capacity:
+                rows = rows[-self.capacity:]
+                row_times = row_times[-self.capacity:]
+                n = self.capacity
+            block = np.asarray(rows).T
+            first = min(n, self.capacity - self.head)
+            self.times[self.head:self.head + first] = row_times[:first]
+            self.values[:, self.head:self.head + first] = block[:, :first]
+            if first < n:
+                self.times[:n - first] = row_times[first:]
+                self.values[:, :n - first] = block[:, first:]
+            self.head = (self.head + n) % self.capacity
+            self.count = min(self.count + n, self.capacity)
+        finally:
+            self.data_mutex.release()
 
-        while len(self.times_queue):
-            try:
-                valueLast = self.values_queue[-1][self.input_index]
-                time_val = self.times_queue[-1]
-                valueLast = float(valueLast) # make sure its a number
-                self.data.append(valueLast)  # latest data point and append it to array
-                self.times.append(time_val)
-                self.values_queue.clear()
-                self.times_queue.clear()
-            except:
-                break
-        
-
-        self.data_mutex.release()
-        
-        self.lines.set_data(self.times, self.data)
-        if len(self.data):
-            self.lineValueText.set_text('[' + self.lineLabel + " IND: " +str(self.input_index) + '] = ' + str(round(self.data[-1],3)))
-        
-        if len(self.times) > 5:
-            #self.fig.canvas.restore_region(self.background)
-            self.ax.set_xlim(self.times[0],self.times[-1])
-            
-            min_ylim = min(self.data)
-            max_ylim = max(self.data)
-            
-            if min_ylim == max_ylim:
-                if min_ylim == 0:
-                    min_ylim = -1
-                    max_ylim = 1
-                else:
-                    min_ylim = min_ylim*.2
-                    max_ylim = max_ylim*1.2
-            
-            
-            self.ax.set_ylim(min_ylim - (max_ylim-min_ylim)/10, max_ylim + (max_ylim-min_ylim)/10)
+    def changePlotIndex(self, index):
+        # index is one message field or a list of them, one subplot each
+        channels = list(index) if isinstance(index, (list, tuple)) else [index]
+        self.data_mutex.acquire()
+        try:
+            self.channels = channels
+            self.values = np.zeros((len(channels), self.capacity))
+            self.head = 0
+            self.count = 0
+        finally:
+            self.data_mutex.release()
+        if self.fig is not None:
+            self.setupAxes()
 
-    def addValue(self, value):
+    def window_samples(self, t0):
+        # copies of the samples newer than t0, oldest first
         self.data_mutex.acquire()
-        self.values_queue.append(value)
-        self.times_queue.append(time.perf_counter()-self.t_start)
-        self.data_mutex.release()
-        
-    def changePlotIndex(self, index):
-        self.input_index = index
-        self.times.clear()
-        self.data.clear()
+        try:
+            start = (self.head - self.count) % self.capacity
+            if start + self.count <= self.capacity:
+                segments = [(start, start + self.count)]
+            else:
+                segments = [(start, self.capacity), (0, self.head)]
+
+            times = []
+            values = []
+            for a, b in segments:
+                a = a + int(np.searchsorted(self.times[a:b], t0))
+                if a < b:
+                    times.append(self.times[a:b])
+                    values.append(self.values[:, a:b])
+            if not times:
+                return np.zeros(0), np.zeros((len(self.channels), 0))
+            return np.concatenate(times), np.concatenate(values, axis=1)
+        finally:
+            self.data_mutex.release()
+
+    @staticmethod
+    def decimate(times, values, t0, span, columns):
+        # min and max of every pixel column, in time order, so the line traces the envelope
+        if len(times) <= 2 * columns:
+            return times, values
+        bins = ((times - t0) * (columns / span)).astype(np.int64)
+        starts = np.concatenate(([0], np.flatnonzero(np.diff(bins)) + 1))
+        lo = np.minimum.reduceat(values, starts, axis=1)
+        hi = np.maximum.reduceat(values, starts, axis=1)
+        x = np.repeat(t0 + (bins[starts] + 0.5) * (span / columns), 2)
+        y = np.empty((values.shape[0], 2 * len(starts)))
+        y[:, 0::2] = lo
+        y[:, 1::2] = hi
+        return x, y
+
+    def updatePlotData(self):
+        self.job = None
+        if self.fig is None:
+            return
+
+        currentTimer = time.perf_counter()
+        now = currentTimer - self.t_start
+        plotTimer = int((currentTimer - self.previousTimer) * 1000)
+        self.previousTimer = currentTimer
+
+        times, values = self.window_samples(now - self.timeSpan)
+        redraw = self.backgrounds is None
+        if len(times) and values.shape[0] == len(self.lines):
+            columns = max(1, int(self.axes[0].bbox.width))
+            x, y = self.decimate(times, values, now - self.timeSpan, self.timeSpan, columns)
+            x = x - now
+            for i, line in enumerate(self.lines):
+                line.set_data(x, y[i])
+                redraw |= self.updateLimits(self.axes[i], y[i])
+
+        if self.statusText is not None and currentTimer - self.statusTimer > 0.2:
+            self.statusTimer = currentTimer
+            status = 'Plot Interval = ' + str(plotTimer) + 'ms'
+            if len(times):
+                for i, channel in enumerate(self.channels):
+                    status += '    [IND: ' + str(channel) + '] = ' + str(round(values[i, -1], 3))
+            self.statusText.set(status)
+
+        if redraw:
+            self.canvas.draw() # on_draw recaptures the backgrounds
+        else:
+            for ax, background in zip(self.axes, self.backgrounds):
+                self.canvas.restore_region(background)
+                self.drawArtists(ax)
+                self.canvas.blit(ax.bbox)
+
+        if self.window is not None:
+            self.job = self.window.after(self.pltInterval, self.updatePlotData)
+
+    @staticmethod
+    def updateLimits(ax, y):
+        # grows the y limits as soon as data leaves them, shrinks them only when the data uses less than a quarter.
+        # The quarter range margin keeps a slowly growing signal from forcing a full redraw every frame.
+        lo, hi = float(np.min(y)), float(np.max(y))
+        if lo == hi:
+            lo, hi = (-1, 1) if lo == 0 else (lo - abs(lo) * 0.2, hi + abs(hi) * 0.2)
+        cur_lo, cur_hi = ax.get_ylim()
+        if lo >= cur_lo and hi <= cur_hi and (hi - lo) > 0.25 * (cur_hi - cur_lo):
+            return False
+        margin = (hi - lo) / 4
+        ax.set_ylim(lo - margin, hi + margin)
+        return True
+
+    def drawArtists(self, ax):
+        for line in ax.get_lines():
+            ax.draw_artist(line)
+
+    def on_draw(self, event=None):
+        self.backgrounds = [self.canvas.copy_from_bbox(ax.bbox) for ax in self.axes]
+        for ax in self.axes:
+            self.drawArtists(ax)
+
+    def setupAxes(self):
+        self.fig.clear()
+        n = len(self.channels)
+        self.axes = [self.fig.add_subplot(n, 1, i + 1) for i in range(n)]
+        self.lines = []
+        for i, ax in enumerate(self.axes):
+            ax.set_xlim(-self.timeSpan, 0)
+            ax.set_ylim(-1, 1)
+            ax.set_ylabel('Value [' + str(self.channels[i]) + ']')
+            self.lines.append(ax.plot([], [], animated=True)[0])
+        self.axes[0].set_title('Real Time Plot')
+        self.axes[-1].set_xlabel("time [s]")
+        self.backgrounds = None
 
     def setupPlot(self):  # retrieve data
-        xmin = 0
-        xmax = self.plotMaxLength
-        ymin = -1
-        ymax = 1050
-        self.fig = plt.figure()
-        self.ax = plt.axes( autoscale_on=True)#xlim=(xmin, xmax), ylim=(float(ymin - (ymax - ymin) / 10), float(ymax + (ymax - ymin) / 10)))
-        self.ax.set_title('Arduino Analog Read')
-        self.ax.set_xlabel("time")
-        self.ax.set_ylabel("AnalogRead Value")
-        
+        self.fig = Figure()
         self.canvas = FigureCanvasTkAgg(self.fig, master=self.window)
-        self.canvas.draw()
         self.canvas.get_tk_widget().pack(side=tkinter.TOP, fill=tkinter.BOTH, expand=1)
-        
+
+        self.statusText = StringVar(self.window)
+        Label(self.window, textvariable=self.statusText, anchor='w').pack(side=tkinter.BOTTOM, fill=tkinter.X)
+
         toolbar = NavigationToolbar2Tk(self.canvas,self.window)
         toolbar.update()
         self.canvas.get_tk_widget().pack(side=tkinter.TOP, fill=tkinter.BOTH, expand=1)
 
-        self.lineLabel = 'Sensor Value'
-        self.timeText = self.ax.text(0.50, 0.95, '', transform=self.ax.transAxes)
-        self.lines = self.ax.plot([], [], label=self.lineLabel)[0]
-        self.lineValueText = self.ax.text(0.50, 0.90, '', transform=self.ax.transAxes)
+        self.canvas.mpl_connect('draw_event', self.on_draw)
+        self.setupAxes()
+        self.canvas.draw()
   
-        # START THE PLOT ANIMATION
-        self.anim = animation.FuncAnimation(self.fig, self.updatePlotData, interval=self.pltInterval)
+        # START THE PLOT UPDATES
+        self.job = self.window.after(self.pltInterval, self.updatePlotData)
         
-    
     def isOk(self):
-        return self.anim is not None
+        return self.job is not None
 
     def close(self):
-        if self.anim is not None:
-            self.anim.event_source.stop()
-        self.anim = None
+        if self.job is not None:
+            self.window.after_cancel(self.job)
+        self.job = None
+        self.fig = None
  
         self.window.withdraw()
         
@@ -499,4 +831,3 @@ class RealTimePlot():
             self.window.protocol("WM_DELETE_WINDOW", self.close)
             self.gui_main = main
         self.setupPlot()
-
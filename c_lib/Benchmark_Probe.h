@@ -0,0 +1,77 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * Benchmark_Probe.h defines the markers the cycle benchmark (Benchmark/, `make benchmark` in the lab directories)
+ * uses to time sections of firmware running under simavr.
+ *
+ * A marker is two single-cycle `out` instructions: the probe id goes to GPIOR1, then BENCH_MARK_BEGIN or
+ * BENCH_MARK_END goes to GPIOR0. The simulator watches GPIOR0 writes and records its cycle counter, so the
+ * firmware needs no timer and the measurement does not disturb the code around it beyond the two stores.
+ * The constant marker overhead is measured with BENCH_EMPTY and subtracted by the runner.
+ *
+ * The markers only exist when MEGN540_BENCHMARK is defined; in normal builds they compile to nothing. This header is
+ * also included by the host-side runner for the probe names.
+ */
+#ifndef _MEGN540_BENCHMARK_PROBE_H
+#define _MEGN540_BENCHMARK_PROBE_H
+
+/**
+ * Probe ids and report names. Append new probes at the end so ids in old reports keep their meaning.
+ */
+#define BENCH_PROBES( X )                            \
+    X( BENCH_EMPTY, "empty" )                        \
+    X( BENCH_FILTER_VALUE, "Filter_Value" )          \
+    X( BENCH_MESSAGE_HANDLING_IDLE, "Message_Handling_Task_idle" ) \
+    X( BENCH_MESSAGE_HANDLING_CMD, "Message_Handling_Task_cmd" )   \
+    X( BENCH_USB_SEND_MSG, "usb_send_msg" )          \
+    X( BENCH_ENCODER_LEFT_ISR, "PCINT0_vect" )       \
+    X( BENCH_ENCODER_RIGHT_ISR, "INT6_vect" )        \
+    X( BENCH_CASCADE_UPDATE, "Cascade_Update" )
+
+#define BENCH_ENUM_ENTRY( id, name ) id,
+typedef enum { BENCH_PROBES( BENCH_ENUM_ENTRY ) BENCH_PROBE_COUNT } Bench_Probe_t;
+#undef BENCH_ENUM_ENTRY
+
+#define BENCH_MARK_BEGIN 0x01
+#define BENCH_MARK_END   0x02
+#define BENCH_MARK_DONE  0x7F  ///<-- all scenarios finished, the runner stops the simulation
+
+#ifdef MEGN540_BENCHMARK
+#define BENCH_PROBE_BEGIN( id ) do { GPIOR1 = ( id ); GPIOR0 = BENCH_MARK_BEGIN; } while( 0 )
+#define BENCH_PROBE_END( id )   do { GPIOR1 = ( id ); GPIOR0 = BENCH_MARK_END; } while( 0 )
+#define BENCH_DONE()            do { GPIOR0 = BENCH_MARK_DONE; } while( 0 )
+#else
+#define BENCH_PROBE_BEGIN( id ) do { } while( 0 )
+#define BENCH_PROBE_END( id )   do { } while( 0 )
+#define BENCH_DONE()            do { } while( 0 )
+#endif
+
+#endif
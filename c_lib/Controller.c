@@ -7,8 +7,11 @@
 void Controller_Init(Controller_t* p_cont, float kp, float* num, float* den, uint8_t order, float update_period)
 {
    Filter_Init(&p_cont->controller, num, den, order);
-   kp = kp;
-   update_period = update_period;
+   p_cont->kp = kp;
+   p_cont->update_period = update_period;
+   p_cont->target_pos = 0;
+   p_cont->target_vel = 0;
+   p_cont->last_control = 0;
 }
 
 /**
@@ -42,7 +45,7 @@ float Controller_Update( Controller_t* p_cont, float measurement, float dt )
     if (p_cont->target_vel > 0) target = measurement + dt*p_cont->target_vel;
     else target = p_cont->target_pos;
     float ret_val = p_cont->kp * (target - filter_val);
-    last_control_val = ret_val;
+    p_cont->last_control = ret_val;
     return ret_val;
 }
 
@@ -51,7 +54,7 @@ float Controller_Update( Controller_t* p_cont, float measurement, float dt )
  */
 float Controller_Last( Controller_t* p_cont)
 {
-    return last_control_val;
+    return p_cont->last_control;
 }
 
 /**
@@ -71,3 +74,88 @@ void Controller_ShiftBy(Controller_t* p_cont, float measurement )
 {
     Filter_ShiftBy(&p_cont->controller, measurement);
 }
+
+/**
+ * Function PI_Loop_Init sets the gains of a PI loop and zeros its state. Anti-windup defaults to clamping.
+ */
+void PI_Loop_Init( PI_Loop_t* p_loop, float kp, float ki, float kff, float out_max, float update_period )
+{
+    p_loop->kp = kp;
+    p_loop->ki_dt = ki*update_period;
+    p_loop->kff = kff;
+    p_loop->kaw_dt = 0;
+    p_loop->out_max = out_max;
+    p_loop->update_period = update_period;
+    p_loop->anti_windup = ANTI_WINDUP_CLAMP;
+    PI_Loop_Reset(p_loop, 0);
+}
+
+/**
+ * Function PI_Loop_Set_Anti_Windup selects the anti-windup strategy.
+ */
+void PI_Loop_Set_Anti_Windup( PI_Loop_t* p_loop, Anti_Windup_t mode, float kaw )
+{
+    p_loop->anti_windup = mode;
+    p_loop->kaw_dt = kaw*p_loop->update_period;
+}
+
+/**
+ * Function PI_Loop_Reset sets the integral state.
+ */
+void PI_Loop_Reset( PI_Loop_t* p_loop, float integral )
+{
+    p_loop->integral = Saturate(integral, p_loop->out_max);
+    p_loop->output = p_loop->integral;
+}
+
+/**
+ * Function PI_Loop_Update steps the loop one update period and returns the saturated output.
+ */
+float PI_Loop_Update( PI_Loop_t* p_loop, float error, float feedforward )
+{
+    float unsat = p_loop->kp*error + p_loop->integral + p_loop->kff*feedforward;
+    float out = Saturate(unsat, p_loop->out_max);
+
+    if( p_loop->anti_windup == ANTI_WINDUP_BACK_CALC ) {
+        p_loop->integral += p_loop->ki_dt*error + p_loop->kaw_dt*(out - unsat);
+    }
+    else if( out == unsat || (error > 0) != (unsat > 0) ) {
+        // only integrate when unsaturated or when the error pulls the output back out of saturation
+        p_loop->integral += p_loop->ki_dt*error;
+    }
+
+    // the integral alone should never be asked for more than the actuator can give
+    p_loop->integral = Saturate(p_loop->integral, p_loop->out_max);
+
+    p_loop->output = out;
+    return out;
+}
+
+/**
+ * Function Cascade_Init zeros the integral and output of both loops.
+ */
+void Cascade_Init( Cascade_Controller_t* p_cont )
+{
+    // written directly rather than with PI_Loop_Reset, which reads out_max, so the gains may not be set yet
+    p_cont->position.integral = 0;
+    p_cont->position.output = 0;
+    p_cont->velocity.integral = 0;
+    p_cont->velocity.output = 0;
+}
+
+/**
+ * Function Cascade_Update runs the position loop then the velocity loop.
+ */
+float Cascade_Update( Cascade_Controller_t* p_cont, float target_pos, float target_vel, float measured_pos, float measured_vel )
+{
+    float vel_cmd = PI_Loop_Update(&p_cont->position, target_pos - measured_pos, target_vel);
+    return PI_Loop_Update(&p_cont->velocity, vel_cmd - measured_vel, target_vel);
+}
+
+/**
+ * Function Cascade_Update_Velocity runs only the inner velocity loop.
+ */
+float Cascade_Update_Velocity( Cascade_Controller_t* p_cont, float target_vel, float measured_vel )
+{
+    return PI_Loop_Update(&p_cont->velocity, target_vel - measured_vel, target_vel);
+}
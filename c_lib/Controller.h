@@ -40,14 +40,32 @@
 
 #include "Filter.h"
 
-typedef struct { Filter_Data_t controller; float kp; float target_pos; float target_vel; float update_period;} Controller_t;
+typedef struct { Filter_Data_t controller; float kp; float target_pos; float target_vel; float update_period; float last_control;} Controller_t;
 
-float last_control_val;
+/**
+ * Anti-windup strategies for the integral term of a PI_Loop_t.
+ *  ANTI_WINDUP_CLAMP      stops integrating while the output is saturated and the error would drive it further in.
+ *  ANTI_WINDUP_BACK_CALC  bleeds the integral back by kaw*(saturated - unsaturated) each update.
+ */
+typedef enum { ANTI_WINDUP_CLAMP, ANTI_WINDUP_BACK_CALC } Anti_Windup_t;
+
+/**
+ * Struct PI_Loop_t holds the gains and state of one proportional-integral loop with feedforward. The integral and
+ * anti-windup gains are stored pre-multiplied by update_period so an update is only a handful of multiplies.
+ */
+typedef struct { float kp; float ki_dt; float kff; float kaw_dt; float integral; float out_max; float output; float update_period; Anti_Windup_t anti_windup; } PI_Loop_t;
+
+/**
+ * Struct Cascade_Controller_t is an outer position loop feeding the velocity command of an inner velocity loop. The
+ * position loop output (out_max) is the velocity limit and the velocity loop output (out_max) is the actuator limit.
+ * Each loop keeps the update period it was given by PI_Loop_Init.
+ */
+typedef struct { PI_Loop_t position; PI_Loop_t velocity; } Cascade_Controller_t;
 
 /**
  * Function Saturate saturates a value to be within the range.
  */
-inline float Saturate( float value, float ABS_MAX )
+static inline float Saturate( float value, float ABS_MAX )
 {
     return (value > ABS_MAX)?ABS_MAX:(value < -ABS_MAX)?-ABS_MAX:value;
 }
@@ -92,4 +110,60 @@ void Controller_SetTo(Controller_t* p_cont, float measurement );
  */
 void Controller_ShiftBy(Controller_t* p_cont, float measurement );
 
+/**
+ * Function PI_Loop_Init sets the gains of a PI loop and zeros its state. Anti-windup defaults to clamping.
+ * @param p_loop pointer to the loop
+ * @param kp proportional gain
+ * @param ki integral gain (per second)
+ * @param kff gain applied to the feedforward term passed to PI_Loop_Update
+ * @param out_max absolute output limit, applied with Saturate
+ * @param update_period seconds between calls to PI_Loop_Update
+ */
+void PI_Loop_Init( PI_Loop_t* p_loop, float kp, float ki, float kff, float out_max, float update_period );
+
+/**
+ * Function PI_Loop_Set_Anti_Windup selects the anti-windup strategy. kaw is the back-calculation gain (per second,
+ * scaled by the update period given to PI_Loop_Init, so call this after it) and is ignored for clamping. A kaw around
+ * ki/kp is a reasonable place to start.
+ */
+void PI_Loop_Set_Anti_Windup( PI_Loop_t* p_loop, Anti_Windup_t mode, float kaw );
+
+/**
+ * Function PI_Loop_Reset sets the integral state, e.g. to zero or to the output needed for a bumpless start.
+ */
+void PI_Loop_Reset( PI_Loop_t* p_loop, float integral );
+
+/**
+ * Function PI_Loop_Update steps the loop one update period and returns the saturated output.
+ * @param p_loop pointer to the loop
+ * @param error target minus measurement
+ * @param feedforward feedforward input (scaled by kff)
+ * @return saturated control output
+ */
+float PI_Loop_Update( PI_Loop_t* p_loop, float error, float feedforward );
+
+/**
+ * Function Cascade_Init zeros the integral and output of both loops without touching their gains, e.g. to restart the
+ * controller from rest. The gains are set with PI_Loop_Init on p_cont->position and p_cont->velocity, before or after
+ * this call.
+ */
+void Cascade_Init( Cascade_Controller_t* p_cont );
+
+/**
+ * Function Cascade_Update runs the position loop then the velocity loop.  The trajectory velocity is used as
+ * feedforward for both loops (position kff is normally 1, velocity kff is the actuator command per unit speed).
+ * @param p_cont pointer to the cascade
+ * @param target_pos trajectory position
+ * @param target_vel trajectory velocity
+ * @param measured_pos measured position
+ * @param measured_vel measured velocity
+ * @return saturated actuator command
+ */
+float Cascade_Update( Cascade_Controller_t* p_cont, float target_pos, float target_vel, float measured_pos, float measured_vel );
+
+/**
+ * Function Cascade_Update_Velocity runs only the inner velocity loop, for velocity-mode driving.
+ */
+float Cascade_Update_Velocity( Cascade_Controller_t* p_cont, float target_vel, float measured_vel );
+
 #endif
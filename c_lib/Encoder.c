@@ -1,4 +1,5 @@
 #include "Encoder.h"
+#include "Benchmark_Probe.h"
 
 #define PI 3.142857
 /**
@@ -138,15 +139,15 @@ float Rad_Right()
  */
 ISR(PCINT0_vect)
 {
+	BENCH_PROBE_BEGIN(BENCH_ENCODER_LEFT_ISR);
 	if (_last_left_XOR != Left_XOR()) {
 		_left_counts += (_last_left_B^Left_A()) - (_last_left_A^Left_B());
 
 		_last_left_A = Left_A();
 		_last_left_B = Left_B();
 		_last_left_XOR = Left_XOR();
-		return;
 	}
-	else return;	
+	BENCH_PROBE_END(BENCH_ENCODER_LEFT_ISR);
 }
 
 
@@ -156,9 +157,10 @@ ISR(PCINT0_vect)
  */
 ISR(INT6_vect)
 {
+	BENCH_PROBE_BEGIN(BENCH_ENCODER_RIGHT_ISR);
 	_right_counts += (_last_right_B ^ Right_A()) - (_last_right_A ^ Right_B());
 
 	_last_right_A = Right_A();
 	_last_right_B = Right_B();
-	return;
+	BENCH_PROBE_END(BENCH_ENCODER_RIGHT_ISR);
 }
@@ -20,7 +20,6 @@
  */
 void  Filter_Init ( Filter_Data_t* p_filt, float* numerator_coeffs, float* denominator_coeffs, uint8_t order )
 {
-    _filter_order = order;
     int i;
     rb_initialize_F(&p_filt->numerator);
     rb_initialize_F(&p_filt->denominator);
@@ -46,7 +45,8 @@ void  Filter_Init ( Filter_Data_t* p_filt, float* numerator_coeffs, float* denom
 void  Filter_ShiftBy( Filter_Data_t* p_filt, float shift_amount )
 {
     int i;
-    for (i = 0; i <= _filter_order; ++i) {
+    uint8_t order = rb_length_F(&p_filt->numerator) - 1;
+    for (i = 0; i <= order; ++i) {
         rb_set_F(&p_filt->in_list, i, rb_get_F(&p_filt->in_list,i)+shift_amount );
         rb_set_F(&p_filt->out_list, i, rb_get_F(&p_filt->out_list,i)+shift_amount);
     }
@@ -79,17 +79,18 @@ void Filter_SetTo( Filter_Data_t* p_filt, float amount )
 float Filter_Value( Filter_Data_t* p_filt, float value)
 {
     float ret_val=0;
+    uint8_t order = rb_length_F(&p_filt->numerator) - 1;
 
     /* Update the filter*/
     // push value to front of input
     rb_push_front_F(&p_filt->in_list, value);
     rb_pop_back_F(&p_filt->in_list);
 
-    for (int i = 1; i <= _filter_order; ++i) {
+    for (int i = 1; i <= order; ++i) {
         ret_val -= rb_get_F(&p_filt->denominator, i) * rb_get_F(&p_filt->out_list, i-1);
     }
 
-    for (int i = 0; i <= _filter_order; ++i) {
+    for (int i = 0; i <= order; ++i) {
         ret_val += rb_get_F(&p_filt->numerator, i) * rb_get_F(&p_filt->in_list, i);
     }
     ret_val /= rb_get_F(&p_filt->denominator, 0);
@@ -98,7 +99,6 @@ float Filter_Value( Filter_Data_t* p_filt, float value)
     rb_push_front_F(&p_filt->out_list, ret_val);
     rb_pop_back_F(&p_filt->out_list);
 
-    last_filter_val = ret_val;
     return ret_val;
 }
 
@@ -108,5 +108,5 @@ float Filter_Value( Filter_Data_t* p_filt, float value)
  */
 float Filter_Last_Output( Filter_Data_t* p_filt )
 {
-    return last_filter_val;
+    return rb_get_F(&p_filt->out_list, 0);
 }
\ No newline at end of file
@@ -40,9 +40,10 @@
 
 #include "Ring_Buffer.h"
 
-uint8_t _filter_order;
-float last_filter_val;
-
+/**
+ * All of a filter's state lives in its Filter_Data_t (the order is the coefficient count less one), so any number of
+ * filters of different orders can run side by side, including from different threads in host builds.
+ */
 typedef struct { struct Ring_Buffer_F numerator; struct Ring_Buffer_F denominator; struct Ring_Buffer_F out_list; struct Ring_Buffer_F in_list; } Filter_Data_t;
 
 /**
@@ -39,6 +39,70 @@ static inline void MSG_FLAG_Init(MSG_FLAG_t* p_flag)
     p_flag->duration = -1;
     p_flag->last_trigger_time.millisec=0;
     p_flag->last_trigger_time.microsec=0;
+    p_flag->seq = -1;
+    p_flag->batch = 0;
+}
+
+static int16_t _rx_sequence = -1;   // sequence of the request being processed, -1 if it was not sequenced
+
+// '&' batch whose replies are being staged: its number (0 when none is open), the flags it set that have not fired
+// yet, and when it ran
+#define BATCH_HOLD_MAX 0.01  // seconds a batch waits for its flags before its replies go out anyway
+static uint8_t _batch_id = 0;
+static uint8_t _batch_last_id = 0;
+static uint8_t _batch_pending = 0;
+static Time_t _batch_time;
+
+/**
+ * Function MSG_FLAG_Set activates a flag for the command being processed, remembering its sequence number.
+ */
+static inline void MSG_FLAG_Set(MSG_FLAG_t* p_flag)
+{
+    p_flag->active = true;
+    p_flag->seq = _rx_sequence;
+    if (_batch_id && p_flag->batch != _batch_id) {
+        p_flag->batch = _batch_id;      // the open batch's replies wait for this flag to fire
+        _batch_pending++;
+    }
+}
+
+static void Process_Command(char command);
+
+// Setpoint mailbox classes. Every command in a class sets the same values, so of several queued back to back only the
+// newest matters; the older ones are dropped unprocessed and counted in _coalesced.
+static const char* const _setpoint_classes[] = { "pP", "vV" };
+#define SETPOINT_CLASSES (sizeof(_setpoint_classes) / sizeof(_setpoint_classes[0]))
+static uint16_t _coalesced[SETPOINT_CLASSES];
+
+/**
+ * Function Setpoint_Class returns the mailbox class of a command, or -1 if it is not a setpoint command.
+ */
+static int8_t Setpoint_Class(char command)
+{
+    for (uint8_t i = 0; i < SETPOINT_CLASSES; i++)
+        for (const char* c = _setpoint_classes[i]; *c; c++)
+            if (*c == command)
+                return i;
+    return -1;
+}
+
+#define BATCH_MAX_LEN 59  // sub-command bytes in an '&' batch, all of it with a '#' prefix has to fit the receive buffer
+
+/**
+ * Function Message_Ready checks if every byte of the command index bytes into the receive buffer has arrived. For an
+ * '&' batch that is the whole batch. Unknown commands, and batches that could never fit, count as ready so
+ * Process_Command can reject them.
+ */
+static bool Message_Ready(uint8_t index)
+{
+    char command = usb_msg_peek_ahead(index);
+    uint16_t len = MEGN540_Message_Len(command);
+    if (command == '&' && usb_msg_length() >= index + 2) {
+        if (usb_msg_peek_ahead(index + 1) > BATCH_MAX_LEN)
+            return true;
+        len += usb_msg_peek_ahead(index + 1);
+    }
+    return usb_msg_length() >= index + len;
 }
 
 
@@ -54,12 +118,13 @@ bool MSG_FLAG_Execute( MSG_FLAG_t* p_flag)
     // What is the logic to indicate an action should be executed?
     // For Lab 1, ignore the timing part.
     if (p_flag->active == true){
-        // lower case t call
-        if (p_flag->duration < 0) {
-            return true;
-        }
-        // upercase T call
-        else if (p_flag->duration <= SecondsSince(&p_flag->last_trigger_time)) {
+        // lower case t call, or upercase T call once its time has come
+        if (p_flag->duration < 0 || p_flag->duration <= SecondsSince(&p_flag->last_trigger_time)) {
+            if (p_flag->batch) {
+                if (p_flag->batch == _batch_id)
+                    _batch_pending--;   // its block runs now, its replies are staged before the batch goes out
+                p_flag->batch = 0;
+            }
             return true;
         }
     }
@@ -88,6 +153,18 @@ void Message_Handling_Init()
     MSG_FLAG_Init( &mf_send_sys );
     MSG_FLAG_Init( &mf_distance );
     MSG_FLAG_Init( &mf_velocity ); 
+    MSG_FLAG_Init( &mf_pwm_profile );
+    MSG_FLAG_Init( &mf_profile_dump );
+    MSG_FLAG_Init( &mf_profile_reset );
+    MSG_FLAG_Init( &mf_velocity_stream );
+    MSG_FLAG_Init( &mf_interpolator_config );
+
+    for (uint8_t i = 0; i < SETPOINT_CLASSES; i++)
+        _coalesced[i] = 0;
+
+    usb_send_batch_flush();
+    _batch_id = 0;
+    _batch_pending = 0;
     return;
 }
 
@@ -104,21 +181,70 @@ void Message_Handling_Task()
     // If it just is a USB thing, do it here, if it requires other hardware, do it in the main and
     // set a flag to have it done here.
 
+    // an open '&' batch goes out once every flag it set has fired (their blocks have run since), new commands wait
+    if (_batch_id) {
+        if (_batch_pending && SecondsSince(&_batch_time) < BATCH_HOLD_MAX)
+            return;
+        usb_send_batch_flush();
+        _batch_id = 0;
+        _batch_pending = 0;
+    }
+
     // Check to see if there is data in waiting
     if( !usb_msg_length() )
         return; // nothing to process...
 
     // Get Your command designator without removal so if their are not enough bytes yet, the command persists
     char command = usb_msg_peek();
-    
+    int16_t seq = -1;
+
+    if (command == '#') {
+        // sequenced request ['#'][sequence][command][data], wait for all of it before taking the prefix off
+        if (usb_msg_length() < 3)
+            return;
+        command = usb_msg_peek_ahead(2);
+        if (!Message_Ready(2))
+            return;
+        usb_msg_get();
+        seq = usb_msg_get();
+    }
     // check if mesasage is fully in buffer
-    if (usb_msg_length() < MEGN540_Message_Len(command))
+    else if (!Message_Ready(0))
         return;
+    else {
+        // setpoint mailbox: skip to the newest of the same class that has fully arrived right behind this one
+        int8_t setpoint_class = Setpoint_Class(command);
+        while (setpoint_class >= 0) {
+            usb_read_available();
+            uint8_t len = MEGN540_Message_Len(command);
+            char next = usb_msg_peek_ahead(len);
+            if (Setpoint_Class(next) != setpoint_class || !Message_Ready(len))
+                break;
+            for (uint8_t i = 0; i < len; i++)
+                usb_msg_get();
+            _coalesced[setpoint_class]++;
+            command = next;
+        }
+    }
         
     // send for testing as an echo function
     //usb_send_byte(usb_msg_get());
     //return;
 
+    // replies sent while processing, and by the flags set here, carry the sequence
+    _rx_sequence = seq;
+    usb_send_set_sequence(seq);
+    Process_Command(command);
+    _rx_sequence = -1;
+    usb_send_set_sequence(-1);
+}
+
+/**
+ * Function Process_Command runs one command whose bytes are all in the receive buffer, command character first.
+ * @param command [char] the command character (not yet removed)
+ */
+static void Process_Command(char command)
+{
     // process command
     switch( command )
     {
@@ -150,7 +276,7 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('~') )
             {
                 //then process your reset by setting the mf_restart flag
-                mf_restart.active = true;
+                MSG_FLAG_Set( &mf_restart );
             }
             break;
         case 't':
@@ -169,7 +295,7 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('e') )
             {
                 usb_msg_get();
-                mf_encoder_count.active = true;
+                MSG_FLAG_Set( &mf_encoder_count );
             }
             break;
         case 'E':
@@ -182,7 +308,7 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('b') )
             {
                 usb_msg_get();
-                mf_battery_voltage.active = true;
+                MSG_FLAG_Set( &mf_battery_voltage );
             }
             break;
         case 'B':
@@ -200,7 +326,7 @@ void Message_Handling_Task()
 		        usb_msg_read_into(&PWM_data.right_PWM, sizeof(PWM_data.right_PWM));
 		        PWM_data.time_limit = false;
 
-		        mf_set_PWM.active = true;	
+		        MSG_FLAG_Set( &mf_set_PWM );	
 	        }
 	        break;
         case 'P':
@@ -213,7 +339,7 @@ void Message_Handling_Task()
 		        usb_msg_read_into(&PWM_data.duration, sizeof(PWM_data.duration));
 		        PWM_data.time_limit = true;
 
-		        mf_set_PWM.active = true;
+		        MSG_FLAG_Set( &mf_set_PWM );
 		        mf_set_PWM.duration = PWM_data.duration/1000;    // in seconds
             }
             break;
@@ -221,21 +347,21 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('s') )
             {
                 usb_msg_get();
-		        mf_stop_PWM.active = true;
+		        MSG_FLAG_Set( &mf_stop_PWM );
             }
             break;
         case 'S':
             if( usb_msg_length() >= MEGN540_Message_Len('S') )
             {
                 usb_msg_get();
-                mf_stop_PWM.active = true;
+                MSG_FLAG_Set( &mf_stop_PWM );
             }
             break;
         case 'q':
             if( usb_msg_length() >= MEGN540_Message_Len('q') )
             {
                 usb_msg_get();
-		        mf_send_sys.active = true;
+		        MSG_FLAG_Set( &mf_send_sys );
 		        mf_send_sys.duration = -1;
             }
             break;
@@ -243,7 +369,7 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('Q') )
             {
                 usb_msg_get();
-   		        mf_send_sys.active = true;
+   		        MSG_FLAG_Set( &mf_send_sys );
 		        // float for calculating duration
    		        float dur;
    		        usb_msg_read_into(&dur, sizeof(dur));
@@ -259,28 +385,146 @@ void Message_Handling_Task()
             if( usb_msg_length() >= MEGN540_Message_Len('d') )
             {
                 usb_msg_get();
-		        mf_distance.active = true;
+		        // read linear and angular distance setpoints into distance_data
+		        usb_msg_read_into(&distance_data.linear, sizeof(distance_data.linear));
+		        usb_msg_read_into(&distance_data.angular, sizeof(distance_data.angular));
+		        distance_data.duration = 0;
+		        MSG_FLAG_Set( &mf_distance );
             }
             break;
         case 'D':
             if( usb_msg_length() >= MEGN540_Message_Len('D') )
             {
                 usb_msg_get();
-		        mf_distance.active = true;
+		        // read linear and angular distance setpoints and the duration (s) into distance_data
+		        usb_msg_read_into(&distance_data, sizeof(distance_data));
+		        MSG_FLAG_Set( &mf_distance );
+            }
+            break;
+        case 'f':
+            if( usb_msg_length() >= MEGN540_Message_Len('f') )
+            {
+                usb_msg_get();
+		        // read the PWM_Profile_t, applied (and range checked) by the main loop
+		        usb_msg_read_into(&PWM_data.profile, sizeof(PWM_data.profile));
+
+		        MSG_FLAG_Set( &mf_pwm_profile );
+            }
+            break;
+        case 'x':
+            if( usb_msg_length() >= MEGN540_Message_Len('x') )
+            {
+                usb_msg_get();
+		        MSG_FLAG_Set( &mf_profile_dump );
+            }
+            break;
+        case 'X':
+            if( usb_msg_length() >= MEGN540_Message_Len('X') )
+            {
+                usb_msg_get();
+		        MSG_FLAG_Set( &mf_profile_reset );
             }
             break;
         case 'v':
             if( usb_msg_length() >= MEGN540_Message_Len('v') )
             {
                 usb_msg_get();
-		        mf_velocity.active = true;
+		        // read linear and angular velocity setpoints into velocity_data
+		        usb_msg_read_into(&velocity_data.linear, sizeof(velocity_data.linear));
+		        usb_msg_read_into(&velocity_data.angular, sizeof(velocity_data.angular));
+		        velocity_data.duration = 0;
+		        MSG_FLAG_Set( &mf_velocity );
             }
             break;
         case 'V':
             if( usb_msg_length() >= MEGN540_Message_Len('V') )
             {
                 usb_msg_get();
-		        mf_velocity.active = true;
+		        // read linear and angular velocity setpoints and the duration (s) into velocity_data
+		        usb_msg_read_into(&velocity_data, sizeof(velocity_data));
+		        MSG_FLAG_Set( &mf_velocity );
+            }
+            break;
+        case 'o':
+            if( usb_msg_length() >= MEGN540_Message_Len('o') )
+            {
+                // reply with the USB buffer high-water marks and the drop table, one cH per USB_DROP_SLOTS
+                usb_msg_get();
+                usb_send_msg("cBBBHcHcHcHcHcHcH", command, (void*)usb_send_stats(), sizeof(USB_Send_Stats_t));
+            }
+            break;
+        case 'l':
+            if( usb_msg_length() >= MEGN540_Message_Len('l') )
+            {
+                // reply with the send latency of replies then telemetry
+                usb_msg_get();
+                usb_send_msg("cIIHIIH", command, (void*)usb_send_latency(), 2 * sizeof(USB_Latency_t));
+            }
+            break;
+        case 'O':
+            if( usb_msg_length() >= MEGN540_Message_Len('O') )
+            {
+                usb_msg_get();
+                usb_send_stats_reset();
+            }
+            break;
+        case 'z':
+            if( usb_msg_length() >= MEGN540_Message_Len('z') )
+            {
+                usb_msg_get();
+		        // read the host time stamp and the linear and angular velocity, interpolated by the main loop
+		        usb_msg_read_into(&velocity_stream, sizeof(velocity_stream));
+		        MSG_FLAG_Set( &mf_velocity_stream );
+            }
+            break;
+        case 'Z':
+            if( usb_msg_length() >= MEGN540_Message_Len('Z') )
+            {
+                usb_msg_get();
+		        // read the interpolator acceleration and jerk limits, delay and timeout
+		        usb_msg_read_into(&interpolator_config, sizeof(interpolator_config));
+		        MSG_FLAG_Set( &mf_interpolator_config );
+            }
+            break;
+        case 'k':
+            if( usb_msg_length() >= MEGN540_Message_Len('k') )
+            {
+                // reply with how many setpoints the mailbox dropped, PWM ('p'/'P') then velocity ('v'/'V')
+                usb_msg_get();
+                usb_send_msg("cHH", command, _coalesced, sizeof(_coalesced));
+            }
+            break;
+        case '&':
+            if( usb_msg_length() >= MEGN540_Message_Len('&') )
+            {
+                // ['&'][uint8_t n][n bytes of commands], run in order with all their replies sent as one frame
+                usb_msg_get();
+                uint8_t remaining = usb_msg_get();
+                if( remaining > BATCH_MAX_LEN ) {
+                    usb_send_msg("cc", '?', &command, sizeof(command));
+                    usb_flush_input_buffer();
+                    break;
+                }
+
+                usb_send_batch_begin();
+                if( ++_batch_last_id == 0 )
+                    _batch_last_id = 1;     // 0 means no batch is open
+                _batch_id = _batch_last_id;
+                _batch_pending = 0;
+                _batch_time = GetTime();
+                while( remaining ) {
+                    char sub = usb_msg_peek();
+                    uint8_t len = MEGN540_Message_Len(sub);
+                    if( len == 0 || len > remaining || sub == '&' ) {
+                        // the rest can't be split into commands, report it and drop it
+                        usb_send_msg("cc", '?', &sub, sizeof(sub));
+                        while( remaining-- )
+                            usb_msg_get();
+                        break;
+                    }
+                    Process_Command(sub);
+                    remaining -= len;
+                }
             }
             break;
         default:
@@ -335,15 +579,15 @@ void tCase(char command){
     switch(num){
         //Time Now
         case 0: ;
-            mf_send_time.active = true;
+            MSG_FLAG_Set( &mf_send_time );
             return;
         //Time to send float
         case 1: ;
-            mf_time_float_send.active = true;
+            MSG_FLAG_Set( &mf_time_float_send );
             return;
         //Time to complete a full loop iteration
         case 2: ;
-            mf_loop_timer.active = true;
+            MSG_FLAG_Set( &mf_loop_timer );
             return;
         default:
             usb_send_msg("c", command, "?", sizeof("?"));
@@ -372,17 +616,17 @@ void TCase(char command){
     switch(num){
         //Time Now
         case 0: ;
-            mf_send_time.active = true;
+            MSG_FLAG_Set( &mf_send_time );
             mf_send_time.duration = dur/1000;
             return;
         //Time to send float
         case 1: ;
-            mf_time_float_send.active = true;
+            MSG_FLAG_Set( &mf_time_float_send );
             mf_time_float_send.duration = dur/1000;
             return;
         //Time to complete a full loop iteration
         case 2: ;
-            mf_loop_timer.active = true;
+            MSG_FLAG_Set( &mf_loop_timer );
             mf_loop_timer.duration = dur/1000;
             return;
         default:
@@ -402,7 +646,7 @@ void ECase(char command){
         mf_encoder_count.duration = -1;
         return;
     }
-    mf_encoder_count.active = true;
+    MSG_FLAG_Set( &mf_encoder_count );
     mf_encoder_count.duration = dur/1000;
 }
 
@@ -417,7 +661,7 @@ void BCase(char command){
         mf_battery_voltage.duration = -1;
         return;
     }
-    mf_battery_voltage.active = true;
+    MSG_FLAG_Set( &mf_battery_voltage );
     mf_battery_voltage.duration = dur/1000;
 }
 
@@ -458,6 +702,16 @@ uint8_t MEGN540_Message_Len( char cmd )
         case 'D': return	13; break;
         case 'v': return	9; break;
         case 'V': return	13; break;
+        case 'f': return	2; break;
+        case 'x': return	1; break;
+        case 'X': return	1; break;
+        case 'o': return	1; break;
+        case 'O': return	1; break;
+        case 'l': return	1; break;
+        case 'z': return	13; break;
+        case 'Z': return	17; break;
+        case 'k': return	1; break;
+        case '&': return	2; break; // plus the batch length in its second byte
         default:  return	0; break;
     }
 }
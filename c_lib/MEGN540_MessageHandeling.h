@@ -38,8 +38,10 @@
 #include "SerialIO.h"
 #include "Timing.h"
 
-/** Message Driven State Machine Flags */
-typedef struct MSG_FLAG { bool active; float duration; Time_t last_trigger_time; } MSG_FLAG_t;
+/** Message Driven State Machine Flags. seq is the sequence number of the '#' request that set the flag (-1 if it was
+ *  not sequenced); replies sent when the flag fires echo it. batch is non-zero while an '&' batch that set the flag is
+ *  waiting for it to fire (see Message_Handling_Task). */
+typedef struct MSG_FLAG { bool active; float duration; Time_t last_trigger_time; int16_t seq; uint8_t batch; } MSG_FLAG_t;
 
 
 MSG_FLAG_t mf_restart;       	///<-- This flag indicates that the device received a restart command from the hoast. Default inactive.
@@ -53,10 +55,30 @@ MSG_FLAG_t mf_stop_PWM; 	/// Indicates if the system should stop PWM and disable
 MSG_FLAG_t mf_send_sys; 	/// Indicates if the system should send system identification
 MSG_FLAG_t mf_distance; 	/// Indicates if the system should drive a distance
 MSG_FLAG_t mf_velocity; 	/// Indicates if the system should speed up to a velocity
+MSG_FLAG_t mf_pwm_profile; 	/// Indicates if the system should switch PWM frequency profile (PWM_data.profile)
+MSG_FLAG_t mf_profile_dump; 	/// Indicates if the system should send the profiler table (stays active until all probes are sent)
+MSG_FLAG_t mf_profile_reset; 	/// Indicates if the system should clear the profiler table
+MSG_FLAG_t mf_velocity_stream; 	/// Indicates a timestamped velocity setpoint ('z') is waiting in velocity_stream
+MSG_FLAG_t mf_interpolator_config; /// Indicates new setpoint interpolator settings ('Z') are waiting in interpolator_config
+
+/** Latest 'd'/'D' distance setpoint. linear in meters, angular in radians, duration in seconds, 0 for 'd'. */
+struct __attribute__((__packed__)) { float linear; float angular; float duration; } distance_data;
+
+/** Latest 'v'/'V' velocity setpoint. linear in m/s, angular in rad/s, duration in seconds, 0 for 'v' (no time limit). */
+struct __attribute__((__packed__)) { float linear; float angular; float duration; } velocity_data;
+
+/** Latest 'z' setpoint: the host's send time (s) and the linear and angular velocity, see Setpoint_Interpolator.h */
+struct __attribute__((__packed__)) { float time; float linear; float angular; } velocity_stream;
+
+/** Latest 'Z' settings for the setpoint interpolators, see Setpoint_Interpolator_Limits */
+struct __attribute__((__packed__)) { float max_accel; float max_jerk; float delay; float timeout; } interpolator_config;
 
 /**
  * Function MSG_FLAG_Execute indicates if the action associated with the message flag should be executed
- * in the main loop both because its active and because its time.
+ * in the main loop both because its active and because its time. Replies the action sends should go out with
+ * usb_send_msg_seq and the flag's seq, so a sequenced request gets them wrapped with its sequence number.
+ * It does not change what or how anything is sent. Its only bookkeeping is for '&' batches: the first time a flag
+ * set by a batch fires, the batch stops waiting for it.
  * @return [bool] True for execute action, False for skip action
  */
 bool MSG_FLAG_Execute( MSG_FLAG_t* p_flag);
@@ -70,6 +92,29 @@ void Message_Handling_Init();
 /**
  * Function Message_Handler processes USB messages as necessary and sets status flags to control the flow of the program.
  * It returns true unless the program receives a reset message.
+ *
+ * Any command can be sent as a sequenced request, ['#'][uint8_t sequence][command][data]. Every reply to it, sent right
+ * away or when the flags it set fire, comes back wrapped with the sequence (see usb_send_msg_seq), so the host
+ * can keep several requests in flight.
+ *
+ * Commands can also be sent together as a batch, ['&'][uint8_t n][n bytes of commands] with n at most 59. They run in
+ * order and their replies, including those sent by the flags they set, come back in one frame (see
+ * usb_send_batch_begin). The frame goes out at the first Message_Handling_Task after every one of those flags has
+ * fired, so the flag's main loop block has run, however the loop is ordered. New commands wait until then. A batch
+ * waits at most BATCH_HOLD_MAX seconds for its flags (a lab may not handle some of them), and replies that would
+ * overflow USB_BATCH_SIZE bytes go out early in a frame of their own.
+ *
+ * Setpoint commands ('p'/'P' and 'v'/'V') are handled as a latest-value mailbox. When several of one kind have
+ * queued up back to back, only the newest is applied and the older ones are dropped. 'k' replies with how many were
+ * dropped for each kind ("cHH": PWM, velocity).
+ *
+ * 'z' [float host time][float linear][float angular] is a timestamped velocity setpoint for the setpoint interpolators
+ * (Setpoint_Interpolator.h), and 'Z' [float max accel][float max jerk][float delay][float timeout] configures them.
+ *
+ * 'o' replies with the USB buffer accounting of usb_send_stats ("cBBBHcHcHcHcHcHcH": send, receive and telemetry
+ * high-water marks, total messages dropped for lack of send buffer space, then (command, drops) pairs). 'l' replies
+ * with the send latency of usb_send_latency ("cIIHIIH": frames, total and max microseconds for replies, then the same
+ * for telemetry), and 'O' zeroes both.
  * @return
  */
 void Message_Handling_Task();
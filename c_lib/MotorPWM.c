@@ -53,6 +53,71 @@
 #include "MotorPWM.h"
 #include "SerialIO.h"
 
+/**
+ * Cached copy of ICR1 (TOP) and the volts to counts scale used by the voltage command layer.
+ * _volts_to_counts = TOP / battery volts, recomputed whenever either changes.
+ */
+static uint16_t _pwm_top = 0;
+static float _supply_volts_inv = 0;
+static float _volts_to_counts = 0;
+
+/**
+ * Direction pins (PB2 left, PB1 right) and the direction bits waiting for the next BOTTOM. Written by Motor_PWM_Set
+ * and applied by the TIMER1_OVF ISR. A motor whose direction is switching runs at zero duty until the switch;
+ * _dir_ocr_a/b hold the duty it gets afterwards.
+ */
+#define MOTOR_DIR_MASK ((1 << PORTB1) | (1 << PORTB2))
+static volatile uint8_t _pending_dir = 0;
+static volatile uint16_t _dir_ocr_a = 0;
+static volatile uint16_t _dir_ocr_b = 0;
+
+/**
+ * Counts before BOTTOM the TIMER1_CAPT ISR needs to write OCR1A/B ahead of the latch, see Motor_PWM_Set_Profile.
+ */
+#define PWM_TOP_CHANGE_MARGIN 16
+
+/**
+ * PWM profiles. TOP sets both the frequency, 16MHz / (2 * TOP), and the duty resolution, TOP counts.
+ * Lower frequencies give finer duty steps and lower switching losses but are audible.
+ */
+static const uint16_t _profile_top[PWM_PROFILE_COUNT] = {
+	1023,	// PWM_PROFILE_HIGH_RES    ~7.8 kHz, 10 bit
+	380,	// PWM_PROFILE_DEFAULT     ~21 kHz
+	200,	// PWM_PROFILE_ULTRASONIC  40 kHz, ~7.6 bit
+	80	// PWM_PROFILE_MAX_FREQ    100 kHz, ~6.3 bit
+};
+static uint8_t _profile = PWM_PROFILE_DEFAULT;
+
+/**
+ * TOP change waiting for the next TIMER1_CAPT (TOP) interrupt, and the duty values (already in the new TOP's counts)
+ * to go with it. _pending_top is 0 when no change is pending.
+ */
+static volatile uint16_t _pending_top = 0;
+static volatile uint16_t _pending_ocr_a = 0;
+static volatile uint16_t _pending_ocr_b = 0;
+
+/**
+ * Duty writes go through these so a write made while a TOP change is pending lands with the new TOP rather than
+ * being applied against the old one. Call with interrupts disabled.
+ */
+static inline void _write_ocr_a( uint16_t count )
+{
+	if (_pending_top) _pending_ocr_a = count;
+	else OCR1A = count;
+}
+static inline void _write_ocr_b( uint16_t count )
+{
+	if (_pending_top) _pending_ocr_b = count;
+	else OCR1B = count;
+}
+
+/**
+ * Command watchdog state, counted down once a millisecond in the TIMER0_COMPB ISR.
+ */
+#define MOTOR_PWM_COM_MASK ((1 << COM1A1) | (1 << COM1A0) | (1 << COM1B1) | (1 << COM1B0))
+static uint16_t _watchdog_timeout_ms = 0;
+static volatile uint16_t _watchdog_count_ms = 0;
+static volatile bool _watchdog_tripped = false;
 
 /**
  * Function data_init() initializes left_PWM, right_PWM, and duration in the PWM_data struct to 0s
@@ -79,8 +144,19 @@ void Motor_PWM_Init( uint16_t MAX_PWM )
 	sei();
 	SREG = sreg;
 
-	TCCR1B |= (1 << WGM13) | (1 << CS10);		// phase correct mode and no prescaling
-	TCCR1A |= (1 << COM1A1) | (1 << COM1B1) | (1 << WGM11);	// set OC1A/OC1B as outputs from right and left motors
+	// Mode 8: phase and frequency correct, TOP = ICR1, no prescaling. Same waveform as phase correct for a fixed TOP,
+	// but OCR1A/B latch at BOTTOM so TOP can be changed at run time without glitches (see Motor_PWM_Set_Profile).
+	TCCR1B |= (1 << WGM13) | (1 << CS10);
+	TCCR1A &= ~((1 << WGM11) | (1 << WGM10));	// OC1A/OC1B are connected by Motor_PWM_Enable
+	TIMSK1 &= ~((1 << ICIE1) | (1 << TOIE1));
+
+	DDRB |= (1 << DDB1) | (1 << DDB2);		// direction pins as outputs, forward
+	PORTB &= ~MOTOR_DIR_MASK;
+	DDRB |= (1 << DDB5) | (1 << DDB6);		// PWM pins as outputs, held low while disconnected
+	PORTB &= ~((1 << PORTB5) | (1 << PORTB6));
+	_pending_dir = 0;
+	_pending_top = 0;
+	_profile = PWM_PROFILE_DEFAULT;
 
 	PWM_data_init();
 	Motor_PWM_Enable(0);
@@ -90,13 +166,18 @@ void Motor_PWM_Init( uint16_t MAX_PWM )
 }
 
 /**
- * Function MotorPWM_Enable enables or disables the motor PWM outputs.
+ * Function MotorPWM_Enable enables or disables the motor PWM outputs. Disabling disconnects OC1A/OC1B from the timer
+ * (COM1A/COM1B cleared, table 14-3) so PB5/PB6 fall back to their PORTB value, which is held low (motor driver brake).
  * @param [bool] enable (true set enable, false set disable)
  */
 void Motor_PWM_Enable( bool enable )
 {
-	if (enable) DDRB |= (1 << DDB5) | (1 << DDB6);
-	else DDRB |= (0 << DDB5) | (0 << DDB6);
+	unsigned char sreg = SREG;
+	cli();
+	if (enable) TCCR1A |= (1 << COM1A1) | (1 << COM1B1);	// clear on up-count match, set on down-count match
+	else TCCR1A &= ~MOTOR_PWM_COM_MASK;			// normal port operation, OC1A/OC1B disconnected
+	sei();
+	SREG = sreg;
 }
 
 /**
@@ -105,7 +186,7 @@ void Motor_PWM_Enable( bool enable )
  */
 bool Is_Motor_PWM_Enabled()
 {
-	if ( bit_is_set(DDRB, DDB5) && bit_is_set(DDRB, DDB6)) return true;
+	if ( bit_is_set(TCCR1A, COM1A1) && bit_is_set(TCCR1A, COM1B1)) return true;
 	else return false;
 }
 
@@ -117,7 +198,7 @@ void Motor_PWM_Left( int16_t pwm )
 {
 	unsigned char sreg = SREG;
 	cli();
-	OCR1B = pwm;
+	_write_ocr_b(pwm);
 	sei();
 	SREG = sreg;
 }
@@ -130,9 +211,159 @@ void Motor_PWM_Right( int16_t pwm )
 {
 	unsigned char sreg = SREG;
 	cli();
-	OCR1A = pwm;
+	_write_ocr_a(pwm);
+	sei();
+	SREG = sreg;
+}
+
+/**
+ * Function Motor_PWM_Set sets signed duty counts for both motors in one call. The magnitudes, limited to the active
+ * TOP, go to OCR1B/OCR1A, which the timer latches at BOTTOM.
+ *
+ * The output pulse is centered on BOTTOM, so a direction pin can't simply switch at the BOTTOM the new duty latches:
+ * the output is high there. A motor changing direction instead gets zero duty first. The Timer 1 BOTTOM interrupt
+ * switches its pin once that zero has latched, when its output is low for the whole period however late the
+ * interrupt runs, and then writes the new duty, which starts at the following BOTTOM. The cost is one period at zero
+ * duty on a reversal; there is never a pulse in the wrong direction.
+ * @param [int16_t] left signed duty for the left motor (negative is reverse)
+ * @param [int16_t] right signed duty for the right motor (negative is reverse)
+ */
+void Motor_PWM_Set( int16_t left, int16_t right )
+{
+	uint8_t dir = 0;
+	if (left < 0) {
+		dir |= (1 << PORTB2);
+		left = (left < -INT16_MAX) ? INT16_MAX : -left;	// -INT16_MIN does not fit
+	}
+	if (right < 0) {
+		dir |= (1 << PORTB1);
+		right = (right < -INT16_MAX) ? INT16_MAX : -right;
+	}
+	// duties are in the active profile's counts, anything past TOP would silently run at full duty
+	if (left > _pwm_top) left = _pwm_top;
+	if (right > _pwm_top) right = _pwm_top;
+
+	unsigned char sreg = SREG;
+	cli();
+	uint8_t was_switching = (TIMSK1 & (1 << TOIE1)) ? (PORTB & MOTOR_DIR_MASK) ^ _pending_dir : 0;
+	uint8_t switching = (PORTB & MOTOR_DIR_MASK) ^ dir;
+	_pending_dir = dir;
+	_dir_ocr_b = left;
+	_dir_ocr_a = right;
+	_write_ocr_b((switching & (1 << PORTB2)) ? 0 : left);
+	_write_ocr_a((switching & (1 << PORTB1)) ? 0 : right);
+	if (!switching) {
+		TIMSK1 &= ~(1 << TOIE1);		// nothing to switch (or a pending switch was cancelled)
+	}
+	else {
+		// TOV1 sets every BOTTOM, clear a stale one so the switch waits for the BOTTOM that latches a newly
+		// written zero. With a TOP change pending the zero goes out from TIMER1_CAPT and the ISR waits for it.
+		if ((switching & ~was_switching) && !_pending_top)
+			TIFR1 = (1 << TOV1);
+		TIMSK1 |= (1 << TOIE1);
+	}
+	sei();
+	SREG = sreg;
+}
+
+/**
+ * Function Motor_Voltage_Set commands both motors in volts using Motor_Volts_To_PWM and Motor_PWM_Set.
+ */
+void Motor_Voltage_Set( float left_volts, float right_volts )
+{
+	Motor_PWM_Set(Motor_Volts_To_PWM(left_volts), Motor_Volts_To_PWM(right_volts));
+}
+
+/**
+ * Timer 1 BOTTOM (TOV1) interrupt, only enabled while a direction change is pending. The switching motors' zero duty
+ * was latched on this BOTTOM, so their outputs stay low until the next one: switch their pins, then give them the
+ * new duty, which latches at that next BOTTOM.
+ */
+ISR(TIMER1_OVF_vect)
+{
+	if (_pending_top) return;			// the zero duty goes out with the TOP change, wait for the BOTTOM after it
+
+	uint8_t switching = (PORTB & MOTOR_DIR_MASK) ^ _pending_dir;
+	PORTB ^= switching;
+	if (switching & (1 << PORTB2)) _write_ocr_b(_dir_ocr_b);
+	if (switching & (1 << PORTB1)) _write_ocr_a(_dir_ocr_a);
+	TIMSK1 &= ~(1 << TOIE1);
+}
+
+/**
+ * Function Motor_PWM_Set_Profile switches to one of the PWM_Profile_t frequency/resolution profiles at run time.
+ * The current duty is rescaled to the new TOP so the motors keep the same duty cycle.
+ *
+ * ICR1 is not double buffered, so it is written from the TOP interrupt: while counting down from TOP the counter
+ * never compares against TOP, so the new value first applies on the next up-count. The rescaled OCR1A/B are written
+ * in the same interrupt and latch at the BOTTOM in between, so the new TOP and duty start on the same BOTTOM. If the
+ * interrupt runs too late for that (BOTTOM has passed, or is under PWM_TOP_CHANGE_MARGIN counts away) it leaves
+ * everything as it is and tries again at the next TOP.
+ * @param [uint8_t] profile a PWM_Profile_t
+ * @return [uint16_t] the new TOP, or 0 if the profile is not valid
+ */
+uint16_t Motor_PWM_Set_Profile( uint8_t profile )
+{
+	if (profile >= PWM_PROFILE_COUNT) return 0;
+
+	uint16_t new_top = _profile_top[profile];
+	uint16_t old_top = _pwm_top;
+
+	unsigned char sreg = SREG;
+	cli();
+	if (!_pending_top) {
+		_pending_ocr_a = OCR1A;
+		_pending_ocr_b = OCR1B;
+		old_top = ICR1;
+	}
+	// rescale whatever is (or is waiting to be) the duty, from the old TOP's counts to the new one
+	_pending_ocr_a = ((uint32_t)_pending_ocr_a * new_top + old_top/2) / old_top;
+	_pending_ocr_b = ((uint32_t)_pending_ocr_b * new_top + old_top/2) / old_top;
+	_dir_ocr_a = ((uint32_t)_dir_ocr_a * new_top + old_top/2) / old_top;
+	_dir_ocr_b = ((uint32_t)_dir_ocr_b * new_top + old_top/2) / old_top;
+	if (!_pending_top) {
+		// ICF1 sets every TOP, clear the stale one so we wait for the next. TOV1 tells TIMER1_CAPT whether BOTTOM
+		// has passed since that TOP; TIMER1_OVF keeps it clear while it is enabled, otherwise it is cleared here.
+		TIFR1 = (1 << ICF1);
+		if (!(TIMSK1 & (1 << TOIE1))) TIFR1 = (1 << TOV1);
+		TIMSK1 |= (1 << ICIE1);
+	}
+	_pending_top = new_top;
 	sei();
 	SREG = sreg;
+
+	// new commands are in the new TOP's counts from here on
+	_profile = profile;
+	_pwm_top = new_top;
+	_volts_to_counts = _pwm_top * _supply_volts_inv;
+	return new_top;
+}
+
+/**
+ * Function Get_Motor_PWM_Profile returns the active (or pending) PWM_Profile_t.
+ */
+uint8_t Get_Motor_PWM_Profile()
+{
+	return _profile;
+}
+
+/**
+ * Timer 1 TOP (ICF1) interrupt, only enabled while a TOP change is pending. It must finish before BOTTOM: after it
+ * the OCRs would latch a period late, against the new TOP, and a TCNT1 already above a lower new TOP on the up-count
+ * would run on to 0xFFFF. TOV1 set means BOTTOM has passed since this TOP; then, or when BOTTOM is too close, the
+ * change is left armed for the next TOP.
+ */
+ISR(TIMER1_CAPT_vect)
+{
+	if ((TIFR1 & (1 << TOV1)) || TCNT1 < PWM_TOP_CHANGE_MARGIN) {
+		if (!(TIMSK1 & (1 << TOIE1))) TIFR1 = (1 << TOV1);	// ours while TIMER1_OVF is off, clear for next TOP
+		return;
+	}
+	OCR1A = _pending_ocr_a;
+	OCR1B = _pending_ocr_b;
+	ICR1 = _pending_top;
+	_pending_top = 0;
+	TIMSK1 &= ~(1 << ICIE1);
 }
 
 /**
@@ -194,6 +425,102 @@ void Set_MAX_Motor_PWM( uint16_t MAX_PWM )
 	unsigned char sreg = SREG;
 	cli();
 	ICR1 = MAX_PWM;
+	_pending_top = 0;				// overrides any pending profile switch
+	TIMSK1 &= ~(1 << ICIE1);
 	sei();
 	SREG = sreg;
+
+	_pwm_top = MAX_PWM;
+	_volts_to_counts = _pwm_top * _supply_volts_inv;
+}
+
+/**
+ * Function Motor_PWM_Set_Supply_Voltage stores the latest (filtered) battery voltage for the voltage command layer.
+ * The reciprocal is taken here, once per battery update, so converting volts to counts is a single multiply.
+ * @param [float] battery_volts the filtered battery voltage
+ */
+void Motor_PWM_Set_Supply_Voltage( float battery_volts )
+{
+	_supply_volts_inv = (battery_volts > MOTOR_MIN_SUPPLY_VOLTS) ? 1.0f/battery_volts : 0;
+	_volts_to_counts = _pwm_top * _supply_volts_inv;
+}
+
+/**
+ * Function Motor_Volts_To_PWM converts a desired motor voltage into signed PWM counts scaled to Get_MAX_Motor_PWM()
+ * using the last supply voltage, saturating at full duty. Returns 0 until a usable supply voltage has been set.
+ * @param [float] volts desired average motor voltage, sign gives direction
+ * @return [int16_t] signed duty count
+ */
+int16_t Motor_Volts_To_PWM( float volts )
+{
+	float counts = volts * _volts_to_counts;
+	if (counts > _pwm_top) return _pwm_top;
+	if (counts < -(float)_pwm_top) return -_pwm_top;
+	return (int16_t) counts;
+}
+
+/**
+ * Function Motor_PWM_Watchdog_Init sets the command timeout watchdog. It runs off the Timer 0 compare B interrupt
+ * (1 kHz, see Timing.h) so SetupTimer0 must have been called. A timeout of 0 turns the watchdog off.
+ * @param [uint16_t] timeout_ms milliseconds without a feed before the motors are braked and disabled
+ */
+void Motor_PWM_Watchdog_Init( uint16_t timeout_ms )
+{
+	unsigned char sreg = SREG;
+	cli();
+	_watchdog_timeout_ms = timeout_ms;
+	_watchdog_count_ms = 0;
+	_watchdog_tripped = false;
+	OCR0B = 125;				// half way through each Timer 0 millisecond, away from the COMPA reset
+	if (timeout_ms) TIMSK0 |= (1 << OCIE0B);
+	else TIMSK0 &= ~(1 << OCIE0B);
+	sei();
+	SREG = sreg;
+}
+
+/**
+ * Function Motor_PWM_Watchdog_Feed restarts the watchdog countdown. Call it whenever a new setpoint arrives.
+ * @param [uint16_t] hold_ms extra time on top of the timeout, e.g. the duration of a timed 'P' command
+ */
+void Motor_PWM_Watchdog_Feed( uint16_t hold_ms )
+{
+	uint16_t count = _watchdog_timeout_ms + hold_ms;
+	if (count < hold_ms) count = UINT16_MAX;	// saturate rather than wrap
+
+	unsigned char sreg = SREG;
+	cli();
+	_watchdog_count_ms = _watchdog_timeout_ms ? count : 0;
+	sei();
+	SREG = sreg;
+}
+
+/**
+ * Function Motor_PWM_Watchdog_Tripped returns true (once) if the watchdog has stopped the motors since the last call.
+ */
+bool Motor_PWM_Watchdog_Tripped()
+{
+	unsigned char sreg = SREG;
+	cli();
+	bool tripped = _watchdog_tripped;	// read and clear together, a trip in between would be lost
+	_watchdog_tripped = false;
+	sei();
+	SREG = sreg;
+	return tripped;
+}
+
+/**
+ * Timer 0 compare B interrupt, once a millisecond. When the countdown runs out the duty is zeroed and the outputs are
+ * disconnected (pins held low) the same way Motor_PWM_Enable(false) does.
+ */
+ISR(TIMER0_COMPB_vect)
+{
+	if (_watchdog_count_ms && --_watchdog_count_ms == 0) {
+		OCR1A = 0;
+		OCR1B = 0;
+		_pending_ocr_a = 0;			// nor may a pending TOP change or direction switch bring the duty back
+		_pending_ocr_b = 0;
+		TIMSK1 &= ~(1 << TOIE1);
+		TCCR1A &= ~MOTOR_PWM_COM_MASK;
+		_watchdog_tripped = true;
+	}
 }
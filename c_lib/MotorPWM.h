@@ -45,6 +45,9 @@
  * Note that the base frequency with no prescalar is given by:
  *          16Mhz / (2 * TOP), where 2 is because were using the phase-corrected mode.
  *
+ * The timer runs in mode 8 (phase and frequency correct, TOP = ICR1). For a fixed TOP this is the same waveform as
+ * phase correct mode, but OCR1A/B are latched at BOTTOM, which lets TOP be changed at run time without glitches.
+ *
  * To Disable or enable the car's PWM functionality use table 14-3 to identify how to disconnect or connect the OC1A/B
  * output pin changes.
  *
@@ -57,7 +60,16 @@
 #include <ctype.h>         // For int32_t type
 #include <stdbool.h>       // For bool
 
-extern struct PWM_info { int16_t left_PWM; int16_t right_PWM; float duration; bool time_limit;} PWM_data; // duration in ms 
+extern struct PWM_info { int16_t left_PWM; int16_t right_PWM; float duration; bool time_limit; uint8_t profile;} PWM_data; // duration in ms 
+
+/**
+ * Named PWM frequency/resolution profiles for Motor_PWM_Set_Profile.
+ */
+typedef enum { PWM_PROFILE_HIGH_RES = 0,  ///<-- ~7.8 kHz, TOP 1023. Finest duty steps, lowest switching loss, audible.
+               PWM_PROFILE_DEFAULT,       ///<-- ~21 kHz, TOP 380. Just above hearing.
+               PWM_PROFILE_ULTRASONIC,    ///<-- 40 kHz, TOP 200.
+               PWM_PROFILE_MAX_FREQ,      ///<-- 100 kHz, TOP 80. Coarse duty, highest switching loss.
+               PWM_PROFILE_COUNT } PWM_Profile_t;
 
 struct PWM_info PWM_data;
 
@@ -76,7 +88,8 @@ void PWM_data_init();
 void Motor_PWM_Init( uint16_t MAX_PWM );
 
 /**
- * Function MotorPWM_Enable enables or disables the motor PWM outputs.
+ * Function MotorPWM_Enable enables or disables the motor PWM outputs. Disabling disconnects OC1A/OC1B from the timer
+ * (COM1A/COM1B cleared, table 14-3) so PB5/PB6 fall back to their PORTB value, which is held low (motor driver brake).
  * @param [bool] enable (true set enable, false set disable)
  */
 void Motor_PWM_Enable( bool enable );
@@ -99,6 +112,22 @@ void Motor_PWM_Left( int16_t pwm );
  */
 void Motor_PWM_Right( int16_t pwm );
 
+/**
+ * Function Motor_PWM_Set sets signed duty counts for both motors in one call. The magnitudes, limited to the TOP of
+ * the active (or pending) profile, go to OCR1B/OCR1A, which the timer latches at BOTTOM. A motor changing direction is
+ * first given zero duty; the Timer 1 BOTTOM interrupt switches its direction pin once that zero has latched (its
+ * output is then low for the whole period) and only then writes the new duty, which starts at the next BOTTOM. A
+ * reversal costs one period at zero duty and never drives a pulse in the wrong direction.
+ * @param [int16_t] left signed duty for the left motor (negative is reverse)
+ * @param [int16_t] right signed duty for the right motor (negative is reverse)
+ */
+void Motor_PWM_Set( int16_t left, int16_t right );
+
+/**
+ * Function Motor_Voltage_Set commands both motors in volts using Motor_Volts_To_PWM and Motor_PWM_Set.
+ */
+void Motor_Voltage_Set( float left_volts, float right_volts );
+
 /**
  * Function Get_Motor_PWM_Left returns the current PWM duty cycle for the left motor. If disabled it returns what the
  * PWM duty cycle would be.
@@ -126,4 +155,58 @@ uint16_t Get_MAX_Motor_PWM();
  */
 void Set_MAX_Motor_PWM( uint16_t MAX_PWM );
 
+/**
+ * Function Motor_PWM_Set_Profile switches to one of the PWM_Profile_t frequency/resolution profiles at run time.
+ * The TOP change is applied from the Timer 1 TOP interrupt so it takes effect at BOTTOM together with the current duty
+ * rescaled to the new TOP (a period later if the interrupt runs too close to BOTTOM). Unlike Set_MAX_Motor_PWM this
+ * is safe while the motors are running.
+ * @param [uint8_t] profile a PWM_Profile_t
+ * @return [uint16_t] the new TOP, or 0 if the profile is not valid
+ */
+uint16_t Motor_PWM_Set_Profile( uint8_t profile );
+
+/**
+ * Function Get_Motor_PWM_Profile returns the active (or pending) PWM_Profile_t.
+ */
+uint8_t Get_Motor_PWM_Profile();
+
+/**
+ * Battery voltage below which the voltage command layer outputs zero (e.g. running on USB power alone).
+ */
+#define MOTOR_MIN_SUPPLY_VOLTS 1.0f
+
+/**
+ * Function Motor_PWM_Set_Supply_Voltage stores the latest (filtered) battery voltage for the voltage command layer.
+ * The reciprocal is taken here, once per battery update, so converting volts to counts is a single multiply.
+ * @param [float] battery_volts the filtered battery voltage
+ */
+void Motor_PWM_Set_Supply_Voltage( float battery_volts );
+
+/**
+ * Function Motor_Volts_To_PWM converts a desired motor voltage into signed PWM counts scaled to Get_MAX_Motor_PWM()
+ * using the last supply voltage, saturating at full duty. Returns 0 until a usable supply voltage has been set.
+ * @param [float] volts desired average motor voltage, sign gives direction
+ * @return [int16_t] signed duty count
+ */
+int16_t Motor_Volts_To_PWM( float volts );
+
+/**
+ * Function Motor_PWM_Watchdog_Init sets the command timeout watchdog. It runs off the Timer 0 compare B interrupt
+ * (1 kHz, see Timing.h) so SetupTimer0 must have been called. A timeout of 0 turns the watchdog off.
+ * The watchdog stays idle until the first Motor_PWM_Watchdog_Feed.
+ * @param [uint16_t] timeout_ms milliseconds without a feed before the motors are braked and disabled
+ */
+void Motor_PWM_Watchdog_Init( uint16_t timeout_ms );
+
+/**
+ * Function Motor_PWM_Watchdog_Feed restarts the watchdog countdown. Call it whenever a new setpoint arrives.
+ * @param [uint16_t] hold_ms extra time on top of the timeout, e.g. the duration of a timed 'P' command
+ */
+void Motor_PWM_Watchdog_Feed( uint16_t hold_ms );
+
+/**
+ * Function Motor_PWM_Watchdog_Tripped returns true (once) if the watchdog has stopped the motors since the last call.
+ */
+bool Motor_PWM_Watchdog_Tripped();
+
 #endif
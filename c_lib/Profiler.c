@@ -0,0 +1,165 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "Profiler.h"
+#include "SerialIO.h"
+
+static Profiler_Probe_t _probes[PROFILER_MAX_PROBES];
+static uint16_t _overhead;          // cycles an empty BEGIN/END pair measures
+static uint8_t _dump_index;         // next probe Profiler_Dump_Next sends
+
+/**
+ * Function _log2_bin returns floor(log2(cycles)), 0 for 0 and 1. Checking the high byte first keeps it to at most
+ * seven shifts.
+ */
+static inline uint8_t _log2_bin( uint16_t cycles )
+{
+    uint8_t bin = 0;
+    if( cycles & 0xFF00 ) {
+        bin = 8;
+        cycles >>= 8;
+    }
+    while( cycles >>= 1 )
+        bin++;
+    return bin;
+}
+
+static inline void _clear_probe( Profiler_Probe_t* p_probe )
+{
+    p_probe->count = 0;
+    p_probe->min   = UINT16_MAX;
+    p_probe->max   = 0;
+    p_probe->total = 0;
+    for( uint8_t i = 0; i < PROFILER_HIST_BINS; i++ )
+        p_probe->hist[i] = 0;
+}
+
+/**
+ * Function Profiler_Init starts Timer3 free running at clk/1 with no interrupts, measures the probe overhead and
+ * clears the table.
+ */
+void Profiler_Init()
+{
+    // Normal mode, TOP = 0xFFFF, compare outputs disconnected, clk/1
+    TCCR3A = 0;
+    TCCR3B = ( 1 << CS30 );
+    TIMSK3 = 0;
+
+    // The overhead of the two timer reads, taken the same way the macros take them. Use the smallest of a few
+    // tries so an interrupt landing in the middle does not inflate it.
+    _overhead = UINT16_MAX;
+    for( uint8_t i = 0; i < 4; i++ ) {
+        _profiler_start[0] = Profiler_Now();
+        uint16_t cycles    = Profiler_Now() - _profiler_start[0];
+        if( cycles < _overhead )
+            _overhead = cycles;
+    }
+
+    Profiler_Reset();
+}
+
+/**
+ * Function Profiler_Reset clears the statistics of every probe.
+ */
+void Profiler_Reset()
+{
+    for( uint8_t i = 0; i < PROFILER_MAX_PROBES; i++ ) {
+        unsigned char sreg = SREG;
+        cli();
+        _clear_probe( &_probes[i] );
+        sei();
+        SREG = sreg;
+    }
+    _dump_index = 0;
+}
+
+/**
+ * Function Profiler_Record adds one section to a probe's statistics. Called by PROFILE_END; the probe overhead
+ * measured by Profiler_Init is subtracted first.
+ * @param [uint8_t] id probe id
+ * @param [uint16_t] cycles raw Timer3 ticks between PROFILE_BEGIN and PROFILE_END
+ */
+void Profiler_Record( uint8_t id, uint16_t cycles )
+{
+    if( id >= PROFILER_MAX_PROBES )
+        return;
+
+    Profiler_Probe_t* p_probe = &_probes[id];
+
+    cycles = cycles > _overhead ? cycles - _overhead : 0;
+
+    // stop accumulating rather than let the total (and so the mean) wrap
+    if( p_probe->total > UINT32_MAX - cycles )
+        return;
+
+    p_probe->count++;
+    p_probe->total += cycles;
+    if( cycles < p_probe->min )
+        p_probe->min = cycles;
+    if( cycles > p_probe->max )
+        p_probe->max = cycles;
+
+    uint8_t bin = _log2_bin( cycles );
+    if( p_probe->hist[bin] < UINT16_MAX )
+        p_probe->hist[bin]++;
+}
+
+/**
+ * Function Profiler_Dump_Next sends the next probe of the table as one message, [id][Profiler_Probe_t] with format
+ * "cBIHHI16H". It only sends when the USB send buffer has room for the whole message, so call it once per main loop
+ * pass until it returns false; the table goes out one probe per pass without overrunning the buffer.
+ * @param [char] cmd command character the messages respond to
+ * @return [bool] true while probes remain to be sent, false once the last one has gone
+ */
+bool Profiler_Dump_Next( char cmd )
+{
+    static char format[] = "cBIHHI16H";
+    struct __attribute__((__packed__)) { uint8_t id; Profiler_Probe_t probe; } msg;
+
+    if( usb_send_free() < usb_send_msg_size( format, sizeof( msg ) ) )
+        return true;
+
+    msg.id = _dump_index;
+
+    // ISR probes may be updating this entry, copy it in one piece
+    unsigned char sreg = SREG;
+    cli();
+    msg.probe = _probes[_dump_index];
+    sei();
+    SREG = sreg;
+
+    usb_send_msg( format, cmd, &msg, sizeof( msg ) );
+
+    if( ++_dump_index >= PROFILER_MAX_PROBES ) {
+        _dump_index = 0;
+        return false;
+    }
+    return true;
+}
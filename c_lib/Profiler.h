@@ -0,0 +1,128 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * Profiler.h/c is a light weight on-device profiler. Timer3 free runs at clk/1, so one timer tick is one CPU cycle,
+ * and a pair of probe macros around a section of code records how many cycles it took:
+ *
+ *      PROFILE_BEGIN( PROF_ID );
+ *      ... code being measured ...
+ *      PROFILE_END( PROF_ID );
+ *
+ * Each probe id (0 to PROFILER_MAX_PROBES-1, assigned by the application) accumulates a count, min, max and total
+ * along with a histogram of log2(cycles): bin n counts sections that took 2^n to 2^(n+1)-1 cycles (bin 0 also holds
+ * zero). The histogram shows jitter and rare long passes that a mean hides.
+ *
+ * Limits:
+ *   - The timer wraps every 65536 cycles (4.096 ms), so longer sections alias. Keep probes inside one loop pass.
+ *   - Time spent in interrupts that fire inside a section is counted in that section.
+ *   - A probe id must only be used from one context (main loop or a single ISR) and must not nest with itself.
+ *   - A probe stops accumulating once its total would overflow (about 268 s of measured time). Reset it with 'X'.
+ *
+ * The probe macros only exist when MEGN540_PROFILE is defined (build the lab with make PROFILE=1); otherwise they
+ * compile to nothing and Timer3 is not touched by the probes. Timer3 is not used by anything else in c_lib.
+ */
+
+#ifndef _MEGN540_PROFILER_H
+#define _MEGN540_PROFILER_H
+
+#include <avr/io.h>         // Board Specific pin definations
+#include <avr/interrupt.h>  // for interrupt service routine use
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef PROFILER_MAX_PROBES
+#define PROFILER_MAX_PROBES 8
+#endif
+#define PROFILER_HIST_BINS 16
+
+/** Statistics for one probe, sent as-is by Profiler_Dump_Next. */
+typedef struct __attribute__((__packed__)) {
+    uint32_t count;                         ///<-- number of recorded sections
+    uint16_t min;                           ///<-- shortest section [cycles]
+    uint16_t max;                           ///<-- longest section [cycles]
+    uint32_t total;                         ///<-- sum of all sections [cycles]
+    uint16_t hist[PROFILER_HIST_BINS];      ///<-- log2 histogram, saturates at 65535
+} Profiler_Probe_t;
+
+/** Section start times, one per probe. Used by the probe macros only. */
+volatile uint16_t _profiler_start[PROFILER_MAX_PROBES];
+
+/**
+ * Function Profiler_Init starts Timer3 free running at clk/1 with no interrupts, measures the probe overhead and
+ * clears the table.
+ */
+void Profiler_Init();
+
+/**
+ * Function Profiler_Reset clears the statistics of every probe.
+ */
+void Profiler_Reset();
+
+/**
+ * Function Profiler_Record adds one section to a probe's statistics. Called by PROFILE_END; the probe overhead
+ * measured by Profiler_Init is subtracted first.
+ * @param [uint8_t] id probe id
+ * @param [uint16_t] cycles raw Timer3 ticks between PROFILE_BEGIN and PROFILE_END
+ */
+void Profiler_Record( uint8_t id, uint16_t cycles );
+
+/**
+ * Function Profiler_Dump_Next sends the next probe of the table as one message, [id][Profiler_Probe_t] with format
+ * "cBIHHI16H". It only sends when the USB send buffer has room for the whole message, so call it once per main loop
+ * pass until it returns false; the table goes out one probe per pass without overrunning the buffer.
+ * @param [char] cmd command character the messages respond to
+ * @return [bool] true while probes remain to be sent, false once the last one has gone
+ */
+bool Profiler_Dump_Next( char cmd );
+
+/**
+ * Function Profiler_Now returns the Timer3 count. The 16 bit read shares the timer's TEMP register with any ISR
+ * probe, so it is done with interrupts disabled.
+ * @return [uint16_t] Timer3 count [cycles]
+ */
+static inline uint16_t Profiler_Now()
+{
+    unsigned char sreg = SREG;
+    cli();
+    uint16_t now = TCNT3;
+    SREG = sreg;
+    return now;
+}
+
+#ifdef MEGN540_PROFILE
+#define PROFILE_BEGIN( id ) do { _profiler_start[( id )] = Profiler_Now(); } while( 0 )
+#define PROFILE_END( id )   do { Profiler_Record( ( id ), Profiler_Now() - _profiler_start[( id )] ); } while( 0 )
+#else
+#define PROFILE_BEGIN( id ) do { } while( 0 )
+#define PROFILE_END( id )   do { } while( 0 )
+#endif
+
+#endif
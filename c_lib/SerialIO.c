@@ -58,11 +58,33 @@
 
 #include "SerialIO.h"
 #include "../c_lib/Ring_Buffer.h"
+#include "../c_lib/Timing.h"
 
 // *** MEGN540  ***
 // Ring Buffer Objects
 static struct Ring_Buffer_C _usb_receive_buffer;
-static struct Ring_Buffer_C _usb_send_buffer;
+static struct Ring_Buffer_C _usb_send_buffer;       // replies, see usb_send_msg
+static struct Ring_Buffer_C _usb_telemetry_buffer;  // periodic data, see usb_send_telemetry
+
+static int16_t _usb_send_sequence = -1;  // sequence number usb_send_msg echoes, -1 for none
+
+static bool    _usb_batch_active = false;   // usb_send_msg stages replies until usb_send_batch_flush
+static uint8_t _usb_batch[USB_BATCH_SIZE];  // staged messages, complete frames back to back
+static uint8_t _usb_batch_len = 0;
+static uint8_t _usb_batch_count = 0;
+static char    _usb_batch_cmd;                // command of the first staged message
+
+static USB_Send_Stats_t _usb_stats;
+static USB_Latency_t _usb_latency[2];  // indexed by USB_CLASS_REPLY / USB_CLASS_TELEMETRY
+
+// Frames queued in each send buffer: when each was queued, and how many bytes of the one going out are left
+typedef struct {
+    uint32_t stamp_us[USB_STAMP_SLOTS];
+    uint8_t first;
+    uint8_t count;
+    uint8_t remaining;
+} USB_Frame_Track_t;
+static USB_Frame_Track_t _usb_track[2];
 
 
 /** Contains the current baud rate and other settings of the first virtual serial port. While this demo does not use
@@ -111,6 +133,8 @@ void USB_SetupHardware(void)
 	// INITIALIZE RING BUFFERS AND OTHER DATA
 	rb_initialize_C(&_usb_receive_buffer);
 	rb_initialize_C(&_usb_send_buffer);
+	rb_initialize_C(&_usb_telemetry_buffer);
+	memset(_usb_track, 0, sizeof(_usb_track));
 }
 
 /** Event handler for the USB_Connect event. This indicates that the device is enumerating via the status LEDs and
@@ -241,6 +265,102 @@ void USB_Echo_Task(void)
 }
 
 
+/**
+ * Function usb_msg_note_high_water updates the receive buffer high-water mark.
+ */
+static inline void usb_msg_note_high_water()
+{
+    uint8_t length = rb_length_C(&_usb_receive_buffer);
+    if (length > _usb_stats.receive_high_water)
+        _usb_stats.receive_high_water = length;
+}
+
+/**
+ * Function usb_send_note_high_water updates the send buffer high-water mark.
+ */
+static inline void usb_send_note_high_water()
+{
+    uint8_t length = rb_length_C(&_usb_send_buffer);
+    if (length > _usb_stats.send_high_water)
+        _usb_stats.send_high_water = length;
+}
+
+/**
+ * Function usb_telemetry_note_high_water updates the telemetry buffer high-water mark.
+ */
+static inline void usb_telemetry_note_high_water()
+{
+    uint8_t length = rb_length_C(&_usb_telemetry_buffer);
+    if (length > _usb_stats.telemetry_high_water)
+        _usb_stats.telemetry_high_water = length;
+}
+
+/**
+ * Function usb_send_now_us returns the time in microseconds for the latency accounting.
+ */
+static inline uint32_t usb_send_now_us()
+{
+    Time_t now = GetTime();
+    return now.millisec * 1000 + now.microsec;
+}
+
+/**
+ * Function usb_send_stamp notes the time a frame of the class was queued. The slots hold more frames than fit in a
+ * send buffer, so none is ever missed.
+ */
+static void usb_send_stamp(uint8_t cls)
+{
+    USB_Frame_Track_t* p_track = &_usb_track[cls];
+    if (p_track->count < USB_STAMP_SLOTS)
+        p_track->stamp_us[(p_track->first + p_track->count++) & (USB_STAMP_SLOTS - 1)] = usb_send_now_us();
+}
+
+/**
+ * Function usb_send_pop takes the next byte of a class for the IN endpoint. A byte that starts a frame (its length
+ * byte) sets how much of the frame is left and closes the frame's latency measurement.
+ */
+static uint8_t usb_send_pop(uint8_t cls)
+{
+    USB_Frame_Track_t* p_track = &_usb_track[cls];
+    uint8_t byte = rb_pop_front_C(cls == USB_CLASS_TELEMETRY ? &_usb_telemetry_buffer : &_usb_send_buffer);
+
+    if (p_track->remaining == 0) {
+        p_track->remaining = byte + 1;
+        if (p_track->count) {
+            uint32_t waited = usb_send_now_us() - p_track->stamp_us[p_track->first];
+            uint16_t waited_us = waited > 0xFFFF ? 0xFFFF : waited;
+            USB_Latency_t* p_latency = &_usb_latency[cls];
+            p_latency->frames++;
+            p_latency->total_us += waited_us;
+            if (waited_us > p_latency->max_us)
+                p_latency->max_us = waited_us;
+            p_track->first = (p_track->first + 1) & (USB_STAMP_SLOTS - 1);
+            p_track->count--;
+        }
+    }
+    p_track->remaining--;
+    return byte;
+}
+
+/**
+ * Function usb_send_count_drop counts a message dropped for lack of send buffer space.
+ */
+static void usb_send_count_drop(char cmd)
+{
+    _usb_stats.dropped++;
+    for (uint8_t i = 0; i < USB_DROP_SLOTS; i++) {
+        USB_Drop_Count_t* p_slot = &_usb_stats.by_cmd[i];
+        if (i == USB_DROP_SLOTS - 1 && p_slot->cmd != cmd)
+            p_slot->cmd = '.';   // table full, the last slot takes the rest
+        else if (p_slot->cmd == 0)
+            p_slot->cmd = cmd;
+        else if (p_slot->cmd != cmd)
+            continue;
+        p_slot->dropped++;
+        return;
+    }
+}
+
 /**
  * (non-blocking) Function usb_read_next_byte takes the next USB byte and reads it
  * into a ring buffer for latter processing.
@@ -261,8 +381,10 @@ void usb_read_next_byte()
     /* Select the Serial Rx Endpoint */
     Endpoint_SelectEndpoint(CDC_RX_EPADDR);
     
-    if (Endpoint_IsOUTReceived() && Endpoint_BytesInEndpoint()){
+    // a full receive buffer leaves the byte in the endpoint, the host waits rather than losing data
+    if (Endpoint_IsOUTReceived() && Endpoint_BytesInEndpoint() && rb_length_C(&_usb_receive_buffer) < RB_LENGTH_C - 1){
 	rb_push_back_C(&_usb_receive_buffer, Endpoint_Read_8());
+	usb_msg_note_high_water();
     }
     
     if (Endpoint_IsOUTReceived() && !Endpoint_BytesInEndpoint()){
@@ -286,6 +408,33 @@ void usb_read_next_byte()
     //}
 }
 
+/**
+ * (non-blocking) Function usb_read_available moves every byte the USB hardware is holding into the receive buffer, as
+ * far as the buffer has room.
+ * @return [uint8_t] number of bytes moved
+ */
+uint8_t usb_read_available()
+{
+    /* Device must be connected and configured for the task to run */
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+	return 0;
+
+    /* Select the Serial Rx Endpoint */
+    Endpoint_SelectEndpoint(CDC_RX_EPADDR);
+
+    uint8_t moved = 0;
+    while (Endpoint_IsOUTReceived() && rb_length_C(&_usb_receive_buffer) < RB_LENGTH_C - 1) {
+	if (!Endpoint_BytesInEndpoint()) {
+	    Endpoint_ClearOUT();   // a banked packet behind this one shows up right away
+	    continue;
+	}
+	rb_push_back_C(&_usb_receive_buffer, Endpoint_Read_8());
+	moved++;
+    }
+    usb_msg_note_high_water();
+    return moved;
+}
+
 /**
  * (non-blocking) Function usb_write_next_byte takes the next byte from the output
  * ringbuffer and writes it to the USB port (if free).
@@ -306,12 +455,21 @@ void usb_write_next_byte()
     Endpoint_SelectEndpoint(CDC_TX_EPADDR);
 
     /* Check to see if any data has been received */
-    if (rb_length_C(&_usb_send_buffer) != 0 && Endpoint_IsINReady())
+    if ((rb_length_C(&_usb_send_buffer) != 0 || rb_length_C(&_usb_telemetry_buffer) != 0) && Endpoint_IsINReady())
     {
 	    uint8_t tx_epsize_space_left = CDC_TXRX_EPSIZE;
-	    while (tx_epsize_space_left && rb_length_C(&_usb_send_buffer)){
+	    while (tx_epsize_space_left){
+		// replies first, but never cut into the middle of a telemetry frame already going out
+		uint8_t cls;
+		if (_usb_track[USB_CLASS_TELEMETRY].remaining == 0 && rb_length_C(&_usb_send_buffer))
+		    cls = USB_CLASS_REPLY;
+		else if (rb_length_C(&_usb_telemetry_buffer))
+		    cls = USB_CLASS_TELEMETRY;
+		else
+		    break;
+
 	    /* Write the received data to the endpoint */
-		Endpoint_Write_8(rb_pop_front_C(&_usb_send_buffer));
+		Endpoint_Write_8(usb_send_pop(cls));
 		tx_epsize_space_left--;
 	    }
 
@@ -370,6 +528,78 @@ void usb_send_str(char* p_str)
     rb_push_back_C(&_usb_send_buffer, 0);
 }
 
+/**
+ * Function usb_send_put adds bytes of a message to a send buffer, or to the staged batch when p_ring is NULL.
+ */
+static void usb_send_put(struct Ring_Buffer_C* p_ring, const void* p_data, uint8_t data_len)
+{
+    if (!p_ring) {
+        memcpy(&_usb_batch[_usb_batch_len], p_data, data_len);
+        _usb_batch_len += data_len;
+    } else {
+        const uint8_t* data = p_data;
+        for (uint8_t i = 0; i < data_len; i++)
+            rb_push_back_C(p_ring, data[i]);
+    }
+}
+
+/**
+ * Function usb_send_frame writes a message of size bytes (see usb_send_msg_size) in the MEGN540 USB message format
+ * with usb_send_put, wrapped as a sequenced reply when a sequence is set.
+ */
+static void usb_send_frame(struct Ring_Buffer_C* p_ring, uint8_t size, char* format, char cmd, void* p_data,
+                           uint8_t data_len)
+{
+    uint8_t total = size - 1;
+    usb_send_put(p_ring, &total, 1);
+    if (_usb_send_sequence >= 0) {
+        // reply to a sequenced request: "cB" ahead of the format, '#' and the sequence ahead of the command
+        uint8_t wrap[2] = { '#', (uint8_t)_usb_send_sequence };
+        usb_send_put(p_ring, "cB", 2);
+        usb_send_put(p_ring, format, strlen(format) + 1);
+        usb_send_put(p_ring, wrap, 2);
+    } else {
+        usb_send_put(p_ring, format, strlen(format) + 1);
+    }
+    usb_send_put(p_ring, &cmd, 1);
+    usb_send_put(p_ring, p_data, data_len);
+}
+
+/**
+ * Function usb_send_batch_emit moves the staged messages to the output buffer and empties the stage. A lone message
+ * goes out unchanged, several are wrapped in one frame: [MSG Length]["c<N>s"]['&'][messages], N their byte count.
+ */
+static void usb_send_batch_emit()
+{
+    if (_usb_batch_count == 1) {
+        if (_usb_batch_len <= usb_send_free()) {
+            usb_send_data(_usb_batch, _usb_batch_len);
+            usb_send_stamp(USB_CLASS_REPLY);
+        } else {
+            usb_send_count_drop(_usb_batch_cmd);
+        }
+    } else if (_usb_batch_count > 1 && _usb_batch_len + 7 > usb_send_free()) {
+        usb_send_count_drop('&');  // 7 covers the length byte, the longest format with its null and '&'
+    } else if (_usb_batch_count > 1) {
+        char format[6] = "c";
+        uint8_t i = 1;
+        if (_usb_batch_len >= 10)
+            format[i++] = '0' + _usb_batch_len / 10;
+        format[i++] = '0' + _usb_batch_len % 10;
+        format[i++] = 's';
+        format[i] = 0;
+
+        usb_send_byte(i + 2 + _usb_batch_len); // format with null + '&' + messages
+        usb_send_str(format);
+        usb_send_byte('&');
+        usb_send_data(_usb_batch, _usb_batch_len);
+        usb_send_stamp(USB_CLASS_REPLY);
+    }
+    usb_send_note_high_water();
+    _usb_batch_len = 0;
+    _usb_batch_count = 0;
+}
+
 /**
  * (non-blocking) Function usb_send_msg sends a message according to the MEGN540 USB message format.
  *      [MSG Length] [Format C-Str][Host Initiating CMD Char][DATA]
@@ -403,11 +633,130 @@ void usb_send_msg(char* format, char cmd, void* p_data, uint8_t data_len )
     //      usb_send_data <-- p_data
     // FUNCTION END
     //uint8_t format_length = strlen(format)+1;
-    uint8_t total = 2 + strlen(format) + data_len;
-    usb_send_byte(total);
-    usb_send_str(format);
-    usb_send_byte(cmd);
-    usb_send_data(p_data, data_len);
+    uint8_t size = usb_send_msg_size(format, data_len);
+    bool staged = _usb_batch_active && size <= USB_BATCH_SIZE;
+
+    // keep replies in order, anything staged goes first if this one can't join it
+    if (_usb_batch_len && (!staged || _usb_batch_len + size > USB_BATCH_SIZE))
+        usb_send_batch_emit();
+
+    // all or nothing, a message that does not fit is dropped rather than written over bytes still queued
+    if (!staged && size > usb_send_free()) {
+        usb_send_count_drop(cmd);
+        return;
+    }
+
+    usb_send_frame(staged ? NULL : &_usb_send_buffer, size, format, cmd, p_data, data_len);
+
+    if (!staged) {
+        usb_send_stamp(USB_CLASS_REPLY);
+        usb_send_note_high_water();
+    } else if (_usb_batch_count++ == 0) {
+        _usb_batch_cmd = cmd;
+    }
+}
+
+/**
+ * (non-blocking) Function usb_send_telemetry sends a message like usb_send_msg through the low priority telemetry
+ * buffer, which usb_write_next_byte only drains when no reply is waiting.
+ * @param format [c-str pointer] Pointer to interpertation string, as for usb_send_msg.
+ * @param cmd [char] Command this message is in respose to.
+ * @param p_data [void*] pointer to the data-object to send.
+ * @param data_len [uint8_t] size of the data-object to send.
+ */
+void usb_send_telemetry(char* format, char cmd, void* p_data, uint8_t data_len )
+{
+    uint8_t size = usb_send_msg_size(format, data_len);
+
+    // all or nothing, as for replies
+    if (size > (RB_LENGTH_C - 1) - rb_length_C(&_usb_telemetry_buffer)) {
+        usb_send_count_drop(cmd);
+        return;
+    }
+
+    usb_send_frame(&_usb_telemetry_buffer, size, format, cmd, p_data, data_len);
+    usb_send_stamp(USB_CLASS_TELEMETRY);
+    usb_telemetry_note_high_water();
+}
+
+/**
+ * (non-blocking) Function usb_send_stats returns the buffer high-water marks and the drop table.
+ */
+const USB_Send_Stats_t* usb_send_stats()
+{
+    return &_usb_stats;
+}
+
+/**
+ * (non-blocking) Function usb_send_latency returns the send latency of replies and telemetry.
+ */
+const USB_Latency_t* usb_send_latency()
+{
+    return _usb_latency;
+}
+
+/**
+ * (non-blocking) Function usb_send_stats_reset zeroes the high-water marks, drop counts and latencies.
+ */
+void usb_send_stats_reset()
+{
+    memset(&_usb_stats, 0, sizeof(_usb_stats));
+    memset(_usb_latency, 0, sizeof(_usb_latency));
+}
+
+/**
+ * (non-blocking) Function usb_send_batch_begin stages every message usb_send_msg sends until usb_send_batch_flush.
+ */
+void usb_send_batch_begin()
+{
+    _usb_batch_active = true;
+}
+
+/**
+ * (non-blocking) Function usb_send_batch_flush sends whatever is staged and stops staging.
+ */
+void usb_send_batch_flush()
+{
+    usb_send_batch_emit();
+    _usb_batch_active = false;
+}
+
+/**
+ * (non-blocking) Function usb_send_set_sequence sets the sequence number usb_send_msg echoes, -1 for none.
+ * @param seq [int16_t] sequence number to echo, or -1 for none
+ */
+void usb_send_set_sequence(int16_t seq)
+{
+    _usb_send_sequence = seq;
+}
+
+/**
+ * (non-blocking) Function usb_send_msg_seq sends a message as a reply to the sequenced request seq, -1 for none.
+ * @param seq [int16_t] sequence number to echo, or -1 for none
+ * @param format [c-str pointer] Pointer to interpertation string, as for usb_send_msg.
+ * @param cmd [char] Command this message is in respose to.
+ * @param p_data [void*] pointer to the data-object to send.
+ * @param data_len [uint8_t] size of the data-object to send.
+ */
+void usb_send_msg_seq(int16_t seq, char* format, char cmd, void* p_data, uint8_t data_len )
+{
+    int16_t current = _usb_send_sequence;
+    _usb_send_sequence = seq;
+    usb_send_msg(format, cmd, p_data, data_len);
+    _usb_send_sequence = current;
+}
+
+/**
+ * (non-blocking) Function usb_send_msg_size returns how many bytes of the send buffer usb_send_msg will use.
+ * @param format [c-str pointer] interpertation string as passed to usb_send_msg
+ * @param data_len [uint8_t] size of the data-object
+ * @return [uint8_t] bytes the message takes
+ */
+uint8_t usb_send_msg_size(char* format, uint8_t data_len)
+{
+    // length byte + format (with null) + cmd + data, plus "cB", '#' and the sequence when wrapped
+    uint8_t size = 3 + strlen(format) + data_len;
+    return _usb_send_sequence >= 0 ? size + 4 : size;
 }
 
 /**
@@ -421,6 +770,17 @@ uint8_t usb_msg_length()
     return rb_length_C(&_usb_receive_buffer);
 }
 
+/**
+ * (non-blocking) Function usb_send_free returns how many more bytes the send buffer can take before it starts
+ * overwriting bytes that have not gone out yet.
+ * @return [uint8_t] Number of free bytes in the send buffer.
+ */
+uint8_t usb_send_free()
+{
+    // one slot always stays empty so a full buffer can be told apart from an empty one
+    return (RB_LENGTH_C - 1) - rb_length_C(&_usb_send_buffer);
+}
+
 /**
  * (non-blocking) Function usb_msg_peek returns (without removal) the next byte in teh receive buffer (null if empty).
  * @return [uint8_t] Next Byte
@@ -432,6 +792,19 @@ uint8_t usb_msg_peek()
     return rb_get_C( &_usb_receive_buffer, 0);
 }
 
+/**
+ * (non-blocking) Function usb_msg_peek_ahead returns (without removal) the byte index places into the receive buffer
+ * (null if there are not that many).
+ * @param index [uint8_t] position from the front of the buffer
+ * @return [uint8_t] Byte at that position
+ */
+uint8_t usb_msg_peek_ahead(uint8_t index)
+{
+    if (index >= rb_length_C(&_usb_receive_buffer))
+        return 0;
+    return rb_get_C( &_usb_receive_buffer, index);
+}
+
 /**
  * (non-blocking) Function usb_msg_get removes and returns the next byte in the receive buffer (null if empty)
  * @return [uint8_t] Next Byte
@@ -479,3 +852,26 @@ void usb_flush_input_buffer()
     }
 }
 
+#ifdef MEGN540_BENCHMARK
+/**
+ * Function usb_bench_inject places bytes in the receive buffer as if they had arrived from the host.
+ * @param p_data [const uint8_t*] bytes to inject
+ * @param data_len [uint8_t] number of bytes
+ */
+void usb_bench_inject(const uint8_t* p_data, uint8_t data_len)
+{
+    for (uint8_t i = 0; i < data_len; i++){
+	rb_push_back_C(&_usb_receive_buffer, p_data[i]);
+    }
+}
+
+/**
+ * Function usb_bench_discard_output empties the send buffers.
+ */
+void usb_bench_discard_output()
+{
+    rb_initialize_C(&_usb_send_buffer);
+    rb_initialize_C(&_usb_telemetry_buffer);
+    memset(_usb_track, 0, sizeof(_usb_track));
+}
+#endif
@@ -68,6 +68,39 @@
 // Include your Ring_Buffer homework code.
 #include "Ring_Buffer.h"
 
+#define USB_BATCH_SIZE 48  // bytes of messages usb_send_batch_begin can stage, the wrapped frame must fit the send buffer
+#define USB_DROP_SLOTS 6   // commands usb_send_stats keeps separate drop counts for, the last slot collects the rest
+#define USB_STAMP_SLOTS 16 // frames each send buffer keeps enqueue times for, a frame is at least 4 bytes (power of 2)
+
+#define USB_CLASS_REPLY 0      // send buffer of usb_send_msg, always transmitted first
+#define USB_CLASS_TELEMETRY 1  // send buffer of usb_send_telemetry, transmitted when no reply is waiting
+
+/**
+ * Send buffer accounting, see usb_send_stats. High-water marks are the most bytes each buffer has held (send is the
+ * reply buffer of usb_send_msg, telemetry the one of usb_send_telemetry). by_cmd lists drops per reply command in the
+ * order they first happened; unused slots have cmd 0, and once the table is full the last slot (cmd '.') counts
+ * every command without a slot of its own. Staged '&' batches that are dropped count under '&'.
+ */
+typedef struct __attribute__((__packed__)) { char cmd; uint16_t dropped; } USB_Drop_Count_t;
+typedef struct __attribute__((__packed__)) {
+    uint8_t send_high_water;
+    uint8_t receive_high_water;
+    uint8_t telemetry_high_water;
+    uint16_t dropped;
+    USB_Drop_Count_t by_cmd[USB_DROP_SLOTS];
+} USB_Send_Stats_t;
+
+/**
+ * Send latency of one class of messages, see usb_send_latency. A frame's latency runs from the moment it is queued
+ * (or a staged batch is moved to the send buffer) until its first byte is written to the IN endpoint, in microseconds.
+ * Frames that wait longer than 65ms count as 65535.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint32_t frames;
+    uint32_t total_us;
+    uint16_t max_us;
+} USB_Latency_t;
+
 
 /* LUFA Specific Function Prototypes: */
 void USB_SetupHardware(void);  // You'll need to add in any initialization items to this function for your ring buffers
@@ -92,9 +125,18 @@ void EVENT_USB_Device_ControlRequest(void);
  */
 void usb_read_next_byte();
 
+/**
+ * (non-blocking) Function usb_read_available moves every byte the USB hardware is holding into the receive buffer, as
+ * far as the buffer has room, instead of the one byte per call of usb_read_next_byte. Used to look past the command
+ * being handled for newer ones already delivered.
+ * @return [uint8_t] number of bytes moved
+ */
+uint8_t usb_read_available();
+
 /**
  * (non-blocking) Function usb_write_next_byte takes the next byte from the output
- * ringbuffer and writes it to the USB port (if free).
+ * ringbuffer and writes it to the USB port (if free). The IN packet is filled from the reply buffer first and from
+ * the telemetry buffer after it, switching between them only at frame boundaries (see usb_send_telemetry).
  */
 void usb_write_next_byte();
 
@@ -129,6 +171,9 @@ void usb_send_str(char* p_str);
  *           All transmissions are host initiate.
  *      DATA: [Byte Array] Data byes that make up the message to be sent.
  *
+ * Sending is all or nothing: a message that does not fit in the free space of the send buffer is dropped whole,
+ * rather than written over bytes still queued, and counted in the drop table of usb_send_stats.
+ *
  * @param format [c-str pointer] Pointer to interpertation string. e.g. ccf.  This alwasy starts with c because of the
  *          CMD char, here teh DATA object is then a char and a float.
  * @param cmd [char] Command this message is in respose to.
@@ -137,18 +182,117 @@ void usb_send_str(char* p_str);
  */
 void usb_send_msg(char* format, char cmd, void* p_data, uint8_t data_len );
 
+/**
+ * (non-blocking) Function usb_send_telemetry sends a message like usb_send_msg, but through the low priority
+ * telemetry send buffer. usb_write_next_byte only takes telemetry when no reply from usb_send_msg is waiting, and only
+ * switches between the two buffers at frame boundaries, so a burst of periodic data such as the 'q' system data cannot
+ * hold up command replies by more than the one frame already going out. Telemetry is never staged in a batch.
+ * Sending is all or nothing against the free space of the telemetry buffer, drops count in usb_send_stats.
+ *
+ * @param format [c-str pointer] Pointer to interpertation string, as for usb_send_msg.
+ * @param cmd [char] Command this message is in respose to.
+ * @param p_data [void*] pointer to the data-object to send.
+ * @param data_len [uint8_t] size of the data-object to send.
+ */
+void usb_send_telemetry(char* format, char cmd, void* p_data, uint8_t data_len );
+
+/**
+ * (non-blocking) Function usb_send_stats returns the send/receive buffer high-water marks and the table of messages
+ * usb_send_msg dropped because the send buffer was full.
+ * @return [const USB_Send_Stats_t*] counters since power on or usb_send_stats_reset
+ */
+const USB_Send_Stats_t* usb_send_stats();
+
+/**
+ * (non-blocking) Function usb_send_latency returns the send latency of each message class, indexed by
+ * USB_CLASS_REPLY and USB_CLASS_TELEMETRY. Frames must go through usb_send_msg or usb_send_telemetry to be timed;
+ * bytes queued directly with usb_send_byte/data/str are not frames and throw the accounting of the reply class off.
+ * @return [const USB_Latency_t*] array of two, counters since power on or usb_send_stats_reset
+ */
+const USB_Latency_t* usb_send_latency();
+
+/**
+ * (non-blocking) Function usb_send_stats_reset zeroes the high-water marks, drop counts and latencies.
+ */
+void usb_send_stats_reset();
+
+/**
+ * (non-blocking) Function usb_send_batch_begin stages the messages usb_send_msg sends from now until
+ * usb_send_batch_flush, which sends them together as one frame:
+ *      [MSG Length]["c<N>s" C-Str]['&'][messages]
+ * where the messages are N bytes of complete frames, each as usb_send_msg would have sent it. A lone staged message is
+ * sent unwrapped, and the stage is sent early whenever the next message would not fit in USB_BATCH_SIZE bytes.
+ * Message_Handling_Task uses this for '&' batch commands, so the replies to every command in the batch, including
+ * those sent when the flags they set fire, share a USB transfer.
+ */
+void usb_send_batch_begin();
+
+/**
+ * (non-blocking) Function usb_send_batch_flush sends whatever usb_send_batch_begin staged and stops staging. Called
+ * by Message_Handling_Task once the batch's flags have fired.
+ */
+void usb_send_batch_flush();
+
+/**
+ * (non-blocking) Function usb_send_set_sequence sets the sequence number of the request being answered. While it is
+ * set (0-255), usb_send_msg wraps every message as a reply to a sequenced request:
+ *      [MSG Length] ["cB" + Format C-Str]['#'][Sequence][Host Initiating CMD Char][DATA]
+ * so a host with several requests in flight can tell which one a reply belongs to. -1 sends plain messages.
+ * Message_Handling_Task sets it while a command is processed. Replies sent later, when a flag fires, use
+ * usb_send_msg_seq with the flag's seq instead; code that sends through a helper (Profiler_Dump_Next,
+ * usb_send_telemetry) sets it around the call and sets it back to -1 after.
+ * @param seq [int16_t] sequence number to echo, or -1 for none
+ */
+void usb_send_set_sequence(int16_t seq);
+
+/**
+ * (non-blocking) Function usb_send_msg_seq sends a message like usb_send_msg, as a reply to the sequenced request seq
+ * (-1 for a plain message) regardless of usb_send_set_sequence, which it leaves as it was. Use it for replies sent
+ * when a message flag fires, with the flag's seq.
+ * @param seq [int16_t] sequence number to echo, or -1 for none
+ * @param format [c-str pointer] Pointer to interpertation string, as for usb_send_msg.
+ * @param cmd [char] Command this message is in respose to.
+ * @param p_data [void*] pointer to the data-object to send.
+ * @param data_len [uint8_t] size of the data-object to send.
+ */
+void usb_send_msg_seq(int16_t seq, char* format, char cmd, void* p_data, uint8_t data_len );
+
+/**
+ * (non-blocking) Function usb_send_msg_size returns how many bytes of the send buffer usb_send_msg will use for a
+ * message, including the sequence wrapper if one is set. Compare with usb_send_free.
+ * @param format [c-str pointer] interpertation string as passed to usb_send_msg
+ * @param data_len [uint8_t] size of the data-object
+ * @return [uint8_t] bytes the message takes
+ */
+uint8_t usb_send_msg_size(char* format, uint8_t data_len);
+
 /**
  * (non-blocking) Funtion usb_msg_length returns the number of bytes in the receive buffer awaiting processing.
  * @return [uint8_t] Number of bytes ready for processing.
  */
 uint8_t usb_msg_length();
 
+/**
+ * (non-blocking) Function usb_send_free returns how many more bytes the (reply) send buffer can take. usb_send_msg
+ * drops a message that needs more; check it (against usb_send_msg_size) to hold a message back for later instead.
+ * @return [uint8_t] Number of free bytes in the send buffer.
+ */
+uint8_t usb_send_free();
+
 /**
  * (non-blocking) Function usb_msg_peek returns (without removal) the next byte in teh receive buffer (null if empty).
  * @return [uint8_t] Next Byte
  */
 uint8_t usb_msg_peek();
 
+/**
+ * (non-blocking) Function usb_msg_peek_ahead returns (without removal) the byte index places into the receive buffer
+ * (null if there are not that many). usb_msg_peek_ahead(0) is usb_msg_peek().
+ * @param index [uint8_t] position from the front of the buffer
+ * @return [uint8_t] Byte at that position
+ */
+uint8_t usb_msg_peek_ahead(uint8_t index);
+
 /**
  * (non-blocking) Function usb_msg_get removes and returns the next byte in the receive buffer (null if empty)
  * @return [uint8_t] Next Byte
@@ -172,5 +316,15 @@ bool usb_msg_read_into(void* p_obj, uint8_t data_len);
  */
 void usb_flush_input_buffer();
 
+#ifdef MEGN540_BENCHMARK
+/**
+ * Benchmark builds only (see Benchmark_Probe.h). The USB stack never enumerates under the simulator, so these stand
+ * in for the host: usb_bench_inject places bytes in the receive buffer as if they had arrived, and
+ * usb_bench_discard_output empties the send buffers so repeated sends measure the same work.
+ */
+void usb_bench_inject(const uint8_t* p_data, uint8_t data_len);
+void usb_bench_discard_output();
+#endif
+
 #endif
 
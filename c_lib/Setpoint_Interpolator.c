@@ -0,0 +1,167 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+#include "Setpoint_Interpolator.h"
+
+#include <math.h>
+
+/**
+ * Function Limit clamps a value to [lo, hi].
+ */
+static inline float Limit( float value, float lo, float hi )
+{
+    return (value > hi)?hi:(value < lo)?lo:value;
+}
+
+/**
+ * Function Setpoint_Interpolator_Init sets the limits and starts from a zero output with no stream.
+ */
+void Setpoint_Interpolator_Init( Setpoint_Interpolator_t* p_interp, float max_accel, float max_jerk, float delay, float timeout )
+{
+    Setpoint_Interpolator_Limits(p_interp, max_accel, max_jerk, delay, timeout);
+    Setpoint_Interpolator_Reset(p_interp, 0);
+}
+
+/**
+ * Function Setpoint_Interpolator_Limits changes the limits, delay and timeout without disturbing the output.
+ */
+void Setpoint_Interpolator_Limits( Setpoint_Interpolator_t* p_interp, float max_accel, float max_jerk, float delay, float timeout )
+{
+    p_interp->max_accel = max_accel > 0 ? max_accel : 0;
+    p_interp->max_jerk = max_jerk > 0 ? max_jerk : 0;
+    p_interp->delay = delay > 0 ? delay : 0;
+    p_interp->timeout = timeout;
+}
+
+/**
+ * Function Setpoint_Interpolator_Reset drops the stream and sets the output.
+ */
+void Setpoint_Interpolator_Reset( Setpoint_Interpolator_t* p_interp, float value )
+{
+    p_interp->count = 0;
+    p_interp->t0 = p_interp->t1 = 0;
+    p_interp->v0 = p_interp->v1 = 0;
+    p_interp->offset = 0;
+    p_interp->last_receive = 0;
+    p_interp->value = value;
+    p_interp->rate = 0;
+}
+
+/**
+ * Function Setpoint_Interpolator_Add takes a new setpoint.
+ */
+void Setpoint_Interpolator_Add( Setpoint_Interpolator_t* p_interp, float host_time, float value, float now )
+{
+    float offset = now - host_time;
+
+    if( p_interp->count == 0 || host_time <= p_interp->t1 || now - p_interp->last_receive > p_interp->timeout ) {
+        // new stream, the offset is relearned from scratch
+        p_interp->count = 1;
+        p_interp->t0 = host_time;
+        p_interp->v0 = value;
+        p_interp->offset = offset;
+    }
+    else {
+        p_interp->count = 2;
+        p_interp->t0 = p_interp->t1;
+        p_interp->v0 = p_interp->v1;
+        // the fastest delivery is the best estimate of the clock offset, later ones only add latency
+        if( offset < p_interp->offset )
+            p_interp->offset = offset;
+    }
+    p_interp->t1 = host_time;
+    p_interp->v1 = value;
+    p_interp->last_receive = now;
+}
+
+/**
+ * Function Setpoint_Interpolator_Target returns the unsmoothed target at device time now.
+ */
+float Setpoint_Interpolator_Target( const Setpoint_Interpolator_t* p_interp, float now )
+{
+    if( p_interp->count == 0 || now - p_interp->last_receive > p_interp->timeout )
+        return 0;
+
+    float t = now - p_interp->offset - p_interp->delay;
+    float span = p_interp->t1 - p_interp->t0;
+
+    if( p_interp->count < 2 || t <= p_interp->t0 )
+        return p_interp->count < 2 ? p_interp->v1 : p_interp->v0;
+
+    // between the two setpoints, or past the newest extrapolating its slope for at most one update period
+    float ahead = Limit(t - p_interp->t0, 0, 2*span);
+    return p_interp->v0 + (p_interp->v1 - p_interp->v0)*ahead/span;
+}
+
+/**
+ * Function Setpoint_Interpolator_Update steps the output toward the target within the limits and returns it.
+ */
+float Setpoint_Interpolator_Update( Setpoint_Interpolator_t* p_interp, float now, float dt )
+{
+    if( dt <= 0 )
+        return p_interp->value;
+
+    float target = Setpoint_Interpolator_Target(p_interp, now);
+    float landing = (target - p_interp->value)/dt;  // reaches the target this update
+    float rate = landing;
+    float step = p_interp->max_jerk*dt;  // largest change of rate this update under the jerk limit
+
+    if( p_interp->max_jerk > 0 ) {
+        // no faster than the rate the jerk limit can still bring to rest by the target. Slowing by step per update
+        // from rate r covers r*(r + step)/(2*max_jerk), this is the r where that equals the distance left
+        float brake = (sqrtf(step*step + 8*p_interp->max_jerk*fabsf(target - p_interp->value)) - step)/2;
+        rate = Limit(rate, -brake, brake);
+    }
+    if( p_interp->max_accel > 0 )
+        rate = Limit(rate, -p_interp->max_accel, p_interp->max_accel);
+    if( p_interp->max_jerk > 0 )
+        rate = Limit(rate, p_interp->rate - step, p_interp->rate + step);
+
+    // the last update before the target may need to slow by more than step, landing on it beats passing it
+    if( (landing > 0 && rate > landing) || (landing < 0 && rate < landing) )
+        rate = landing;
+
+    p_interp->rate = rate;
+    if( rate == landing )
+        p_interp->value = target;  // exactly, so a stopped output reads as zero
+    else
+        p_interp->value += rate*dt;
+    return p_interp->value;
+}
+
+/**
+ * Function Setpoint_Interpolator_Active returns true while a stream is live or the output has not come to rest.
+ */
+bool Setpoint_Interpolator_Active( const Setpoint_Interpolator_t* p_interp, float now )
+{
+    if( p_interp->count && now - p_interp->last_receive <= p_interp->timeout )
+        return true;
+    return p_interp->value != 0 || p_interp->rate != 0;
+}
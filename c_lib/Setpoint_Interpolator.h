@@ -0,0 +1,115 @@
+/*
+         MEGN540 Mechatronics Lab
+    Copyright (C) Andrew Petruska, 2021.
+       apetruska [at] mines [dot] edu
+          www.mechanical.mines.edu
+*/
+
+/*
+    Copyright (c) 2021 Andrew Petruska at Colorado School of Mines
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+*/
+
+/**
+ * Setpoint_Interpolator.h/c turns sparse, timestamped setpoints from the host into a smooth setpoint at the control
+ * rate, so how often the host sends is decoupled from how smoothly the robot moves.
+ *
+ * Each setpoint carries the host's send time. The device renders the piecewise-linear path through the last two
+ * setpoints at (device time - offset - delay), where offset maps host time to device time (the smallest difference
+ * seen since the stream started, i.e. the fastest delivery) and delay holds rendering back so it interpolates between
+ * received points instead of guessing ahead. With a delay shorter than the host's update period it extrapolates the
+ * last slope, at most one update period past the newest setpoint, then holds. If no setpoint arrives within timeout
+ * the target falls to zero.
+ *
+ * The output then chases that target with optional acceleration and jerk limits (rate of change and change of rate
+ * of change of the setpoint). A limit of zero is no limit.
+ */
+#ifndef _MEGN540_SETPOINT_INTERPOLATOR_H
+#define _MEGN540_SETPOINT_INTERPOLATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    float t0, v0;         ///<-- previous setpoint, host time (s) and value
+    float t1, v1;         ///<-- newest setpoint
+    uint8_t count;        ///<-- setpoints held since the stream started, saturates at 2
+    float offset;         ///<-- device time minus host time
+    float last_receive;   ///<-- device time the newest setpoint arrived
+    float value;          ///<-- smoothed output
+    float rate;           ///<-- output rate of change (per second)
+    float max_accel;      ///<-- limit on rate, 0 for none
+    float max_jerk;       ///<-- limit on the change of rate per second, 0 for none
+    float delay;          ///<-- seconds rendering lags the host
+    float timeout;        ///<-- seconds without a setpoint before the target falls to zero
+} Setpoint_Interpolator_t;
+
+/**
+ * Function Setpoint_Interpolator_Init sets the limits and starts from a zero output with no stream.
+ * @param p_interp pointer to the interpolator
+ * @param max_accel largest output rate of change, 0 for no limit
+ * @param max_jerk largest change of the output rate per second, 0 for no limit
+ * @param delay seconds rendering lags the host, about one host update period to interpolate, 0 to extrapolate
+ * @param timeout seconds without a setpoint before the target falls to zero
+ */
+void Setpoint_Interpolator_Init( Setpoint_Interpolator_t* p_interp, float max_accel, float max_jerk, float delay, float timeout );
+
+/**
+ * Function Setpoint_Interpolator_Limits changes the limits, delay and timeout without disturbing the output.
+ */
+void Setpoint_Interpolator_Limits( Setpoint_Interpolator_t* p_interp, float max_accel, float max_jerk, float delay, float timeout );
+
+/**
+ * Function Setpoint_Interpolator_Reset drops the stream and sets the output, e.g. when another mode takes over.
+ */
+void Setpoint_Interpolator_Reset( Setpoint_Interpolator_t* p_interp, float value );
+
+/**
+ * Function Setpoint_Interpolator_Add takes a new setpoint. A setpoint that is not newer than the last one, or that
+ * arrives after the stream timed out, starts a new stream.
+ * @param p_interp pointer to the interpolator
+ * @param host_time the host's time stamp for the setpoint (s)
+ * @param value the setpoint
+ * @param now device time it arrived (s)
+ */
+void Setpoint_Interpolator_Add( Setpoint_Interpolator_t* p_interp, float host_time, float value, float now );
+
+/**
+ * Function Setpoint_Interpolator_Target returns the unsmoothed target at device time now.
+ */
+float Setpoint_Interpolator_Target( const Setpoint_Interpolator_t* p_interp, float now );
+
+/**
+ * Function Setpoint_Interpolator_Update steps the output toward the target within the limits and returns it.
+ * @param p_interp pointer to the interpolator
+ * @param now device time (s)
+ * @param dt seconds since the last update
+ * @return smoothed setpoint
+ */
+float Setpoint_Interpolator_Update( Setpoint_Interpolator_t* p_interp, float now, float dt );
+
+/**
+ * Function Setpoint_Interpolator_Active returns true while a stream is live or the output has not yet come to rest at
+ * zero after one ended.
+ */
+bool Setpoint_Interpolator_Active( const Setpoint_Interpolator_t* p_interp, float now );
+
+#endif